@@ -14,6 +14,36 @@
 
 namespace leveldb {
 
+namespace {
+class RateLimitedFile : public WritableFile {
+ public:
+  RateLimitedFile(WritableFile* base, RateLimiter* limiter,
+                  RateLimiter::Priority pri)
+      : base_(base), limiter_(limiter), pri_(pri) {
+  }
+  virtual ~RateLimitedFile() { delete base_; }
+
+  virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size(), pri_);
+    return base_->Append(data);
+  }
+  virtual Status Close() { return base_->Close(); }
+  virtual Status Flush() { return base_->Flush(); }
+  virtual Status Sync() { return base_->Sync(); }
+
+ private:
+  WritableFile* const base_;
+  RateLimiter* const limiter_;
+  const RateLimiter::Priority pri_;
+};
+}
+
+WritableFile* NewRateLimitedFile(WritableFile* base,
+                                 RateLimiter* limiter,
+                                 RateLimiter::Priority pri) {
+  return new RateLimitedFile(base, limiter, pri);
+}
+
 Status BuildTable(const std::string& dbname,
                   Env* env,
                   const Options& options,
@@ -31,6 +61,9 @@ Status BuildTable(const std::string& dbname,
     if (!s.ok()) {
       return s;
     }
+    if (options.rate_limiter != NULL) {
+      file = NewRateLimitedFile(file, options.rate_limiter, RateLimiter::kHigh);
+    }
 
     TableBuilder* builder = new TableBuilder(options, file);
     meta->smallest.DecodeFrom(iter->key());
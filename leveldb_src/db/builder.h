@@ -5,6 +5,7 @@
 #ifndef STORAGE_LEVELDB_DB_BUILDER_H_
 #define STORAGE_LEVELDB_DB_BUILDER_H_
 
+#include "leveldb/rate_limiter.h"
 #include "leveldb/status.h"
 
 namespace leveldb {
@@ -16,6 +17,7 @@ class Env;
 class Iterator;
 class TableCache;
 class VersionEdit;
+class WritableFile;
 
 // Build a Table file from the contents of *iter.  The generated file
 // will be named according to meta->number.  On success, the rest of
@@ -29,6 +31,12 @@ extern Status BuildTable(const std::string& dbname,
                          Iterator* iter,
                          FileMetaData* meta);
 
+// Return a file that passes every write on to "base" once "limiter"
+// lets it through at priority "pri".  The result owns "base".
+extern WritableFile* NewRateLimitedFile(WritableFile* base,
+                                        RateLimiter* limiter,
+                                        RateLimiter::Priority pri);
+
 }
 
 #endif  // STORAGE_LEVELDB_DB_BUILDER_H_
@@ -16,6 +16,7 @@
 #include "leveldb/write_batch.h"
 
 using leveldb::Cache;
+using leveldb::CompactRangeOptions;
 using leveldb::Comparator;
 using leveldb::CompressionType;
 using leveldb::DB;
@@ -44,6 +45,7 @@ struct leveldb_writebatch_t   { WriteBatch        rep; };
 struct leveldb_snapshot_t     { const Snapshot*   rep; };
 struct leveldb_readoptions_t  { ReadOptions       rep; };
 struct leveldb_writeoptions_t { WriteOptions      rep; };
+struct leveldb_compactrangeoptions_t { CompactRangeOptions rep; };
 struct leveldb_options_t      { Options           rep; };
 struct leveldb_cache_t        { Cache*            rep; };
 struct leveldb_seqfile_t      { SequentialFile*   rep; };
@@ -218,6 +220,20 @@ void leveldb_approximate_sizes(
   delete[] ranges;
 }
 
+void leveldb_compact_range(
+    leveldb_t* db,
+    const leveldb_compactrangeoptions_t* options,
+    const char* start_key, size_t start_key_len,
+    const char* limit_key, size_t limit_key_len,
+    char** errptr) {
+  Slice a, b;
+  SaveError(errptr, db->rep->CompactRange(
+      // Pass NULL Slice if corresponding "const char*" is NULL
+      (start_key ? (a = Slice(start_key, start_key_len), &a) : NULL),
+      (limit_key ? (b = Slice(limit_key, limit_key_len), &b) : NULL),
+      options->rep));
+}
+
 void leveldb_destroy_db(
     const leveldb_options_t* options,
     const char* name,
@@ -432,6 +448,28 @@ void leveldb_readoptions_set_snapshot(
   opt->rep.snapshot = (snap ? snap->rep : NULL);
 }
 
+leveldb_compactrangeoptions_t* leveldb_compactrangeoptions_create() {
+  return new leveldb_compactrangeoptions_t;
+}
+
+void leveldb_compactrangeoptions_destroy(
+    leveldb_compactrangeoptions_t* opt) {
+  delete opt;
+}
+
+void leveldb_compactrangeoptions_set_rewrite_bottommost(
+    leveldb_compactrangeoptions_t* opt, unsigned char v) {
+  opt->rep.rewrite_bottommost = v;
+}
+
+void leveldb_compactrangeoptions_set_progress(
+    leveldb_compactrangeoptions_t* opt,
+    void* state,
+    void (*progress)(void*, int done, int total)) {
+  opt->rep.progress = progress;
+  opt->rep.progress_arg = state;
+}
+
 leveldb_writeoptions_t* leveldb_writeoptions_create() {
   return new leveldb_writeoptions_t;
 }
@@ -245,6 +245,20 @@ int main(int argc, char** argv) {
     CheckCondition(sizes[1] > 0);
   }
 
+  StartPhase("compact_range");
+  {
+    leveldb_compactrangeoptions_t* coptions =
+        leveldb_compactrangeoptions_create();
+    leveldb_compactrangeoptions_set_rewrite_bottommost(coptions, 1);
+    leveldb_compact_range(db, coptions, NULL, 0, "k00000000000000010000", 21,
+                          &err);
+    CheckNoError(err);
+    leveldb_compact_range(db, coptions, NULL, 0, NULL, 0, &err);
+    CheckNoError(err);
+    leveldb_compactrangeoptions_destroy(coptions);
+    CheckGet(db, roptions, "foo", "hello");
+  }
+
   StartPhase("property");
   {
     char* prop = leveldb_property_value(db, "nosuchprop");
@@ -319,6 +319,7 @@ TEST(CorruptionTest, CompactionInputErrorParanoid) {
     dbi->Put(WriteOptions(), "~", "end");
     dbi->TEST_CompactMemTable();
   }
+  dbi->TEST_WaitForBackgroundWork();
 
   Build(10);
   dbi->TEST_CompactMemTable();
@@ -10,8 +10,10 @@
 #include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/write_batch.h"
 #include "port/port.h"
+#include "util/coding.h"
 #include "util/crc32c.h"
 #include "util/histogram.h"
 #include "util/mutexlock.h"
@@ -31,6 +33,7 @@
 //      readhot       -- read N times in random order from 1% section of DB
 //      crc32c        -- repeated crc32c of 4K of data
 //      acquireload   -- load N*1000 times
+//      cachecontended -- N lookups per thread of entries in a shared cache
 //   Meta operations:
 //      compact     -- Compact the entire DB
 //      stats       -- Print DB stats
@@ -82,9 +85,43 @@ static int FLAGS_write_buffer_size = 0;
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// If true, use a CLOCK cache (NewClockCache) instead of an LRU cache.
+static bool FLAGS_clock_cache = false;
+
+// Number of shard bits of a CLOCK cache.  The LRU cache always uses 16
+// shards.
+static int FLAGS_cache_numshardbits = 4;
+
+// Fraction of an LRU cache reserved for entries that have been hit.
+static double FLAGS_cache_high_pri_pool_ratio = 0.0;
+
+// Number of bytes to use as a cache of compressed data (0 means none).
+static int FLAGS_compressed_cache_size = 0;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
+// Number of background compactions that may run at the same time
+static int FLAGS_max_background_compactions = 0;
+
+// Number of threads a single compaction may be split across
+static int FLAGS_max_subcompactions = 0;
+
+// Bytes per second that flushes and compactions may write (0 means no limit)
+static int FLAGS_rate_limit = 0;
+
+// Bytes that compactions read ahead from their inputs (0 means no readahead)
+static int FLAGS_compaction_readahead_size = 0;
+
+// Compaction style: 0 for leveled, 1 for universal, 2 for FIFO
+static int FLAGS_compaction_style = 0;
+
+// If true, level size limits follow the size of the largest level
+static bool FLAGS_level_compaction_dynamic_level_bytes = false;
+
+// Number of data blocks that sequential reads prefetch in the background
+static int FLAGS_prefetch_blocks = 0;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -290,9 +327,22 @@ struct ThreadState {
 
 }
 
+static Cache* NewBenchmarkCache(size_t capacity) {
+  if (FLAGS_clock_cache) {
+    return NewClockCache(capacity, FLAGS_cache_numshardbits);
+  }
+  return NewLRUCache(capacity, FLAGS_cache_high_pri_pool_ratio);
+}
+
+static void DeleteNothing(const Slice& key, void* value) {
+}
+
 class Benchmark {
  private:
   Cache* cache_;
+  Cache* compressed_cache_;
+  Cache* contended_cache_;
+  RateLimiter* rate_limiter_;
   DB* db_;
   int num_;
   int value_size_;
@@ -377,7 +427,12 @@ class Benchmark {
 
  public:
   Benchmark()
-  : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
+  : cache_(FLAGS_cache_size >= 0 ? NewBenchmarkCache(FLAGS_cache_size) : NULL),
+    compressed_cache_(FLAGS_compressed_cache_size > 0 ?
+                      NewBenchmarkCache(FLAGS_compressed_cache_size) : NULL),
+    contended_cache_(NULL),
+    rate_limiter_(FLAGS_rate_limit > 0 ?
+                  NewGenericRateLimiter(FLAGS_rate_limit) : NULL),
     db_(NULL),
     num_(FLAGS_num),
     value_size_(FLAGS_value_size),
@@ -399,6 +454,9 @@ class Benchmark {
   ~Benchmark() {
     delete db_;
     delete cache_;
+    delete compressed_cache_;
+    delete contended_cache_;
+    delete rate_limiter_;
   }
 
   void Run() {
@@ -471,6 +529,9 @@ class Benchmark {
         method = &Benchmark::Crc32c;
       } else if (name == Slice("acquireload")) {
         method = &Benchmark::AcquireLoad;
+      } else if (name == Slice("cachecontended")) {
+        FillContendedCache();
+        method = &Benchmark::CacheContended;
       } else if (name == Slice("snappycomp")) {
         method = &Benchmark::SnappyCompress;
       } else if (name == Slice("snappyuncomp")) {
@@ -616,6 +677,44 @@ class Benchmark {
     if (ptr == NULL) exit(1); // Disable unused variable warning.
   }
 
+  static const int kContendedCacheEntries = 10000;
+
+  static std::string ContendedCacheKey(int k) {
+    // Same shape as a block cache key: cache id followed by offset
+    char buf[16];
+    EncodeFixed64(buf, 1);
+    EncodeFixed64(buf + 8, static_cast<uint64_t>(k) * 4096);
+    return std::string(buf, sizeof(buf));
+  }
+
+  void FillContendedCache() {
+    delete contended_cache_;
+    // Leave slack so that uneven sharding does not evict anything
+    contended_cache_ = NewBenchmarkCache(2 * kContendedCacheEntries);
+    for (int k = 0; k < kContendedCacheEntries; k++) {
+      contended_cache_->Release(contended_cache_->Insert(
+          ContendedCacheKey(k), NULL, 1, &DeleteNothing));
+    }
+  }
+
+  // Every thread looks up entries of a cache that holds all of them, so
+  // all lookups are hits and only contend on the cache itself.
+  void CacheContended(ThreadState* thread) {
+    int found = 0;
+    for (int i = 0; i < reads_; i++) {
+      const int k = thread->rand.Next() % kContendedCacheEntries;
+      Cache::Handle* h = contended_cache_->Lookup(ContendedCacheKey(k));
+      if (h != NULL) {
+        found++;
+        contended_cache_->Release(h);
+      }
+      thread->stats.FinishedSingleOp();
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", found, reads_);
+    thread->stats.AddMessage(msg);
+  }
+
   void SnappyCompress(ThreadState* thread) {
     RandomGenerator gen;
     Slice input = gen.Generate(Options().block_size);
@@ -668,7 +767,16 @@ class Benchmark {
     Options options;
     options.create_if_missing = !FLAGS_use_existing_db;
     options.block_cache = cache_;
+    options.block_cache_compressed = compressed_cache_;
     options.write_buffer_size = FLAGS_write_buffer_size;
+    options.max_background_compactions = FLAGS_max_background_compactions;
+    options.max_subcompactions = FLAGS_max_subcompactions;
+    options.rate_limiter = rate_limiter_;
+    options.compaction_readahead_size = FLAGS_compaction_readahead_size;
+    options.compaction_style =
+        static_cast<CompactionStyle>(FLAGS_compaction_style);
+    options.level_compaction_dynamic_level_bytes =
+        FLAGS_level_compaction_dynamic_level_bytes;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -715,7 +823,9 @@ class Benchmark {
   }
 
   void ReadSequential(ThreadState* thread) {
-    Iterator* iter = db_->NewIterator(ReadOptions());
+    ReadOptions options;
+    options.prefetch_blocks = FLAGS_prefetch_blocks;
+    Iterator* iter = db_->NewIterator(options);
     int i = 0;
     int64_t bytes = 0;
     for (iter->SeekToFirst(); i < reads_ && iter->Valid(); iter->Next()) {
@@ -796,19 +906,10 @@ class Benchmark {
   }
 
   void Compact(ThreadState* thread) {
-    DBImpl* dbi = reinterpret_cast<DBImpl*>(db_);
-    dbi->TEST_CompactMemTable();
-    int max_level_with_files = 1;
-    for (int level = 1; level < config::kNumLevels; level++) {
-      std::string property;
-      char name[100];
-      snprintf(name, sizeof(name), "leveldb.num-files-at-level%d", level);
-      if (db_->GetProperty(name, &property) && atoi(property.c_str()) > 0) {
-        max_level_with_files = level;
-      }
-    }
-    for (int level = 0; level < max_level_with_files; level++) {
-      dbi->TEST_CompactRange(level, "", "~");
+    Status s = db_->CompactRange(NULL, NULL, CompactRangeOptions());
+    if (!s.ok()) {
+      fprintf(stderr, "compact error: %s\n", s.ToString().c_str());
+      exit(1);
     }
   }
 
@@ -847,6 +948,10 @@ class Benchmark {
 int main(int argc, char** argv) {
   FLAGS_write_buffer_size = leveldb::Options().write_buffer_size;
   FLAGS_open_files = leveldb::Options().max_open_files;
+  FLAGS_max_background_compactions =
+      leveldb::Options().max_background_compactions;
+  FLAGS_max_subcompactions = leveldb::Options().max_subcompactions;
+  FLAGS_compaction_style = leveldb::Options().compaction_style;
 
   for (int i = 1; i < argc; i++) {
     double d;
@@ -856,6 +961,9 @@ int main(int argc, char** argv) {
       FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
     } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
       FLAGS_compression_ratio = d;
+    } else if (sscanf(argv[i], "--cache_high_pri_pool_ratio=%lf%c",
+                      &d, &junk) == 1) {
+      FLAGS_cache_high_pri_pool_ratio = d;
     } else if (sscanf(argv[i], "--histogram=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_histogram = n;
@@ -874,8 +982,33 @@ int main(int argc, char** argv) {
       FLAGS_write_buffer_size = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--clock_cache=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_clock_cache = n;
+    } else if (sscanf(argv[i], "--cache_numshardbits=%d%c", &n, &junk) == 1) {
+      FLAGS_cache_numshardbits = n;
+    } else if (sscanf(argv[i], "--compressed_cache_size=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_compressed_cache_size = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (sscanf(argv[i], "--max_background_compactions=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_max_background_compactions = n;
+    } else if (sscanf(argv[i], "--max_subcompactions=%d%c", &n, &junk) == 1) {
+      FLAGS_max_subcompactions = n;
+    } else if (sscanf(argv[i], "--rate_limit=%d%c", &n, &junk) == 1) {
+      FLAGS_rate_limit = n;
+    } else if (sscanf(argv[i], "--compaction_readahead_size=%d%c",
+                      &n, &junk) == 1) {
+      FLAGS_compaction_readahead_size = n;
+    } else if (sscanf(argv[i], "--compaction_style=%d%c", &n, &junk) == 1) {
+      FLAGS_compaction_style = n;
+    } else if (sscanf(argv[i], "--level_compaction_dynamic_level_bytes=%d%c",
+                      &n, &junk) == 1 && (n == 0 || n == 1)) {
+      FLAGS_level_compaction_dynamic_level_bytes = n;
+    } else if (sscanf(argv[i], "--prefetch_blocks=%d%c", &n, &junk) == 1) {
+      FLAGS_prefetch_blocks = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
     } else {
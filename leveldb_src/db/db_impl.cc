@@ -5,10 +5,12 @@
 #include "db/db_impl.h"
 
 #include <algorithm>
+#include <deque>
 #include <set>
 #include <string>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 #include <vector>
 #include "db/builder.h"
 #include "db/db_iter.h"
@@ -20,6 +22,7 @@
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/status.h"
@@ -44,6 +47,10 @@ struct DBImpl::CompactionState {
   // we can drop all entries for the same key with sequence numbers < S.
   SequenceNumber smallest_snapshot;
 
+  // No snapshot sees entries with larger sequence numbers.  Zero if
+  // there are no snapshots.
+  SequenceNumber newest_snapshot;
+
   // Files produced by compaction
   struct Output {
     uint64_t number;
@@ -58,16 +65,40 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // If non-zero, the number the first output file must use.  It is
+  // kept in pending_outputs_ until it is used or the state is cleaned up.
+  uint64_t reserved_number;
+
+  // When the compaction is split into subcompactions, each one has its
+  // own state, covering the user keys in [*begin,*end).  NULL means
+  // unbounded.
+  const std::string* begin;
+  const std::string* end;
+  Compaction::Cursor cursor;
+
+  FilterStats filter_stats;
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        reserved_number(0),
+        begin(NULL),
+        end(NULL) {
   }
 };
 
+// A subcompaction run by a thread of its own
+struct DBImpl::Subcompaction {
+  DBImpl* db;
+  CompactionState* state;
+  Status status;
+  bool done;
+};
+
 // Fix user-supplied options to be reasonable
 template <class T,class V>
 static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
@@ -79,9 +110,22 @@ Options SanitizeOptions(const std::string& dbname,
                         const Options& src) {
   Options result = src;
   result.comparator = icmp;
-  ClipToRange(&result.max_open_files,           20,     50000);
-  ClipToRange(&result.write_buffer_size,        64<<10, 1<<30);
-  ClipToRange(&result.block_size,               1<<10,  4<<20);
+  ClipToRange(&result.max_open_files,             20,     50000);
+  ClipToRange(&result.write_buffer_size,          64<<10, 1<<30);
+  ClipToRange(&result.block_size,                 1<<10,  4<<20);
+  ClipToRange(&result.max_file_opening_threads,   1,      64);
+  ClipToRange(&result.max_background_compactions, 1,      64);
+  ClipToRange(&result.max_subcompactions,         1,      64);
+  ClipToRange(&result.max_bytes_for_level_multiplier, 2,  1000);
+  ClipToRange(&result.target_file_size_multiplier, 1,     1000);
+  ClipToRange(&result.target_file_size_base,      4ULL<<10,  1ULL<<30);
+  ClipToRange(&result.max_bytes_for_level_base,   64ULL<<10, 1ULL<<40);
+  ClipToRange(&result.universal_size_ratio,       0,      1000);
+  ClipToRange(&result.universal_min_merge_width,  2,      1000);
+  ClipToRange(&result.universal_max_merge_width,
+              result.universal_min_merge_width,           1000);
+  ClipToRange(&result.universal_max_size_amplification_percent, 0, 1<<20);
+  ClipToRange(&result.fifo_max_table_files,       4,      1<<20);
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -110,15 +154,20 @@ DBImpl::DBImpl(const Options& options, const std::string& dbname)
       bg_cv_(&mutex_),
       mem_(new MemTable(internal_comparator_)),
       imm_(NULL),
+      imm_switch_micros_(0),
       logfile_(NULL),
       logfile_number_(0),
       log_(NULL),
       logger_(NULL),
       logger_cv_(&mutex_),
-      bg_compaction_scheduled_(false),
-      manual_compaction_(NULL) {
+      bg_compaction_scheduled_(0),
+      bg_flush_scheduled_(false),
+      imm_flushing_(false),
+      ttl_thread_running_(false),
+      compactions_held_(false),
+      manual_compaction_(NULL),
+      iterator_reseeks_(0) {
   mem_->Ref();
-  has_imm_.Release_Store(NULL);
 
   // Reserve ten files or so for other uses and give the rest to TableCache.
   const int table_cache_size = options.max_open_files - 10;
@@ -126,13 +175,18 @@ DBImpl::DBImpl(const Options& options, const std::string& dbname)
 
   versions_ = new VersionSet(dbname_, &options_, table_cache_,
                              &internal_comparator_);
+  env_->SetBackgroundThreads(options_.max_background_compactions);
+  if (options_.mmap_read_budget > 0) {
+    env_->SetMmapReadBudget(options_.mmap_read_budget);
+  }
 }
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_) {
+  while (bg_compaction_scheduled_ > 0 || bg_flush_scheduled_ ||
+         ttl_thread_running_) {
     bg_cv_.Wait();
   }
   mutex_.Unlock();
@@ -277,7 +331,9 @@ Status DBImpl::Recover(VersionEdit* edit) {
     }
   }
 
+  const uint64_t manifest_start_micros = env_->NowMicros();
   s = versions_->Recover();
+  recovery_stats_.manifest_micros = env_->NowMicros() - manifest_start_micros;
   if (s.ok()) {
     SequenceNumber max_sequence(0);
 
@@ -308,14 +364,9 @@ Status DBImpl::Recover(VersionEdit* edit) {
 
     // Recover in the order in which the logs were generated
     std::sort(logs.begin(), logs.end());
-    for (size_t i = 0; i < logs.size(); i++) {
-      s = RecoverLogFile(logs[i], edit, &max_sequence);
-
-      // The previous incarnation may not have written any MANIFEST
-      // records after allocating this log number.  So we manually
-      // update the file number allocation counter in VersionSet.
-      versions_->MarkFileNumberUsed(logs[i]);
-    }
+    const uint64_t logs_start_micros = env_->NowMicros();
+    s = RecoverLogFiles(logs, edit, &max_sequence);
+    recovery_stats_.logs_micros = env_->NowMicros() - logs_start_micros;
 
     if (s.ok()) {
       if (versions_->LastSequence() < max_sequence) {
@@ -324,56 +375,140 @@ Status DBImpl::Recover(VersionEdit* edit) {
     }
   }
 
+  if (s.ok()) {
+    const RecoveryStats& r = recovery_stats_;
+    Log(options_.info_log,
+        "Recovered manifest in %llu us and %d logs (%llu records, "
+        "%llu bytes, %d tables) in %llu us: decode %llu us on %d threads, "
+        "insert %llu us, flush %llu us; waited %llu us for decode, "
+        "%llu us for flush",
+        (unsigned long long) r.manifest_micros,
+        r.logs,
+        (unsigned long long) r.records,
+        (unsigned long long) r.bytes,
+        r.tables,
+        (unsigned long long) r.logs_micros,
+        (unsigned long long) r.decode_micros,
+        r.decode_threads,
+        (unsigned long long) r.insert_micros,
+        (unsigned long long) r.flush_micros,
+        (unsigned long long) r.decode_wait_micros,
+        (unsigned long long) r.flush_wait_micros);
+  }
   return s;
 }
 
-Status DBImpl::RecoverLogFile(uint64_t log_number,
-                              VersionEdit* edit,
-                              SequenceNumber* max_sequence) {
-  struct LogReporter : public log::Reader::Reporter {
-    Env* env;
-    Logger* info_log;
-    const char* fname;
-    Status* status;  // NULL if options_.paranoid_checks==false
-    virtual void Corruption(size_t bytes, const Status& s) {
-      Log(info_log, "%s%s: dropping %d bytes; %s",
-          (this->status == NULL ? "(ignoring error) " : ""),
-          fname, static_cast<int>(bytes), s.ToString().c_str());
-      if (this->status != NULL && this->status->ok()) *this->status = s;
-    }
-  };
+// Log records are decoded and checksummed on up to this many threads
+// while recovery inserts the records of earlier logs into memtables.
+static const int kMaxLogDecodeThreads = 4;
 
-  mutex_.AssertHeld();
+// Records handed from a log decoding thread to the recovering thread
+static const size_t kRecordChunkBytes = 256 << 10;
+
+namespace {
+struct RecordChunk {
+  std::vector<std::string> records;
+  size_t bytes;
+};
 
-  // Open the log file
-  std::string fname = LogFileName(dbname_, log_number);
+struct DecodedLog {
+  uint64_t number;
+  std::deque<RecordChunk*> chunks;  // Decoded but not yet replayed
+  size_t pending_bytes;             // Sum of the chunks' bytes
+  Status status;
+  bool done;                        // No more chunks will be added
+};
+
+// Shared by the threads started by DBImpl::RecoverLogFiles()
+struct LogDecodeState {
+  port::Mutex mu;
+  port::CondVar cv;
+  Env* env;
+  Logger* info_log;
+  std::string dbname;
+  bool paranoid_checks;
+  size_t max_pending_bytes;
+  std::vector<DecodedLog> logs;
+  size_t next_decode;               // Index of the next log to decode
+  size_t next_replay;               // Index of the log being replayed
+  size_t pending_bytes;             // Sum of the logs' pending_bytes
+  bool abort;
+  int threads_running;
+  uint64_t decode_micros;           // Summed over all threads
+
+  LogDecodeState() : cv(&mu) { }
+
+  // The log being replayed may always run ahead up to the limit so that
+  // the logs after it cannot starve it.
+  bool MustWait(size_t index) const {
+    const DecodedLog& log = logs[index];
+    return !abort &&
+        (log.pending_bytes >= max_pending_bytes ||
+         (index != next_replay && pending_bytes >= max_pending_bytes));
+  }
+};
+
+struct LogReporter : public log::Reader::Reporter {
+  Logger* info_log;
+  const char* fname;
+  Status* status;  // NULL if options_.paranoid_checks==false
+  virtual void Corruption(size_t bytes, const Status& s) {
+    Log(info_log, "%s%s: dropping %d bytes; %s",
+        (this->status == NULL ? "(ignoring error) " : ""),
+        fname, static_cast<int>(bytes), s.ToString().c_str());
+    if (this->status != NULL && this->status->ok()) *this->status = s;
+  }
+};
+}
+
+// Hand "chunk" over to the recovering thread.  Returns false if
+// recovery has been aborted.  REQUIRES: state->mu held.
+static bool PublishChunk(LogDecodeState* state, size_t index,
+                         RecordChunk* chunk) {
+  DecodedLog* log = &state->logs[index];
+  while (state->MustWait(index)) {
+    state->cv.Wait();
+  }
+  if (state->abort) {
+    delete chunk;
+    return false;
+  }
+  log->chunks.push_back(chunk);
+  log->pending_bytes += chunk->bytes;
+  state->pending_bytes += chunk->bytes;
+  state->cv.SignalAll();
+  return true;
+}
+
+// Read all the records of the log at "index" and publish them in chunks.
+static void DecodeLogFile(LogDecodeState* state, size_t index) {
+  DecodedLog* log = &state->logs[index];
+  std::string fname = LogFileName(state->dbname, log->number);
   SequentialFile* file;
-  Status status = env_->NewSequentialFile(fname, &file);
+  Status status = state->env->NewSequentialFile(fname, &file);
   if (!status.ok()) {
-    MaybeIgnoreError(&status);
-    return status;
+    MutexLock l(&state->mu);
+    log->status = status;
+    return;
   }
 
-  // Create the log reader.
   LogReporter reporter;
-  reporter.env = env_;
-  reporter.info_log = options_.info_log;
+  reporter.info_log = state->info_log;
   reporter.fname = fname.c_str();
-  reporter.status = (options_.paranoid_checks ? &status : NULL);
+  reporter.status = (state->paranoid_checks ? &status : NULL);
   // We intentially make log::Reader do checksumming even if
   // paranoid_checks==false so that corruptions cause entire commits
   // to be skipped instead of propagating bad information (like overly
   // large sequence numbers).
   log::Reader reader(file, &reporter, true/*checksum*/,
                      0/*initial_offset*/);
-  Log(options_.info_log, "Recovering log #%llu",
-      (unsigned long long) log_number);
+  Log(state->info_log, "Recovering log #%llu",
+      (unsigned long long) log->number);
 
-  // Read all the records and add to a memtable
   std::string scratch;
   Slice record;
-  WriteBatch batch;
-  MemTable* mem = NULL;
+  RecordChunk* chunk = NULL;
+  bool aborted = false;
   while (reader.ReadRecord(&record, &scratch) &&
          status.ok()) {
     if (record.size() < 12) {
@@ -381,49 +516,247 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
           record.size(), Status::Corruption("log record too small"));
       continue;
     }
-    WriteBatchInternal::SetContents(&batch, record);
-
-    if (mem == NULL) {
-      mem = new MemTable(internal_comparator_);
-      mem->Ref();
-    }
-    status = WriteBatchInternal::InsertInto(&batch, mem);
-    MaybeIgnoreError(&status);
-    if (!status.ok()) {
-      break;
+    if (chunk == NULL) {
+      chunk = new RecordChunk;
+      chunk->bytes = 0;
     }
-    const SequenceNumber last_seq =
-        WriteBatchInternal::Sequence(&batch) +
-        WriteBatchInternal::Count(&batch) - 1;
-    if (last_seq > *max_sequence) {
-      *max_sequence = last_seq;
+    chunk->records.push_back(record.ToString());
+    chunk->bytes += record.size();
+    if (chunk->bytes >= kRecordChunkBytes) {
+      MutexLock l(&state->mu);
+      if (!PublishChunk(state, index, chunk)) {
+        aborted = true;
+      }
+      chunk = NULL;
+      if (aborted) break;
     }
+  }
+  delete file;
 
-    if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
-      status = WriteLevel0Table(mem, edit, NULL);
-      if (!status.ok()) {
-        // Reflect errors immediately so that conditions like full
-        // file-systems cause the DB::Open() to fail.
+  MutexLock l(&state->mu);
+  if (chunk != NULL) {
+    PublishChunk(state, index, chunk);
+  }
+  log->status = status;
+}
+
+static void DecodeLogWork(void* arg) {
+  LogDecodeState* state = reinterpret_cast<LogDecodeState*>(arg);
+  state->mu.Lock();
+  while (!state->abort && state->next_decode < state->logs.size()) {
+    const size_t index = state->next_decode++;
+    state->mu.Unlock();
+    const uint64_t start_micros = state->env->NowMicros();
+    DecodeLogFile(state, index);
+    const uint64_t micros = state->env->NowMicros() - start_micros;
+    state->mu.Lock();
+    state->logs[index].done = true;
+    state->decode_micros += micros;
+    state->cv.SignalAll();
+  }
+  state->threads_running--;
+  state->cv.SignalAll();
+  state->mu.Unlock();
+}
+
+// A memtable filled during recovery that is being written to a level-0
+// table while the records that follow it are inserted into a new one.
+struct DBImpl::RecoveryFlush {
+  DBImpl* db;
+  VersionEdit* edit;
+  MemTable* mem;
+  bool running;
+  Status status;        // First error of any flush
+};
+
+void DBImpl::RecoveryFlushWork(void* arg) {
+  RecoveryFlush* flush = reinterpret_cast<RecoveryFlush*>(arg);
+  DBImpl* db = flush->db;
+  MutexLock l(&db->mutex_);
+  const uint64_t start_micros = db->env_->NowMicros();
+  Status s = db->WriteLevel0Table(flush->mem, flush->edit, NULL);
+  db->recovery_stats_.flush_micros += db->env_->NowMicros() - start_micros;
+  db->recovery_stats_.tables++;
+  if (flush->status.ok()) {
+    flush->status = s;
+  }
+  flush->mem->Unref();
+  flush->mem = NULL;
+  flush->running = false;
+  db->bg_cv_.SignalAll();
+}
+
+// Wait for the flush started by RecoverLogFiles(), if any, to finish.
+// REQUIRES: mutex_ held.
+void DBImpl::WaitForRecoveryFlush(RecoveryFlush* flush) {
+  mutex_.AssertHeld();
+  const uint64_t start_micros = env_->NowMicros();
+  while (flush->running) {
+    bg_cv_.Wait();
+  }
+  recovery_stats_.flush_wait_micros += env_->NowMicros() - start_micros;
+}
+
+Status DBImpl::RecoverLogFiles(const std::vector<uint64_t>& logs,
+                               VersionEdit* edit,
+                               SequenceNumber* max_sequence) {
+  mutex_.AssertHeld();
+  if (logs.empty()) {
+    return Status::OK();
+  }
+
+  // The previous incarnation may not have written any MANIFEST
+  // records after allocating these log numbers.  So we manually
+  // update the file number allocation counter in VersionSet before
+  // any table file numbers are allocated below.
+  for (size_t i = 0; i < logs.size(); i++) {
+    versions_->MarkFileNumberUsed(logs[i]);
+  }
+
+  LogDecodeState state;
+  state.env = env_;
+  state.info_log = options_.info_log;
+  state.dbname = dbname_;
+  state.paranoid_checks = options_.paranoid_checks;
+  state.max_pending_bytes = std::max(options_.write_buffer_size,
+                                     4 * kRecordChunkBytes);
+  state.logs.resize(logs.size());
+  for (size_t i = 0; i < logs.size(); i++) {
+    state.logs[i].number = logs[i];
+    state.logs[i].pending_bytes = 0;
+    state.logs[i].done = false;
+  }
+  state.next_decode = 0;
+  state.next_replay = 0;
+  state.pending_bytes = 0;
+  state.abort = false;
+  state.decode_micros = 0;
+  const int threads = std::min(static_cast<int>(logs.size()),
+                               kMaxLogDecodeThreads);
+  state.threads_running = threads;
+  for (int i = 0; i < threads; i++) {
+    env_->StartThread(&DecodeLogWork, &state);
+  }
+  recovery_stats_.logs = static_cast<int>(logs.size());
+  recovery_stats_.decode_threads = threads;
+
+  RecoveryFlush flush;
+  flush.db = this;
+  flush.edit = edit;
+  flush.mem = NULL;
+  flush.running = false;
+
+  // Nothing else can use the DB before DB::Open returns, so the records
+  // are inserted without holding mutex_.  It is only needed for the
+  // table builds, which run concurrently with the inserts.
+  mutex_.Unlock();
+  Status status;
+  MemTable* mem = NULL;
+  WriteBatch batch;
+  state.mu.Lock();
+  for (size_t i = 0; i < logs.size() && status.ok(); i++) {
+    DecodedLog* log = &state.logs[i];
+    state.next_replay = i;
+    state.cv.SignalAll();
+    while (status.ok()) {
+      const uint64_t wait_start_micros = env_->NowMicros();
+      while (log->chunks.empty() && !log->done) {
+        state.cv.Wait();
+      }
+      recovery_stats_.decode_wait_micros +=
+          env_->NowMicros() - wait_start_micros;
+      if (log->chunks.empty()) {
+        status = log->status;
+        MaybeIgnoreError(&status);
         break;
       }
-      mem->Unref();
-      mem = NULL;
+      RecordChunk* chunk = log->chunks.front();
+      log->chunks.pop_front();
+      log->pending_bytes -= chunk->bytes;
+      state.pending_bytes -= chunk->bytes;
+      state.cv.SignalAll();
+      state.mu.Unlock();
+
+      // Add the records to the memtable, flushing it whenever it fills up
+      const uint64_t start_micros = env_->NowMicros();
+      for (size_t r = 0; r < chunk->records.size(); r++) {
+        WriteBatchInternal::SetContents(&batch, chunk->records[r]);
+        if (mem == NULL) {
+          mem = new MemTable(internal_comparator_);
+          mem->Ref();
+        }
+        status = WriteBatchInternal::InsertInto(&batch, mem);
+        MaybeIgnoreError(&status);
+        if (!status.ok()) {
+          break;
+        }
+        const SequenceNumber last_seq =
+            WriteBatchInternal::Sequence(&batch) +
+            WriteBatchInternal::Count(&batch) - 1;
+        if (last_seq > *max_sequence) {
+          *max_sequence = last_seq;
+        }
+        recovery_stats_.records++;
+
+        if (mem->ApproximateMemoryUsage() > options_.write_buffer_size) {
+          mutex_.Lock();
+          WaitForRecoveryFlush(&flush);
+          // Reflect errors immediately so that conditions like full
+          // file-systems cause the DB::Open() to fail.
+          status = flush.status;
+          if (status.ok()) {
+            flush.mem = mem;
+            flush.running = true;
+            mem = NULL;
+            env_->StartThread(&DBImpl::RecoveryFlushWork, &flush);
+          }
+          mutex_.Unlock();
+          if (!status.ok()) {
+            break;
+          }
+        }
+      }
+      recovery_stats_.insert_micros += env_->NowMicros() - start_micros;
+      recovery_stats_.bytes += chunk->bytes;
+      delete chunk;
+      state.mu.Lock();
     }
   }
 
+  // Stop the decoding threads and drop whatever they left behind
+  state.abort = true;
+  state.cv.SignalAll();
+  while (state.threads_running > 0) {
+    state.cv.Wait();
+  }
+  for (size_t i = 0; i < state.logs.size(); i++) {
+    while (!state.logs[i].chunks.empty()) {
+      delete state.logs[i].chunks.front();
+      state.logs[i].chunks.pop_front();
+    }
+  }
+  recovery_stats_.decode_micros = state.decode_micros;
+  state.mu.Unlock();
+
+  mutex_.Lock();
+  WaitForRecoveryFlush(&flush);
+  if (status.ok()) {
+    status = flush.status;
+  }
   if (status.ok() && mem != NULL) {
-    status = WriteLevel0Table(mem, edit, NULL);
     // Reflect errors immediately so that conditions like full
     // file-systems cause the DB::Open() to fail.
+    const uint64_t start_micros = env_->NowMicros();
+    status = WriteLevel0Table(mem, edit, NULL);
+    recovery_stats_.flush_micros += env_->NowMicros() - start_micros;
+    recovery_stats_.tables++;
   }
-
   if (mem != NULL) mem->Unref();
-  delete file;
   return status;
 }
 
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+                                Version* base, uint64_t* pending) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
@@ -445,7 +778,11 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long) meta.file_size,
       s.ToString().c_str());
   delete iter;
-  pending_outputs_.erase(meta.number);
+  if (pending != NULL) {
+    *pending = meta.number;
+  } else {
+    pending_outputs_.erase(meta.number);
+  }
 
 
   // Note that if file_size is zero, the file has been deleted and
@@ -462,8 +799,12 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
         level++;
       }
     }
+    // Only kCompactionStyleFIFO needs to know how old its files are
+    const uint64_t creation_time =
+        (options_.compaction_style == kCompactionStyleFIFO ?
+         static_cast<uint64_t>(time(NULL)) : 0);
     edit->AddFile(level, meta.number, meta.file_size,
-                  meta.smallest, meta.largest);
+                  meta.smallest, meta.largest, creation_time);
   }
 
   CompactionStats stats;
@@ -476,13 +817,36 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
 Status DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
   assert(imm_ != NULL);
+  assert(!imm_flushing_);
+  imm_flushing_ = true;
+  const uint64_t start_micros = env_->NowMicros();
 
-  // Save the contents of the memtable as a new Table
+  // Save the contents of the memtable as a new Table.  It may only be
+  // pushed below level-0 if no compaction is in progress: one could be
+  // writing to the level it would land in.  No compaction starts until
+  // the table is installed.
   VersionEdit edit;
-  Version* base = versions_->current();
-  base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
-  base->Unref();
+  Version* base = NULL;
+  if (options_.compaction_style == kCompactionStyleUniversal) {
+    // The table is a new level-0 run.  A merge of runs picked before it
+    // is installed would take a file number after its own.
+    compactions_held_ = true;
+  } else if (options_.compaction_style == kCompactionStyleFIFO) {
+    // Every table stays in level-0, and compactions only delete the
+    // oldest ones
+  } else if (options_.level_compaction_dynamic_level_bytes) {
+    // Level-0 is compacted straight into the base level, and the levels
+    // above that are kept empty
+  } else if (versions_->NumRunningCompactions() == 0) {
+    base = versions_->current();
+    base->Ref();
+    compactions_held_ = true;
+  }
+  uint64_t number = 0;
+  Status s = WriteLevel0Table(imm_, &edit, base, &number);
+  if (base != NULL) {
+    base->Unref();
+  }
 
   if (s.ok() && shutting_down_.Acquire_Load()) {
     s = Status::IOError("Deleting DB during memtable compaction");
@@ -494,15 +858,103 @@ Status DBImpl::CompactMemTable() {
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
     s = versions_->LogAndApply(&edit, &mutex_);
   }
+  pending_outputs_.erase(number);
+  imm_flushing_ = false;
+  compactions_held_ = false;
 
   if (s.ok()) {
     // Commit to the new state
     imm_->Unref();
     imm_ = NULL;
-    has_imm_.Release_Store(NULL);
     DeleteObsoleteFiles();
+
+    const uint64_t end_micros = env_->NowMicros();
+    flush_stats_.flushes++;
+    flush_stats_.delay_micros += start_micros - imm_switch_micros_;
+    flush_stats_.micros += end_micros - start_micros;
+    flush_stats_.max_micros = std::max<int64_t>(flush_stats_.max_micros,
+                                                end_micros - start_micros);
+  }
+
+  return s;
+}
+
+Status DBImpl::CompactRange(const Slice* begin, const Slice* end,
+                            const CompactRangeOptions& options) {
+  Status s = FlushMemTable();
+  if (!s.ok()) {
+    return s;
+  }
+
+  // Find the user keys bounding the data in the range, and the last
+  // level holding some of it
+  std::string lo, hi;
+  int max_level_with_files = -1;
+  int base_level;
+  {
+    MutexLock l(&mutex_);
+    base_level = versions_->BaseLevel();
+    const Comparator* ucmp = user_comparator();
+    Version* base = versions_->current();
+    std::vector<FileMetaData*> files;
+    base->GetFilesInReadOrder(&files);
+    bool found = false;
+    for (size_t i = 0; i < files.size(); i++) {
+      const Slice smallest = files[i]->smallest.user_key();
+      const Slice largest = files[i]->largest.user_key();
+      if ((begin != NULL && ucmp->Compare(largest, *begin) < 0) ||
+          (end != NULL && ucmp->Compare(smallest, *end) > 0)) {
+        continue;
+      }
+      if (!found || ucmp->Compare(smallest, lo) < 0) {
+        lo = smallest.ToString();
+      }
+      if (!found || ucmp->Compare(largest, hi) > 0) {
+        hi = largest.ToString();
+      }
+      found = true;
+    }
+    if (!found) {
+      return s;
+    }
+    if (begin != NULL && ucmp->Compare(*begin, lo) > 0) {
+      lo = begin->ToString();
+    }
+    if (end != NULL && ucmp->Compare(*end, hi) < 0) {
+      hi = end->ToString();
+    }
+    for (int level = 0; level < config::kNumLevels; level++) {
+      if (base->OverlapInLevel(level, lo, hi)) {
+        max_level_with_files = level;
+      }
+    }
+  }
+
+  if (options_.compaction_style == kCompactionStyleFIFO) {
+    // Files are never merged
+    if (options.progress != NULL) {
+      (*options.progress)(options.progress_arg, 1, 1);
+    }
+    return s;
+  } else if (options_.compaction_style == kCompactionStyleUniversal) {
+    // All runs are merged into one
+    s = RunManualCompaction(0, lo, hi, true);
+    if (s.ok() && options.progress != NULL) {
+      (*options.progress)(options.progress_arg, 1, 1);
+    }
+    return s;
   }
 
+  // Level-0 is always pushed down, so that a bottommost rewrite never
+  // happens in level-0, where files may overlap.
+  const int last_level = std::max(max_level_with_files, base_level);
+  const int total = last_level + (options.rewrite_bottommost ? 1 : 0);
+  for (int level = 0; level < total && s.ok(); level++) {
+    s = RunManualCompaction(level, lo, hi, level == last_level);
+    if (s.ok() && options.progress != NULL) {
+      (*options.progress)(options.progress_arg, level + 1, total);
+    }
+  }
   return s;
 }
 
@@ -512,7 +964,13 @@ void DBImpl::TEST_CompactRange(
     const std::string& end) {
   assert(level >= 0);
   assert(level + 1 < config::kNumLevels);
+  RunManualCompaction(level, begin, end, false);
+}
 
+Status DBImpl::RunManualCompaction(int level,
+                                   const std::string& begin,
+                                   const std::string& end,
+                                   bool in_place) {
   MutexLock l(&mutex_);
   while (manual_compaction_ != NULL) {
     bg_cv_.Wait();
@@ -521,14 +979,20 @@ void DBImpl::TEST_CompactRange(
   manual.level = level;
   manual.begin = begin;
   manual.end = end;
+  manual.in_place = in_place;
   manual_compaction_ = &manual;
   MaybeScheduleCompaction();
   while (manual_compaction_ == &manual) {
     bg_cv_.Wait();
   }
+  return manual.status;
 }
 
 Status DBImpl::TEST_CompactMemTable() {
+  return FlushMemTable();
+}
+
+Status DBImpl::FlushMemTable() {
   MutexLock l(&mutex_);
   LoggerId self;
   AcquireLoggingResponsibility(&self);
@@ -546,18 +1010,59 @@ Status DBImpl::TEST_CompactMemTable() {
   return s;
 }
 
-void DBImpl::MaybeScheduleCompaction() {
+void DBImpl::TEST_WaitForBackgroundWork() {
+  MutexLock l(&mutex_);
+  while (bg_compaction_scheduled_ > 0 || bg_flush_scheduled_) {
+    bg_cv_.Wait();
+  }
+}
+
+void DBImpl::MaybeScheduleFlush() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
+  if (bg_flush_scheduled_) {
     // Already scheduled
+  } else if (shutting_down_.Acquire_Load()) {
+    // DB is being deleted; no more background work
+  } else if (imm_ == NULL) {
+    // No work to be done
+  } else {
+    bg_flush_scheduled_ = true;
+    env_->ScheduleHighPriority(&DBImpl::BGFlushWork, this);
+  }
+}
+
+void DBImpl::BGFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlush();
+}
+
+// Memtable flushes get a lane of their own, so that they do not wait
+// for compactions to finish.
+void DBImpl::BackgroundFlush() {
+  MutexLock l(&mutex_);
+  assert(bg_flush_scheduled_);
+  if (!shutting_down_.Acquire_Load() && imm_ != NULL) {
+    CompactMemTable();
+  }
+  bg_flush_scheduled_ = false;
+
+  // Retry if the flush failed, and compact the new level-0 file if
+  // needed.
+  MaybeScheduleFlush();
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+}
+
+void DBImpl::MaybeScheduleCompaction() {
+  mutex_.AssertHeld();
+  if (bg_compaction_scheduled_ >= options_.max_background_compactions) {
+    // Already scheduled as many as allowed
   } else if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
-  } else if (imm_ == NULL &&
-             manual_compaction_ == NULL &&
+  } else if (manual_compaction_ == NULL &&
              !versions_->NeedsCompaction()) {
     // No work to be done
   } else {
-    bg_compaction_scheduled_ = true;
+    bg_compaction_scheduled_++;
     env_->Schedule(&DBImpl::BGWork, this);
   }
 }
@@ -566,60 +1071,125 @@ void DBImpl::BGWork(void* db) {
   reinterpret_cast<DBImpl*>(db)->BackgroundCall();
 }
 
+void DBImpl::TTLCheckWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->TTLCheckLoop();
+}
+
+// Files only outlive fifo_ttl_seconds with the passing of time, so this
+// thread looks for them now and then even if nothing else schedules a
+// compaction.  It sleeps in short steps to notice shutdown quickly.
+void DBImpl::TTLCheckLoop() {
+  const uint64_t period_micros = 1000000 *
+      std::min<uint64_t>(options_.fifo_ttl_seconds, 60);
+  uint64_t slept_micros = 0;
+  while (shutting_down_.Acquire_Load() == NULL) {
+    const uint64_t step_micros = 100000;
+    env_->SleepForMicroseconds(static_cast<int>(step_micros));
+    slept_micros += step_micros;
+    if (slept_micros >= period_micros) {
+      slept_micros = 0;
+      MutexLock l(&mutex_);
+      MaybeScheduleCompaction();
+    }
+  }
+  MutexLock l(&mutex_);
+  ttl_thread_running_ = false;
+  bg_cv_.SignalAll();
+}
+
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(bg_compaction_scheduled_);
+  assert(bg_compaction_scheduled_ > 0);
+  bool did_work = false;
   if (!shutting_down_.Acquire_Load()) {
-    BackgroundCompaction();
+    did_work = BackgroundCompaction();
   }
-  bg_compaction_scheduled_ = false;
+  bg_compaction_scheduled_--;
 
   // Previous compaction may have produced too many files in a level,
-  // so reschedule another compaction if needed.
-  MaybeScheduleCompaction();
+  // so reschedule another compaction if needed.  If there was nothing
+  // this compaction could take, the work left is blocked by the ones
+  // still running, which will reschedule when they finish, as will a
+  // flush that holds compactions back.
+  if (!compactions_held_ && (did_work || bg_compaction_scheduled_ == 0)) {
+    MaybeScheduleCompaction();
+  }
   bg_cv_.SignalAll();
 }
 
-void DBImpl::BackgroundCompaction() {
+// Returns false if there was nothing to do.
+bool DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != NULL) {
-    CompactMemTable();
-    return;
+  if (compactions_held_) {
+    // A memtable flush will reschedule once it is done
+    return false;
   }
 
   Compaction* c;
   bool is_manual = (manual_compaction_ != NULL);
+  if (is_manual && versions_->NumRunningCompactions() > 0) {
+    // Wait for the compactions in progress to finish, and do not start
+    // any more in the meantime.
+    return false;
+  }
   if (is_manual) {
     const ManualCompaction* m = manual_compaction_;
     c = versions_->CompactRange(
         m->level,
         InternalKey(m->begin, kMaxSequenceNumber, kValueTypeForSeek),
-        InternalKey(m->end, 0, static_cast<ValueType>(0)));
+        InternalKey(m->end, 0, static_cast<ValueType>(0)),
+        m->in_place);
   } else {
     c = versions_->PickCompaction();
   }
+  if (c == NULL && !is_manual) {
+    return false;
+  }
+
+  // The inputs of "c" are taken, so another compaction can look for
+  // work elsewhere.
+  MaybeScheduleCompaction();
 
   Status status;
   if (c == NULL) {
     // Nothing to do
+  } else if (c->deletion_compaction()) {
+    // Drop the input files whole
+    c->AddInputDeletions(c->edit());
+    status = versions_->LogAndApply(c->edit(), &mutex_);
+    if (status.ok()) {
+      c->ReleaseInputs();
+      DeleteObsoleteFiles();
+    }
+    VersionSet::LevelSummaryStorage tmp;
+    Log(options_.info_log, "Deleted %d level-0 files %s: %s\n",
+        c->num_input_files(0),
+        status.ToString().c_str(),
+        versions_->LevelSummary(&tmp));
   } else if (!is_manual && c->IsTrivialMove()) {
-    // Move file to next level
+    // Move file to the output level
     assert(c->num_input_files(0) == 1);
     FileMetaData* f = c->input(0, 0);
     c->edit()->DeleteFile(c->level(), f->number);
-    c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
+    c->edit()->AddFile(c->output_level(), f->number, f->file_size,
                        f->smallest, f->largest);
     status = versions_->LogAndApply(c->edit(), &mutex_);
     VersionSet::LevelSummaryStorage tmp;
     Log(options_.info_log, "Moved #%lld to level-%d %lld bytes %s: %s\n",
         static_cast<unsigned long long>(f->number),
-        c->level() + 1,
+        c->output_level(),
         static_cast<unsigned long long>(f->file_size),
         status.ToString().c_str(),
         versions_->LevelSummary(&tmp));
   } else {
     CompactionState* compact = new CompactionState(c);
+    if (c->output_level() == 0) {
+      // A merge of level-0 runs is read after the runs flushed once it
+      // has been picked, so its output must be numbered before them
+      compact->reserved_number = versions_->NewFileNumber();
+      pending_outputs_.insert(compact->reserved_number);
+    }
     status = DoCompactionWork(compact);
     CleanupCompaction(compact);
   }
@@ -639,8 +1209,10 @@ void DBImpl::BackgroundCompaction() {
 
   if (is_manual) {
     // Mark it as done
+    manual_compaction_->status = status;
     manual_compaction_ = NULL;
   }
+  return true;
 }
 
 void DBImpl::CleanupCompaction(CompactionState* compact) {
@@ -657,6 +1229,9 @@ void DBImpl::CleanupCompaction(CompactionState* compact) {
     const CompactionState::Output& out = compact->outputs[i];
     pending_outputs_.erase(out.number);
   }
+  if (compact->reserved_number != 0) {
+    pending_outputs_.erase(compact->reserved_number);
+  }
   delete compact;
 }
 
@@ -666,7 +1241,12 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   uint64_t file_number;
   {
     mutex_.Lock();
-    file_number = versions_->NewFileNumber();
+    if (compact->reserved_number != 0) {
+      file_number = compact->reserved_number;
+      compact->reserved_number = 0;
+    } else {
+      file_number = versions_->NewFileNumber();
+    }
     pending_outputs_.insert(file_number);
     CompactionState::Output out;
     out.number = file_number;
@@ -679,6 +1259,11 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   // Make the output file
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname, &compact->outfile);
+  if (s.ok() && options_.rate_limiter != NULL) {
+    compact->outfile = NewRateLimitedFile(compact->outfile,
+                                          options_.rate_limiter,
+                                          RateLimiter::kLow);
+  }
   if (s.ok()) {
     compact->builder = new TableBuilder(options_, compact->outfile);
   }
@@ -743,78 +1328,56 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
       compact->compaction->num_input_files(0),
       compact->compaction->level(),
       compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1,
+      compact->compaction->output_level(),
       static_cast<long long>(compact->total_bytes));
 
   // Add compaction outputs
   compact->compaction->AddInputDeletions(compact->compaction->edit());
-  const int level = compact->compaction->level();
+  const int level = compact->compaction->output_level();
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
     compact->compaction->edit()->AddFile(
-        level + 1,
+        level,
         out.number, out.file_size, out.smallest, out.largest);
-    pending_outputs_.erase(out.number);
   }
-  compact->outputs.clear();
 
+  // The outputs stay in pending_outputs_ until CleanupCompaction(), since
+  // another thread may delete obsolete files while the edit is written.
   Status s = versions_->LogAndApply(compact->compaction->edit(), &mutex_);
   if (s.ok()) {
     compact->compaction->ReleaseInputs();
     DeleteObsoleteFiles();
-  } else {
-    // Discard any files we may have created during this failed compaction
-    for (size_t i = 0; i < compact->outputs.size(); i++) {
-      env_->DeleteFile(TableFileName(dbname_, compact->outputs[i].number));
-    }
   }
   return s;
 }
 
-Status DBImpl::DoCompactionWork(CompactionState* compact) {
-  const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
-
-  Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
-      compact->compaction->num_input_files(0),
-      compact->compaction->level(),
-      compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1);
-
-  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
-  assert(compact->builder == NULL);
-  assert(compact->outfile == NULL);
-  if (snapshots_.empty()) {
-    compact->smallest_snapshot = versions_->LastSequence();
+// Merge the inputs of "compact" within [*compact->begin,*compact->end)
+// into its outputs.  REQUIRES: mutex_ not held.
+Status DBImpl::DoSubcompactionWork(CompactionState* compact) {
+  Iterator* input = versions_->MakeInputIterator(compact->compaction);
+  if (compact->begin != NULL) {
+    InternalKey start(*compact->begin, kMaxSequenceNumber, kValueTypeForSeek);
+    input->Seek(start.Encode());
   } else {
-    compact->smallest_snapshot = snapshots_.oldest()->number_;
+    input->SeekToFirst();
   }
-
-  // Release mutex while we're actually doing the compaction work
-  mutex_.Unlock();
-
-  Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  const CompactionFilter* filter = options_.compaction_filter;
+  std::string filtered_key;
+  std::string filtered_value;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
-    // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != NULL) {
-      const uint64_t imm_start = env_->NowMicros();
-      mutex_.Lock();
-      if (imm_ != NULL) {
-        CompactMemTable();
-        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
-      }
-      mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
-    }
-
     Slice key = input->key();
-    if (compact->compaction->ShouldStopBefore(key) &&
+    Slice value = input->value();
+    if (compact->end != NULL &&
+        user_comparator()->Compare(ExtractUserKey(key),
+                                   *compact->end) >= 0) {
+      break;
+    }
+    if (compact->compaction->ShouldStopBefore(key, &compact->cursor) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
       if (!status.ok()) {
@@ -844,7 +1407,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         drop = true;    // (A)
       } else if (ikey.type == kTypeDeletion &&
                  ikey.sequence <= compact->smallest_snapshot &&
-                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                        &compact->cursor)) {
         // For this user key:
         // (1) there is no data in higher levels
         // (2) data in lower levels will have larger sequence numbers
@@ -853,6 +1417,38 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
         drop = true;
+      } else if (filter != NULL &&
+                 ikey.type == kTypeValue &&
+                 last_sequence_for_key == kMaxSequenceNumber &&
+                 ikey.sequence > compact->newest_snapshot) {
+        // The newest entry for this user key, which no snapshot sees
+        compact->filter_stats.entries++;
+        filtered_value.clear();
+        bool value_changed = false;
+        if (filter->Filter(compact->compaction->level(), ikey.user_key,
+                           value, &filtered_value, &value_changed)) {
+          compact->filter_stats.dropped++;
+          if (ikey.sequence <= compact->smallest_snapshot &&
+              compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                                     &compact->cursor)) {
+            // As for a deletion marker above, nothing is left for the
+            // entry to hide once the older ones here are dropped by (A)
+            compact->filter_stats.removed++;
+            drop = true;
+          } else {
+            // Hide the older entries in deeper levels, or those kept
+            // here for snapshots
+            filtered_key.clear();
+            AppendInternalKey(&filtered_key,
+                              ParsedInternalKey(ikey.user_key, ikey.sequence,
+                                                kTypeDeletion));
+            key = filtered_key;
+            value = Slice();
+          }
+        } else if (value_changed) {
+          compact->filter_stats.changed++;
+          value = filtered_value;
+        }
       }
 
       last_sequence_for_key = ikey.sequence;
@@ -863,7 +1459,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         "%d smallest_snapshot: %d",
         ikey.user_key.ToString().c_str(),
         (int)ikey.sequence, ikey.type, kTypeValue, drop,
-        compact->compaction->IsBaseLevelForKey(ikey.user_key),
+        compact->compaction->IsBaseLevelForKey(ikey.user_key,
+                                               &compact->cursor),
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
@@ -879,7 +1476,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         compact->current_output()->smallest.DecodeFrom(key);
       }
       compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
+      compact->builder->Add(key, value);
 
       // Close output file if it is big enough
       if (compact->builder->FileSize() >=
@@ -906,8 +1503,102 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   delete input;
   input = NULL;
 
+  return status;
+}
+
+void DBImpl::SubcompactionWork(void* arg) {
+  Subcompaction* sub = reinterpret_cast<Subcompaction*>(arg);
+  DBImpl* db = sub->db;
+  sub->status = db->DoSubcompactionWork(sub->state);
+  MutexLock l(&db->mutex_);
+  sub->done = true;
+  db->bg_cv_.SignalAll();
+}
+
+// Split "compact" at "boundaries" and run the parts at the same time,
+// the first one on this thread.  The outputs of all parts are gathered
+// in "compact", in key order, to be installed by a single edit.
+// REQUIRES: mutex_ not held.
+Status DBImpl::DoSubcompactions(CompactionState* compact,
+                                const std::vector<std::string>& boundaries) {
+  const size_t n = boundaries.size() + 1;
+  Log(options_.info_log, "Compacting in %d subcompactions", int(n));
+  std::vector<Subcompaction> subs(n);
+  for (size_t i = 0; i < n; i++) {
+    CompactionState* state = new CompactionState(compact->compaction);
+    state->smallest_snapshot = compact->smallest_snapshot;
+    state->newest_snapshot = compact->newest_snapshot;
+    state->begin = (i == 0) ? NULL : &boundaries[i - 1];
+    state->end = (i + 1 == n) ? NULL : &boundaries[i];
+    subs[i].db = this;
+    subs[i].state = state;
+    subs[i].done = false;
+  }
+  for (size_t i = 1; i < n; i++) {
+    env_->StartThread(&DBImpl::SubcompactionWork, &subs[i]);
+  }
+  subs[0].status = DoSubcompactionWork(subs[0].state);
+
+  mutex_.Lock();
+  subs[0].done = true;
+  Status status;
+  for (size_t i = 0; i < n; i++) {
+    while (!subs[i].done) {
+      bg_cv_.Wait();
+    }
+    CompactionState* state = subs[i].state;
+    if (status.ok()) {
+      status = subs[i].status;
+    }
+    compact->outputs.insert(compact->outputs.end(),
+                            state->outputs.begin(), state->outputs.end());
+    compact->total_bytes += state->total_bytes;
+    compact->filter_stats.Add(state->filter_stats);
+    state->outputs.clear();   // Now pending on behalf of "compact"
+    CleanupCompaction(state);
+  }
+  mutex_.Unlock();
+  return status;
+}
+
+Status DBImpl::DoCompactionWork(CompactionState* compact) {
+  const uint64_t start_micros = env_->NowMicros();
+
+  Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
+      compact->compaction->num_input_files(0),
+      compact->compaction->level(),
+      compact->compaction->num_input_files(1),
+      compact->compaction->output_level());
+
+  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
+  assert(compact->builder == NULL);
+  assert(compact->outfile == NULL);
+  if (snapshots_.empty()) {
+    compact->smallest_snapshot = versions_->LastSequence();
+    compact->newest_snapshot = 0;
+  } else {
+    compact->smallest_snapshot = snapshots_.oldest()->number_;
+    compact->newest_snapshot = snapshots_.newest()->number_;
+  }
+
+  // Release mutex while we're actually doing the compaction work
+  mutex_.Unlock();
+
+  std::vector<std::string> boundaries;
+  if (options_.max_subcompactions > 1) {
+    versions_->GetSubcompactionBoundaries(compact->compaction,
+                                          options_.max_subcompactions,
+                                          &boundaries);
+  }
+  Status status;
+  if (boundaries.empty()) {
+    status = DoSubcompactionWork(compact);
+  } else {
+    status = DoSubcompactions(compact, boundaries);
+  }
+
   CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  stats.micros = env_->NowMicros() - start_micros;
   for (int which = 0; which < 2; which++) {
     for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
       stats.bytes_read += compact->compaction->input(which, i)->file_size;
@@ -917,8 +1608,19 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     stats.bytes_written += compact->outputs[i].file_size;
   }
 
+  const FilterStats& f = compact->filter_stats;
+  if (f.dropped > 0 || f.changed > 0) {
+    Log(options_.info_log, "Compaction filter %s dropped %lld, changed %lld "
+        "of %lld entries",
+        options_.compaction_filter->Name(),
+        static_cast<long long>(f.dropped),
+        static_cast<long long>(f.changed),
+        static_cast<long long>(f.entries));
+  }
+
   mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
+  stats_[compact->compaction->output_level()].Add(stats);
+  filter_stats_.Add(f);
 
   if (status.ok()) {
     status = InstallCompactionResults(compact);
@@ -1038,10 +1740,17 @@ Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   Iterator* internal_iter = NewInternalIterator(options, &latest_snapshot);
   return NewDBIterator(
-      &dbname_, env_, user_comparator(), internal_iter,
+      this, &dbname_, env_, user_comparator(), internal_iter,
       (options.snapshot != NULL
        ? reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_
-       : latest_snapshot));
+       : latest_snapshot),
+      options.pin_data,
+      options_.max_sequential_skip_in_iterations);
+}
+
+void DBImpl::RecordIteratorReseeks(uint64_t n) {
+  MutexLock l(&mutex_);
+  iterator_reseeks_ += n;
 }
 
 const Snapshot* DBImpl::GetSnapshot() {
@@ -1123,6 +1832,15 @@ Status DBImpl::MakeRoomForWrite(bool force) {
   mutex_.AssertHeld();
   assert(logger_ != NULL);
   bool allow_delay = !force;
+  // Level-0 files are never merged under kCompactionStyleFIFO; they are
+  // deleted once there are more than fifo_max_table_files of them
+  int slowdown_trigger = config::kL0_SlowdownWritesTrigger;
+  int stop_trigger = config::kL0_StopWritesTrigger;
+  if (options_.compaction_style == kCompactionStyleFIFO) {
+    slowdown_trigger = options_.fifo_max_table_files + 1;
+    stop_trigger = slowdown_trigger +
+        (config::kL0_StopWritesTrigger - config::kL0_SlowdownWritesTrigger);
+  }
   Status s;
   while (true) {
     if (!bg_error_.ok()) {
@@ -1131,7 +1849,7 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       break;
     } else if (
         allow_delay &&
-        versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
+        versions_->NumLevelFiles(0) >= slowdown_trigger) {
       // We are getting close to hitting a hard limit on the number of
       // L0 files.  Rather than delaying a single write by several
       // seconds when we hit the hard limit, start delaying each
@@ -1149,8 +1867,10 @@ Status DBImpl::MakeRoomForWrite(bool force) {
     } else if (imm_ != NULL) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
+      const uint64_t start_micros = env_->NowMicros();
       bg_cv_.Wait();
-    } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
+      flush_stats_.stall_micros += env_->NowMicros() - start_micros;
+    } else if (versions_->NumLevelFiles(0) >= stop_trigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "waiting...\n");
       bg_cv_.Wait();
@@ -1169,11 +1889,11 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       logfile_number_ = new_log_number;
       log_ = new log::Writer(lfile);
       imm_ = mem_;
-      has_imm_.Release_Store(imm_);
+      imm_switch_micros_ = env_->NowMicros();
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
       force = false;   // Do not force another compaction if have room
-      MaybeScheduleCompaction();
+      MaybeScheduleFlush();
     }
   }
   return s;
@@ -1225,6 +1945,62 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
       }
     }
     return true;
+  } else if (in == "recovery-stats") {
+    const RecoveryStats& r = recovery_stats_;
+    char buf[400];
+    snprintf(buf, sizeof(buf),
+             "Manifest: %.3f sec\n"
+             "Logs: %d files, %llu records, %.1f MB, %d tables, %.3f sec\n"
+             "  decode: %.3f sec on %d threads, waited %.3f sec\n"
+             "  insert: %.3f sec\n"
+             "  flush:  %.3f sec, waited %.3f sec\n",
+             r.manifest_micros / 1e6,
+             r.logs,
+             static_cast<unsigned long long>(r.records),
+             r.bytes / 1048576.0,
+             r.tables,
+             r.logs_micros / 1e6,
+             r.decode_micros / 1e6,
+             r.decode_threads,
+             r.decode_wait_micros / 1e6,
+             r.insert_micros / 1e6,
+             r.flush_micros / 1e6,
+             r.flush_wait_micros / 1e6);
+    *value = buf;
+    return true;
+  } else if (in == "flush-stats") {
+    const FlushStats& f = flush_stats_;
+    char buf[300];
+    snprintf(buf, sizeof(buf),
+             "Flushes: %llu, %.3f sec, max %.3f sec\n"
+             "  delayed: %.3f sec\n"
+             "  writers stalled: %.3f sec\n",
+             static_cast<unsigned long long>(f.flushes),
+             f.micros / 1e6,
+             f.max_micros / 1e6,
+             f.delay_micros / 1e6,
+             f.stall_micros / 1e6);
+    *value = buf;
+    return true;
+  } else if (in == "compaction-filter-stats") {
+    const FilterStats& f = filter_stats_;
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "Filtered: %llu entries\n"
+             "  dropped: %llu, %llu without a deletion\n"
+             "  changed: %llu\n",
+             static_cast<unsigned long long>(f.entries),
+             static_cast<unsigned long long>(f.dropped),
+             static_cast<unsigned long long>(f.removed),
+             static_cast<unsigned long long>(f.changed));
+    *value = buf;
+    return true;
+  } else if (in == "iterator-reseeks") {
+    char buf[50];
+    snprintf(buf, sizeof(buf), "%llu",
+             static_cast<unsigned long long>(iterator_reseeks_));
+    *value = buf;
+    return true;
   }
 
   return false;
@@ -1272,6 +2048,87 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
 
 DB::~DB() { }
 
+namespace {
+// Shared by the threads started by DBImpl::PreloadTables()
+struct PreloadState {
+  port::Mutex mu;
+  port::CondVar cv;
+  TableCache* table_cache;
+  std::vector<FileMetaData*> files;
+  size_t next;                  // Index of the next file to open
+  int threads_running;
+  int opened;
+
+  PreloadState() : cv(&mu) { }
+};
+}
+
+static void PreloadWork(void* arg) {
+  PreloadState* state = reinterpret_cast<PreloadState*>(arg);
+  state->mu.Lock();
+  while (state->next < state->files.size()) {
+    FileMetaData* f = state->files[state->next++];
+    state->mu.Unlock();
+    // Errors are not reported here: the file will be opened again, and
+    // the error surfaced, by the first read that needs it.
+    Status s = state->table_cache->Preload(f);
+    state->mu.Lock();
+    if (s.ok()) {
+      state->opened++;
+    }
+  }
+  state->threads_running--;
+  state->cv.SignalAll();
+  state->mu.Unlock();
+}
+
+void DBImpl::PreloadTables() {
+  const uint64_t start_micros = env_->NowMicros();
+  PreloadState state;
+  state.table_cache = table_cache_;
+  state.next = 0;
+  state.opened = 0;
+
+  // Holding a reference to the current version keeps its files from
+  // being deleted by compactions while they are being opened.
+  mutex_.Lock();
+  Version* current = versions_->current();
+  current->Ref();
+  mutex_.Unlock();
+
+  // The table cache holds max_open_files - 10 tables.  Preload at most
+  // half of that: preloaded tables stay pinned, and every pin takes a
+  // slot away from the cache, which is left the rest for the outputs of
+  // the first compactions and for tables opened by other reads.
+  current->GetFilesInReadOrder(&state.files);
+  const size_t limit = (options_.max_open_files - 10) / 2;
+  if (state.files.size() > limit) {
+    state.files.resize(limit);
+  }
+
+  int threads = options_.max_file_opening_threads;
+  if (threads > static_cast<int>(state.files.size())) {
+    threads = static_cast<int>(state.files.size());
+  }
+  state.threads_running = threads;
+  for (int i = 0; i < threads; i++) {
+    env_->StartThread(&PreloadWork, &state);
+  }
+  state.mu.Lock();
+  while (state.threads_running > 0) {
+    state.cv.Wait();
+  }
+  state.mu.Unlock();
+
+  Log(options_.info_log, "Preloaded %d of %d table files in %llu us",
+      state.opened, static_cast<int>(state.files.size()),
+      static_cast<unsigned long long>(env_->NowMicros() - start_micros));
+
+  mutex_.Lock();
+  current->Unref();
+  mutex_.Unlock();
+}
+
 Status DB::Open(const Options& options, const std::string& dbname,
                 DB** dbptr) {
   *dbptr = NULL;
@@ -1296,8 +2153,16 @@ Status DB::Open(const Options& options, const std::string& dbname,
       impl->DeleteObsoleteFiles();
       impl->MaybeScheduleCompaction();
     }
+    if (s.ok() && options.compaction_style == kCompactionStyleFIFO &&
+        options.fifo_ttl_seconds > 0) {
+      impl->ttl_thread_running_ = true;
+      options.env->StartThread(&DBImpl::TTLCheckWork, impl);
+    }
   }
   impl->mutex_.Unlock();
+  if (s.ok() && impl->options_.preload_tables) {
+    impl->PreloadTables();
+  }
   if (s.ok()) {
     *dbptr = impl;
   } else {
@@ -1306,6 +2171,9 @@ Status DB::Open(const Options& options, const std::string& dbname,
   return s;
 }
 
+CompactionFilter::~CompactionFilter() {
+}
+
 Snapshot::~Snapshot() {
 }
 
@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_DB_DB_IMPL_H_
 
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
 #include "db/log_writer.h"
 #include "db/snapshot.h"
@@ -38,6 +39,13 @@ class DBImpl : public DB {
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
   virtual bool GetProperty(const Slice& property, std::string* value);
   virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
+  virtual Status CompactRange(const Slice* begin, const Slice* end,
+                              const CompactRangeOptions& options);
+
+  // Called by iterators when they are deleted, with the number of times
+  // they sought past a run of hidden entries instead of stepping over
+  // them.
+  void RecordIteratorReseeks(uint64_t n);
 
   // Extra methods (for testing) that are not in the public DB interface
 
@@ -50,6 +58,9 @@ class DBImpl : public DB {
   // Force current memtable contents to be compacted.
   Status TEST_CompactMemTable();
 
+  // Wait until no flush or compaction is scheduled or running.
+  void TEST_WaitForBackgroundWork();
+
   // Return an internal iterator over the current state of the database.
   // The keys of this iterator are internal keys (see format.h).
   // The returned iterator should be deleted when no longer needed.
@@ -81,11 +92,27 @@ class DBImpl : public DB {
   // log-file/memtable and writes a new descriptor iff successful.
   Status CompactMemTable();
 
-  Status RecoverLogFile(uint64_t log_number,
-                        VersionEdit* edit,
-                        SequenceNumber* max_sequence);
+  // Replay the given log files, in order, into level-0 tables that are
+  // added to *edit.  The records are decoded on several threads while
+  // earlier ones are inserted into memtables, and full memtables are
+  // written out while the inserts continue.
+  Status RecoverLogFiles(const std::vector<uint64_t>& logs,
+                         VersionEdit* edit,
+                         SequenceNumber* max_sequence);
+
+  struct RecoveryFlush;
+  static void RecoveryFlushWork(void* arg);
+  void WaitForRecoveryFlush(RecoveryFlush* flush);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base);
+  // If "pending" is non-NULL the number of the new table is stored in
+  // *pending and left in pending_outputs_, for the caller to erase once
+  // "edit" has been installed.
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base,
+                          uint64_t* pending = NULL);
+
+  // Open the table files of the current version ahead of the first reads
+  // (see Options::preload_tables).  REQUIRES: mutex_ not held.
+  void PreloadTables();
 
   // Only thread is allowed to log at a time.
   struct LoggerId { };          // Opaque identifier for logging thread
@@ -94,14 +121,35 @@ class DBImpl : public DB {
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */);
 
+  // Write out the current memtable and wait for it to be installed.
+  Status FlushMemTable();
+
+  // Compact the files of "level" that overlap the user key range
+  // [begin,end] on the background threads, and wait for it to finish.
+  // If "in_place" is true the files are rewritten into "level" itself.
+  Status RunManualCompaction(int level,
+                             const std::string& begin,
+                             const std::string& end,
+                             bool in_place);
+
   struct CompactionState;
 
+  void MaybeScheduleFlush();
+  static void BGFlushWork(void* db);
+  void BackgroundFlush();
   void MaybeScheduleCompaction();
   static void BGWork(void* db);
   void BackgroundCall();
-  void BackgroundCompaction();
+  static void TTLCheckWork(void* db);
+  void TTLCheckLoop();
+  bool BackgroundCompaction();
   void CleanupCompaction(CompactionState* compact);
   Status DoCompactionWork(CompactionState* compact);
+  Status DoSubcompactionWork(CompactionState* compact);
+  struct Subcompaction;
+  static void SubcompactionWork(void* arg);
+  Status DoSubcompactions(CompactionState* compact,
+                          const std::vector<std::string>& boundaries);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
@@ -127,7 +175,7 @@ class DBImpl : public DB {
   port::CondVar bg_cv_;          // Signalled when background work finishes
   MemTable* mem_;
   MemTable* imm_;                // Memtable being compacted
-  port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
+  uint64_t imm_switch_micros_;   // When imm_ was last set
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
@@ -139,14 +187,30 @@ class DBImpl : public DB {
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_;
 
-  // Has a background compaction been scheduled or is running?
-  bool bg_compaction_scheduled_;
+  // Number of background compactions scheduled or running.  At most
+  // options_.max_background_compactions.
+  int bg_compaction_scheduled_;
+
+  // Has a memtable flush been scheduled on the high priority lane?
+  bool bg_flush_scheduled_;
+
+  // Is imm_ being written out?
+  bool imm_flushing_;
+
+  // Is the thread that looks for files past fifo_ttl_seconds running?
+  bool ttl_thread_running_;
+
+  // Set while imm_ is being written out to a level that a compaction
+  // could also write to.  No compaction is started meanwhile.
+  bool compactions_held_;
 
   // Information for a manual compaction
   struct ManualCompaction {
     int level;
     std::string begin;
     std::string end;
+    bool in_place;
+    Status status;
   };
   ManualCompaction* manual_compaction_;
 
@@ -172,6 +236,65 @@ class DBImpl : public DB {
   };
   CompactionStats stats_[config::kNumLevels];
 
+  // Number of times iterators reseeked past hidden entries
+  uint64_t iterator_reseeks_;
+
+  // What options_.compaction_filter did to the entries passed to it
+  struct FilterStats {
+    int64_t entries;
+    int64_t dropped;
+    int64_t removed;            // Dropped without leaving a deletion
+    int64_t changed;
+
+    FilterStats() : entries(0), dropped(0), removed(0), changed(0) { }
+
+    void Add(const FilterStats& f) {
+      this->entries += f.entries;
+      this->dropped += f.dropped;
+      this->removed += f.removed;
+      this->changed += f.changed;
+    }
+  };
+  FilterStats filter_stats_;
+
+  // Where the time spent recovering the DB in DB::Open went.  The decode
+  // and insert times overlap each other and the flush time.
+  struct RecoveryStats {
+    int64_t manifest_micros;    // Reading the descriptor
+    int64_t logs_micros;        // Replaying the logs, start to end
+    int64_t decode_micros;      // Reading and checksumming log records
+    int64_t decode_wait_micros; // Inserts stalled on decoding
+    int64_t insert_micros;      // Inserting records into memtables
+    int64_t flush_micros;       // Writing level-0 tables
+    int64_t flush_wait_micros;  // Inserts stalled on a table write
+    int64_t records;
+    int64_t bytes;
+    int logs;
+    int tables;
+    int decode_threads;
+
+    RecoveryStats()
+        : manifest_micros(0), logs_micros(0), decode_micros(0),
+          decode_wait_micros(0), insert_micros(0), flush_micros(0),
+          flush_wait_micros(0), records(0), bytes(0), logs(0), tables(0),
+          decode_threads(0) { }
+  };
+  RecoveryStats recovery_stats_;
+
+  // Memtable flushes since the DB was opened
+  struct FlushStats {
+    int64_t flushes;
+    int64_t micros;             // Writing tables and installing them
+    int64_t max_micros;         // Longest single flush
+    int64_t delay_micros;       // From switching memtables to flush start
+    int64_t stall_micros;       // Writers waiting for a flush to finish
+
+    FlushStats()
+        : flushes(0), micros(0), max_micros(0), delay_micros(0),
+          stall_micros(0) { }
+  };
+  FlushStats flush_stats_;
+
   // No copying allowed
   DBImpl(const DBImpl&);
   void operator=(const DBImpl&);
@@ -4,6 +4,7 @@
 
 #include "db/db_iter.h"
 
+#include "db/db_impl.h"
 #include "db/filename.h"
 #include "db/dbformat.h"
 #include "leveldb/env.h"
@@ -46,17 +47,26 @@ class DBIter: public Iterator {
     kReverse
   };
 
-  DBIter(const std::string* dbname, Env* env,
-         const Comparator* cmp, Iterator* iter, SequenceNumber s)
-      : dbname_(dbname),
+  DBIter(DBImpl* db, const std::string* dbname, Env* env,
+         const Comparator* cmp, Iterator* iter, SequenceNumber s,
+         bool pin_data, int max_skip)
+      : db_(db),
+        dbname_(dbname),
         env_(env),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        pin_data_(pin_data),
+        max_skip_(max_skip),
+        saved_key_pinned_(false),
         direction_(kForward),
-        valid_(false) {
+        valid_(false),
+        reseeks_(0) {
   }
   virtual ~DBIter() {
+    if (reseeks_ > 0) {
+      db_->RecordIteratorReseeks(reseeks_);
+    }
     delete iter_;
   }
   virtual bool Valid() const { return valid_; }
@@ -75,6 +85,13 @@ class DBIter: public Iterator {
       return status_;
     }
   }
+  virtual bool IsKeyPinned() const {
+    assert(valid_);
+    if (!pin_data_) {
+      return false;
+    }
+    return (direction_ == kForward) ? iter_->IsKeyPinned() : saved_key_pinned_;
+  }
 
   virtual void Next();
   virtual void Prev();
@@ -83,40 +100,98 @@ class DBIter: public Iterator {
   virtual void SeekToLast();
 
  private:
-  void FindNextUserEntry(bool skipping, std::string* skip);
+  void FindNextUserEntry(bool skipping);
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
+  bool EntryMissing(const Slice& value);
+
+  // Makes saved_key_ refer to "k", which must be a piece of the current
+  // entry of iter_.  The bytes are only copied if they may change when
+  // iter_ is moved.
+  inline void SaveKey(const Slice& k) {
+    if (pin_data_ && iter_->IsKeyPinned()) {
+      saved_key_ = k;
+      saved_key_pinned_ = true;
+    } else {
+      key_buf_.assign(k.data(), k.size());
+      saved_key_ = key_buf_;
+      saved_key_pinned_ = false;
+    }
+  }
+
+  inline void ClearSavedKey() {
+    key_buf_.clear();
+    saved_key_.clear();
+    saved_key_pinned_ = false;
+  }
 
-  inline void SaveKey(const Slice& k, std::string* dst) {
-    dst->assign(k.data(), k.size());
+  // Like SaveKey() but for the value of the current entry of iter_.
+  // Values stay in place for as long as the blocks holding them are
+  // pinned, so they are never copied when pin_data_ is set.
+  inline void SaveValue(const Slice& v) {
+    if (pin_data_) {
+      saved_value_ = v;
+    } else {
+      if (value_buf_.capacity() > v.size() + 1048576) {
+        std::string empty;
+        swap(empty, value_buf_);
+      }
+      value_buf_.assign(v.data(), v.size());
+      saved_value_ = value_buf_;
+    }
   }
 
   inline void ClearSavedValue() {
-    if (saved_value_.capacity() > 1048576) {
+    if (value_buf_.capacity() > 1048576) {
       std::string empty;
-      swap(empty, saved_value_);
+      swap(empty, value_buf_);
     } else {
-      saved_value_.clear();
+      value_buf_.clear();
     }
+    saved_value_.clear();
   }
 
+  DBImpl* const db_;
   const std::string* const dbname_;
   Env* const env_;
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
+  bool const pin_data_;
+  int const max_skip_;        // Hidden entries to step over before reseeking
 
   Status status_;
-  std::string saved_key_;     // == current key when direction_==kReverse
-  std::string saved_value_;   // == current raw value when direction_==kReverse
+  Slice saved_key_;           // == current key when direction_==kReverse
+  Slice saved_value_;         // == current raw value when direction_==kReverse
+  std::string key_buf_;       // Backing store for saved_key_ unless pinned
+  std::string value_buf_;     // Backing store for saved_value_ unless pinned
+  bool saved_key_pinned_;
   Direction direction_;
   bool valid_;
+  uint64_t reseeks_;          // Reported to db_ when the iterator is deleted
 
   // No copying allowed
   DBIter(const DBIter&);
   void operator=(const DBIter&);
 };
 
+// Tables are only opened once an entry of theirs is used (see
+// LazyFileIterator in version_set.cc), so the entry iter_ is at, whose
+// value is "value", may turn out to come from a table that cannot be
+// read.  Such an entry has an empty value and leaves the error in
+// iter_->status().  Returns true, with iter_ moved to the first entry
+// after it, if the entry is not really there.  Otherwise iter_ is left
+// at the entry.
+bool DBIter::EntryMissing(const Slice& value) {
+  if (!value.empty() || iter_->status().ok()) {
+    return false;
+  }
+  // Seeking again goes through the table that is open by now
+  const std::string k = iter_->key().ToString();
+  iter_->Seek(k);
+  return !(iter_->Valid() && iter_->key() == Slice(k));
+}
+
 inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
   if (!ParseInternalKey(iter_->key(), ikey)) {
     status_ = Status::Corruption("corrupted internal key in DBIter");
@@ -141,46 +216,77 @@ void DBIter::Next() {
     }
     if (!iter_->Valid()) {
       valid_ = false;
-      saved_key_.clear();
+      ClearSavedKey();
       return;
     }
   }
 
   // Temporarily use saved_key_ as storage for key to skip.
-  std::string* skip = &saved_key_;
-  SaveKey(ExtractUserKey(iter_->key()), skip);
-  FindNextUserEntry(true, skip);
+  SaveKey(ExtractUserKey(iter_->key()));
+  FindNextUserEntry(true);
 }
 
-void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
+void DBIter::FindNextUserEntry(bool skipping) {
+  // saved_key_ holds the user key to skip when "skipping" is set.
   // Loop until we hit an acceptable entry to yield
   assert(iter_->Valid());
   assert(direction_ == kForward);
+  int num_skipped = 0;
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
-      switch (ikey.type) {
-        case kTypeDeletion:
-          // Arrange to skip all upcoming entries for this key since
-          // they are hidden by this deletion.
-          SaveKey(ikey.user_key, skip);
-          skipping = true;
-          break;
-        case kTypeValue:
-          if (skipping &&
-              user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
-            // Entry hidden
-          } else {
+    if (ParseKey(&ikey)) {
+      if (ikey.sequence > sequence_) {
+        // Entry hidden because it is newer than the snapshot.  If a key
+        // was written many times since then, jump to its newest entry
+        // the snapshot can see.
+        num_skipped++;
+        if (max_skip_ > 0 && num_skipped > max_skip_) {
+          num_skipped = 0;
+          std::string target;
+          AppendInternalKey(
+              &target,
+              ParsedInternalKey(ikey.user_key, sequence_, kValueTypeForSeek));
+          iter_->Seek(target);
+          reseeks_++;
+          continue;
+        }
+      } else if (skipping &&
+                 user_comparator_->Compare(ikey.user_key, saved_key_) <= 0) {
+        // Entry hidden.  If there are many of them (a key that was
+        // overwritten or deleted over and over) jump past all of the
+        // remaining ones instead of stepping through them one by one.
+        num_skipped++;
+        if (max_skip_ > 0 && num_skipped > max_skip_) {
+          num_skipped = 0;
+          std::string target;
+          AppendInternalKey(
+              &target, ParsedInternalKey(saved_key_, 0, kTypeDeletion));
+          iter_->Seek(target);
+          reseeks_++;
+          continue;
+        }
+      } else {
+        switch (ikey.type) {
+          case kTypeDeletion:
+            // Arrange to skip all upcoming entries for this key since
+            // they are hidden by this deletion.
+            SaveKey(ikey.user_key);
+            skipping = true;
+            num_skipped = 0;
+            break;
+          case kTypeValue:
+            if (EntryMissing(iter_->value())) {
+              continue;  // iter_ is at the next entry already
+            }
             valid_ = true;
-            saved_key_.clear();
+            ClearSavedKey();
             return;
-          }
-          break;
+        }
       }
     }
     iter_->Next();
   } while (iter_->Valid());
-  saved_key_.clear();
+  ClearSavedKey();
   valid_ = false;
 }
 
@@ -191,12 +297,12 @@ void DBIter::Prev() {
     // iter_ is pointing at the current entry.  Scan backwards until
     // the key changes so we can use the normal reverse scanning code.
     assert(iter_->Valid());  // Otherwise valid_ would have been false
-    SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    SaveKey(ExtractUserKey(iter_->key()));
     while (true) {
       iter_->Prev();
       if (!iter_->Valid()) {
         valid_ = false;
-        saved_key_.clear();
+        ClearSavedKey();
         ClearSavedValue();
         return;
       }
@@ -215,27 +321,63 @@ void DBIter::FindPrevUserEntry() {
   assert(direction_ == kReverse);
 
   ValueType value_type = kTypeDeletion;
+  int num_skipped = 0;
   if (iter_->Valid()) {
     do {
       ParsedInternalKey ikey;
-      if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
-        if ((value_type != kTypeDeletion) &&
-            user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
-          // We encountered a non-deleted value in entries for previous keys,
-          break;
+      if (ParseKey(&ikey)) {
+        bool same_key = false;
+        if (value_type != kTypeDeletion) {
+          const int r = user_comparator_->Compare(ikey.user_key, saved_key_);
+          if (r < 0) {
+            // We encountered entries for previous keys after a
+            // non-deleted value
+            break;
+          }
+          same_key = (r == 0);
         }
-        value_type = ikey.type;
-        if (value_type == kTypeDeletion) {
-          saved_key_.clear();
-          ClearSavedValue();
+        if (ikey.sequence > sequence_) {
+          // Entry hidden because it is newer than the snapshot.  These
+          // come after the entries of their key that the snapshot can
+          // see, so if there are many of them, jump to just before the
+          // key's first entry.
+          num_skipped++;
+          if (max_skip_ > 0 && num_skipped > max_skip_) {
+            num_skipped = 0;
+            std::string target;
+            AppendInternalKey(
+                &target, ParsedInternalKey(ikey.user_key, kMaxSequenceNumber,
+                                           kValueTypeForSeek));
+            iter_->Seek(target);
+            reseeks_++;
+            if (iter_->Valid()) {
+              iter_->Prev();
+            } else {
+              iter_->SeekToLast();
+            }
+            continue;
+          }
         } else {
-          Slice raw_value = iter_->value();
-          if (saved_value_.capacity() > raw_value.size() + 1048576) {
-            std::string empty;
-            swap(empty, saved_value_);
+          if (ikey.type == kTypeValue && EntryMissing(iter_->value())) {
+            // Carry on from the entry before the missing one
+            if (iter_->Valid()) {
+              iter_->Prev();
+            } else {
+              iter_->SeekToLast();
+            }
+            continue;
+          }
+          value_type = ikey.type;
+          if (value_type == kTypeDeletion) {
+            ClearSavedKey();
+            ClearSavedValue();
+          } else {
+            if (!same_key) {
+              // Newer versions of an already saved key only replace the value
+              SaveKey(ikey.user_key);
+            }
+            SaveValue(iter_->value());
           }
-          SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
-          saved_value_.assign(raw_value.data(), raw_value.size());
         }
       }
       iter_->Prev();
@@ -245,7 +387,7 @@ void DBIter::FindPrevUserEntry() {
   if (value_type == kTypeDeletion) {
     // End
     valid_ = false;
-    saved_key_.clear();
+    ClearSavedKey();
     ClearSavedValue();
     direction_ = kForward;
   } else {
@@ -256,12 +398,12 @@ void DBIter::FindPrevUserEntry() {
 void DBIter::Seek(const Slice& target) {
   direction_ = kForward;
   ClearSavedValue();
-  saved_key_.clear();
+  ClearSavedKey();
   AppendInternalKey(
-      &saved_key_, ParsedInternalKey(target, sequence_, kValueTypeForSeek));
-  iter_->Seek(saved_key_);
+      &key_buf_, ParsedInternalKey(target, sequence_, kValueTypeForSeek));
+  iter_->Seek(key_buf_);
   if (iter_->Valid()) {
-    FindNextUserEntry(false, &saved_key_ /* temporary storage */);
+    FindNextUserEntry(false);
   } else {
     valid_ = false;
   }
@@ -272,7 +414,7 @@ void DBIter::SeekToFirst() {
   ClearSavedValue();
   iter_->SeekToFirst();
   if (iter_->Valid()) {
-    FindNextUserEntry(false, &saved_key_ /* temporary storage */);
+    FindNextUserEntry(false);
   } else {
     valid_ = false;
   }
@@ -288,12 +430,16 @@ void DBIter::SeekToLast() {
 }  // anonymous namespace
 
 Iterator* NewDBIterator(
+    DBImpl* db,
     const std::string* dbname,
     Env* env,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
-    const SequenceNumber& sequence) {
-  return new DBIter(dbname, env, user_key_comparator, internal_iter, sequence);
+    const SequenceNumber& sequence,
+    bool pin_data,
+    int max_skip) {
+  return new DBIter(db, dbname, env, user_key_comparator, internal_iter,
+                    sequence, pin_data, max_skip);
 }
 
 }
@@ -11,15 +11,25 @@
 
 namespace leveldb {
 
+class DBImpl;
+
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
+// into appropriate user keys.  If "pin_data" is true, "*internal_iter"
+// must keep the memory behind its values (and behind every key for which
+// IsKeyPinned() returns true) alive until it is deleted.  After stepping
+// over "max_skip" hidden entries of one user key, the iterator seeks past
+// the rest of them instead (never if "max_skip" is zero) and reports this
+// to "db".
 extern Iterator* NewDBIterator(
+    DBImpl* db,
     const std::string* dbname,
     Env* env,
     const Comparator* user_key_comparator,
     Iterator* internal_iter,
-    const SequenceNumber& sequence);
+    const SequenceNumber& sequence,
+    bool pin_data,
+    int max_skip);
 
 }
 
@@ -7,7 +7,11 @@
 #include "db/filename.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/cache.h"
+#include "leveldb/compaction_filter.h"
 #include "leveldb/env.h"
+#include "leveldb/persistent_cache.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/table.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
@@ -22,14 +26,52 @@ static std::string RandomString(Random* rnd, int len) {
   return r;
 }
 
+namespace {
+class AtomicCounter {
+ private:
+  port::Mutex mu_;
+  int count_;
+ public:
+  AtomicCounter() : count_(0) { }
+  void Increment() {
+    MutexLock l(&mu_);
+    count_++;
+  }
+  int Read() {
+    MutexLock l(&mu_);
+    return count_;
+  }
+  void Reset() {
+    MutexLock l(&mu_);
+    count_ = 0;
+  }
+};
+}
+
 // Special Env used to delay background operations
 class SpecialEnv : public EnvWrapper {
  public:
   // sstable Sync() calls are blocked while this pointer is non-NULL.
   port::AtomicPointer delay_sstable_sync_;
 
+  // Number of sstable reads done since the counter was last reset
+  AtomicCounter sstable_read_counter_;
+
+  // Number of sstables opened for reading since the counter was last reset
+  AtomicCounter sstable_open_counter_;
+
+  // While this points at a file number, reads of sstables with smaller
+  // numbers are blocked.
+  port::AtomicPointer delay_sstable_reads_below_;
+
+  // While this pointer is non-NULL, sstable reads are copied into the
+  // caller's scratch space, as done by files that are not mmapped.
+  port::AtomicPointer copy_sstable_reads_;
+
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
     delay_sstable_sync_.Release_Store(NULL);
+    delay_sstable_reads_below_.Release_Store(NULL);
+    copy_sstable_reads_.Release_Store(NULL);
   }
 
   Status NewWritableFile(const std::string& f, WritableFile** r) {
@@ -63,6 +105,48 @@ class SpecialEnv : public EnvWrapper {
     }
     return s;
   }
+
+  Status NewRandomAccessFile(const std::string& f, RandomAccessFile** r) {
+    class CountingFile : public RandomAccessFile {
+     private:
+      SpecialEnv* env_;
+      RandomAccessFile* target_;
+      uint64_t number_;
+     public:
+      CountingFile(SpecialEnv* env, RandomAccessFile* target, uint64_t number)
+          : env_(env), target_(target), number_(number) {
+      }
+      virtual ~CountingFile() { delete target_; }
+      virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                          char* scratch) const {
+        const uint64_t* limit;
+        while ((limit = reinterpret_cast<const uint64_t*>(
+                    env_->delay_sstable_reads_below_.Acquire_Load())) != NULL &&
+               number_ < *limit) {
+          env_->SleepForMicroseconds(10000);
+        }
+        env_->sstable_read_counter_.Increment();
+        Status s = target_->Read(offset, n, result, scratch);
+        if (s.ok() && env_->copy_sstable_reads_.Acquire_Load() != NULL &&
+            result->data() != scratch) {
+          memcpy(scratch, result->data(), result->size());
+          *result = Slice(scratch, result->size());
+        }
+        return s;
+      }
+      virtual void Hint(AccessPattern pattern) { target_->Hint(pattern); }
+    };
+
+    Status s = target()->NewRandomAccessFile(f, r);
+    uint64_t number;
+    FileType type;
+    if (s.ok() && ParseFileName(f.substr(f.rfind('/') + 1), &number, &type) &&
+        type == kTableFile) {
+      sstable_open_counter_.Increment();
+      *r = new CountingFile(this, *r, number);
+    }
+    return s;
+  }
 };
 
 class DBTest {
@@ -216,13 +300,16 @@ class DBTest {
   }
 
   // Prevent pushing of new sstables into deeper levels by adding
-  // tables that cover a specified range to all levels.
+  // tables that cover a specified range to all levels.  Flushes do not
+  // wait for compactions, so let the ones this triggers finish before
+  // the caller adds files of its own.
   void FillLevels(const std::string& smallest, const std::string& largest) {
     for (int level = 0; level < config::kNumLevels; level++) {
       Put(smallest, "begin");
       Put(largest, "end");
       dbfull()->TEST_CompactMemTable();
     }
+    dbfull()->TEST_WaitForBackgroundWork();
   }
 
   void DumpFileCounts(const char* label) {
@@ -570,6 +657,307 @@ TEST(DBTest, IterMultiWithDelete) {
   delete iter;
 }
 
+TEST(DBTest, IterReseek) {
+  Options options;
+  options.env = env_;
+  options.max_sequential_skip_in_iterations = 3;
+  Reopen(&options);
+
+  // Few overwrites of "a" are stepped over
+  ASSERT_OK(Put("a", "v0"));
+  ASSERT_OK(Put("a", "v1"));
+  ASSERT_OK(Put("a", "v2"));
+  ASSERT_OK(Put("b", "vb"));
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->v2");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  delete iter;
+  std::string num;
+  ASSERT_TRUE(db_->GetProperty("leveldb.iterator-reseeks", &num));
+  ASSERT_EQ("0", num);
+
+  // Many overwrites and deletions of "a" trigger a reseek
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(Put("a", "v"));
+    ASSERT_OK(Delete("a"));
+  }
+  ASSERT_OK(Put("a", "va"));
+  iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->va");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  delete iter;
+  ASSERT_TRUE(db_->GetProperty("leveldb.iterator-reseeks", &num));
+  ASSERT_EQ("1", num);
+
+  // Deleted key followed by its hidden versions
+  ASSERT_OK(Delete("a"));
+  iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  delete iter;
+  ASSERT_TRUE(db_->GetProperty("leveldb.iterator-reseeks", &num));
+  ASSERT_EQ("2", num);
+
+  // Many writes since the snapshot are jumped over in both directions
+  ASSERT_OK(Put("a", "vs"));
+  const Snapshot* snapshot = db_->GetSnapshot();
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(Put("a", "new"));
+    ASSERT_OK(Put("b", "new"));
+  }
+  ReadOptions ropts;
+  ropts.snapshot = snapshot;
+  iter = db_->NewIterator(ropts);
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->vs");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  delete iter;
+  // One more reseek passes the old versions of "a"
+  ASSERT_TRUE(db_->GetProperty("leveldb.iterator-reseeks", &num));
+  ASSERT_EQ("5", num);
+
+  iter = db_->NewIterator(ropts);
+  iter->SeekToLast();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "a->vs");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "(invalid)");
+  delete iter;
+  ASSERT_TRUE(db_->GetProperty("leveldb.iterator-reseeks", &num));
+  ASSERT_EQ("7", num);
+  db_->ReleaseSnapshot(snapshot);
+}
+
+TEST(DBTest, PreloadTables) {
+  Options options;
+  options.env = env_;
+  Reopen(&options);
+
+  // Files at level 0 as well as at the levels below it
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("z", "vz"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("m", "vm"));
+  ASSERT_OK(Put("n", "vn"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("b", "vb"));
+  ASSERT_OK(Put("c", "vc"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("a", "va2"));
+  ASSERT_OK(Put("z", "vz2"));
+  dbfull()->TEST_CompactMemTable();
+  const int num_files = NumTableFilesAtLevel(0) + NumTableFilesAtLevel(1) +
+      NumTableFilesAtLevel(2);
+  ASSERT_EQ(4, num_files);
+  ASSERT_GT(NumTableFilesAtLevel(0), 0);
+
+  // Without preloading, tables are opened by the first reads
+  env_->sstable_open_counter_.Reset();
+  Reopen(&options);
+  ASSERT_EQ(0, env_->sstable_open_counter_.Read());
+
+  options.preload_tables = true;
+  options.max_file_opening_threads = 2;
+  Reopen(&options);
+  ASSERT_EQ(num_files, env_->sstable_open_counter_.Read());
+  ASSERT_EQ("va2", Get("a"));
+  ASSERT_EQ("vb", Get("b"));
+  ASSERT_EQ("vm", Get("m"));
+  ASSERT_EQ("vz2", Get("z"));
+  ASSERT_EQ(num_files, env_->sstable_open_counter_.Read());
+}
+
+TEST(DBTest, PinAsManyTablesAsTheCacheHolds) {
+  Options options;
+  options.env = env_;
+  options.max_open_files = 20;  // The table cache holds 10 tables
+  Reopen(&options);
+
+  // Produce 10 non-overlapping files, each with a single key
+  for (int i = 0; i < 10; i++) {
+    ASSERT_OK(Put(std::string(1, 'a' + i), "v"));
+    dbfull()->TEST_CompactMemTable();
+  }
+  int num_files = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    num_files += NumTableFilesAtLevel(level);
+  }
+  ASSERT_EQ(10, num_files);
+
+  // Every table is pinned when first read, so reading them all again
+  // opens none of them a second time
+  Reopen(&options);
+  env_->sstable_open_counter_.Reset();
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 10; i++) {
+      ASSERT_EQ("v", Get(std::string(1, 'a' + i)));
+    }
+    ASSERT_EQ(10, env_->sstable_open_counter_.Read());
+  }
+}
+
+TEST(DBTest, PersistentCacheOutlivesTables) {
+  PersistentCache* persistent_cache;
+  ASSERT_OK(NewPersistentCache(env_, test::TmpDir() + "/db_persistent_cache",
+                               1 << 20, &persistent_cache));
+  Options options;
+  options.env = env_;
+  options.max_open_files = 20;  // The table cache holds 10 tables
+  options.block_cache = NewLRUCache(1);  // Evicts every block
+  options.persistent_cache = persistent_cache;
+  Reopen(&options);
+
+  // Produce 12 files, of which only 10 can be pinned
+  for (int i = 0; i < 12; i++) {
+    ASSERT_OK(Put(std::string(1, 'a' + i), "v"));
+    dbfull()->TEST_CompactMemTable();
+  }
+  Reopen(&options);
+  for (int i = 0; i < 12; i++) {
+    ASSERT_EQ("v", Get(std::string(1, 'a' + i)));
+  }
+  persistent_cache->WaitForWrites();
+
+  // The last two tables are closed again after every read.  Opening one
+  // takes a single read of its tail, and its data block is found in the
+  // persistent cache under the same key as before.
+  env_->sstable_open_counter_.Reset();
+  env_->sstable_read_counter_.Reset();
+  ASSERT_EQ("v", Get("k"));
+  ASSERT_EQ("v", Get("l"));
+  ASSERT_EQ(2, env_->sstable_open_counter_.Read());
+  ASSERT_EQ(2, env_->sstable_read_counter_.Read());
+
+  delete db_;
+  db_ = NULL;
+  delete persistent_cache;
+  delete options.block_cache;
+}
+
+TEST(DBTest, IterOpensTablesLazily) {
+  Options options;
+  options.env = env_;
+  Reopen(&options);
+
+  // Produce a level-2 file covering [a,z] and level-1 files
+  // covering [b,c] and [m,n].
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("z", "vz"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("m", "vm"));
+  ASSERT_OK(Put("n", "vn"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("b", "vb"));
+  ASSERT_OK(Put("c", "vc"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  ASSERT_EQ(2, NumTableFilesAtLevel(1));
+  ASSERT_EQ(1, NumTableFilesAtLevel(2));
+
+  // A seek to "d" only reads the [m,n] file because the iterator lands
+  // on its first entry: positioning the merged iterators takes nothing
+  // but its boundary keys
+  env_->sstable_read_counter_.Reset();
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->Seek("d");
+  ASSERT_EQ(2, env_->sstable_read_counter_.Read());
+  ASSERT_EQ(IterStatus(iter), "m->vm");
+  ASSERT_EQ(2, env_->sstable_read_counter_.Read());
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "n->vn");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "z->vz");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "n->vn");
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->va");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "b->vb");
+  iter->SeekToLast();
+  ASSERT_EQ(IterStatus(iter), "z->vz");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "n->vn");
+  iter->Seek("e");
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "c->vc");
+  delete iter;
+}
+
+TEST(DBTest, IterUnreadableLazyTable) {
+  Options options;
+  options.env = env_;
+  Reopen(&options);
+
+  // Produce level-2 and level-1 files covering [a,y] and a level-0 file
+  // covering [x,z]
+  ASSERT_OK(Put("a", "va"));
+  ASSERT_OK(Put("y", "vy"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("a", "va2"));
+  ASSERT_OK(Put("y", "vy2"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("x", "vx"));
+  ASSERT_OK(Put("z", "vz"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(1, NumTableFilesAtLevel(0));
+  ASSERT_EQ(1, NumTableFilesAtLevel(1));
+  ASSERT_EQ(1, NumTableFilesAtLevel(2));
+
+  // Remove the level-0 file while no table is open
+  Reopen(&options);
+  std::vector<std::string> filenames;
+  ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+  uint64_t newest = 0;
+  for (size_t i = 0; i < filenames.size(); i++) {
+    uint64_t number;
+    FileType type;
+    if (ParseFileName(filenames[i], &number, &type) && type == kTableFile) {
+      newest = std::max(newest, number);
+    }
+  }
+  ASSERT_OK(env_->DeleteFile(TableFileName(dbname_, newest)));
+
+  // The boundary keys of the missing table are never returned, with or
+  // without a value; the iterator reports the error and goes on with
+  // the other tables
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->Seek("x");
+  ASSERT_EQ(IterStatus(iter), "y->vy2");
+  ASSERT_TRUE(!iter->status().ok());
+  iter->Next();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_TRUE(!iter->status().ok());
+  delete iter;
+
+  iter = db_->NewIterator(ReadOptions());
+  iter->SeekToLast();
+  ASSERT_EQ(IterStatus(iter), "y->vy2");
+  ASSERT_TRUE(!iter->status().ok());
+  iter->Prev();
+  ASSERT_EQ(IterStatus(iter), "a->va2");
+  delete iter;
+
+  iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_EQ(IterStatus(iter), "a->va2");
+  iter->Next();
+  ASSERT_EQ(IterStatus(iter), "y->vy2");
+  iter->Next();
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_TRUE(!iter->status().ok());
+  delete iter;
+}
+
 TEST(DBTest, Recover) {
   ASSERT_OK(Put("foo", "v1"));
   ASSERT_OK(Put("baz", "v5"));
@@ -676,6 +1064,31 @@ TEST(DBTest, RecoverWithLargeLog) {
   ASSERT_GT(NumTableFilesAtLevel(0), 1);
 }
 
+TEST(DBTest, RecoverWithManyRecords) {
+  // Enough records to be handed over in several chunks and to fill
+  // several memtables on recovery
+  const int kNum = 20000;
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < kNum; i++) {
+    values.push_back(RandomString(&rnd, 100));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+
+  Options options;
+  options.write_buffer_size = 100000;
+  Reopen(&options);
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+
+  std::string stats;
+  ASSERT_TRUE(db_->GetProperty("leveldb.recovery-stats", &stats));
+  ASSERT_TRUE(stats.find("Logs: 1 files, 20000 records") != std::string::npos)
+      << stats;
+}
+
 TEST(DBTest, CompactionsGenerateMultipleFiles) {
   Options options;
   options.write_buffer_size = 100000000;        // Large write buffer
@@ -702,6 +1115,49 @@ TEST(DBTest, CompactionsGenerateMultipleFiles) {
   }
 }
 
+TEST(DBTest, Subcompactions) {
+  Options options;
+  options.write_buffer_size = 100000000;        // Large write buffer
+  options.max_subcompactions = 4;
+  Reopen(&options);
+
+  // Fill several level-1 files, then overwrite every key in level-0
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 80; i++) {
+    values.push_back(RandomString(&rnd, 100000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, "", Key(100000));
+  ASSERT_GT(NumTableFilesAtLevel(1), 2);
+  for (int i = 0; i < 80; i++) {
+    values[i] = RandomString(&rnd, 100000);
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_OK(Delete(Key(7)));
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, "", Key(100000));
+
+  std::string log;
+  ASSERT_OK(ReadFileToString(env_, InfoLogFileName(dbname_), &log));
+  ASSERT_TRUE(log.find("Compacting in ") != std::string::npos);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_GT(NumTableFilesAtLevel(1), 2);
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ(i == 7 ? "NOT_FOUND" : values[i], Get(Key(i)));
+  }
+  Reopen(&options);
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+  ASSERT_EQ(79, count);
+}
+
 TEST(DBTest, RepeatedWritesToSameKey) {
   Options options;
   options.env = env_;
@@ -721,6 +1177,104 @@ TEST(DBTest, RepeatedWritesToSameKey) {
   }
 }
 
+TEST(DBTest, ConcurrentCompactions) {
+  Options options;
+  options.env = env_;
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.max_background_compactions = 4;
+  Reopen(&options);
+
+  // Overwrite keys in random order so that every level takes part
+  const int kNum = 2000;
+  Random rnd(301);
+  std::vector<std::string> values(kNum);
+  for (int i = 0; i < 5 * kNum; i++) {
+    const int k = rnd.Uniform(kNum);
+    values[k] = RandomString(&rnd, 500);
+    ASSERT_OK(Put(Key(k), values[k]));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_GT(NumTableFilesAtLevel(1) + NumTableFilesAtLevel(2), 0);
+
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(values[i].empty() ? "NOT_FOUND" : values[i], Get(Key(i)));
+  }
+  Reopen(&options);
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int k = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    while (values[k].empty()) k++;
+    ASSERT_EQ(Key(k), iter->key().ToString());
+    ASSERT_EQ(values[k], iter->value().ToString());
+    k++;
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+  while (k < kNum && values[k].empty()) k++;
+  ASSERT_EQ(kNum, k);
+}
+
+namespace {
+struct CompactLevel0State {
+  DBTest* test;
+  port::AtomicPointer done;
+};
+
+static void CompactLevel0(void* arg) {
+  CompactLevel0State* state = reinterpret_cast<CompactLevel0State*>(arg);
+  state->test->dbfull()->TEST_CompactRange(0, "", "~");
+  state->done.Release_Store(state);
+}
+}
+
+TEST(DBTest, FlushDuringCompaction) {
+  Options options;
+  options.env = env_;
+  Reopen(&options);
+
+  // Two overlapping level-0 files, compacted by a thread that gets
+  // stuck reading them
+  ASSERT_OK(Put("a", "v1"));
+  ASSERT_OK(Put("z", "v1"));
+  Reopen(&options);
+  ASSERT_OK(Put("a", "v2"));
+  ASSERT_OK(Put("z", "v2"));
+  Reopen(&options);
+  ASSERT_EQ(2, NumTableFilesAtLevel(0));
+
+  std::vector<std::string> files;
+  ASSERT_OK(env_->GetChildren(dbname_, &files));
+  uint64_t limit = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    uint64_t number;
+    FileType type;
+    if (ParseFileName(files[i], &number, &type) && type == kTableFile) {
+      limit = std::max(limit, number + 1);
+    }
+  }
+  env_->delay_sstable_reads_below_.Release_Store(&limit);
+  CompactLevel0State state;
+  state.test = this;
+  state.done.Release_Store(NULL);
+  env_->StartThread(CompactLevel0, &state);
+
+  // The memtable is flushed while the compaction is stuck
+  ASSERT_OK(Put("m", "v3"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_TRUE(state.done.Acquire_Load() == NULL);
+  std::string stats;
+  ASSERT_TRUE(db_->GetProperty("leveldb.flush-stats", &stats));
+  ASSERT_TRUE(stats.find("Flushes: 1,") != std::string::npos) << stats;
+
+  env_->delay_sstable_reads_below_.Release_Store(NULL);
+  while (state.done.Acquire_Load() == NULL) {
+    env_->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ("v2", Get("a"));
+  ASSERT_EQ("v3", Get("m"));
+  ASSERT_EQ("v2", Get("z"));
+}
+
 TEST(DBTest, SparseMerge) {
   Options options;
   options.compression = kNoCompression;
@@ -876,6 +1430,66 @@ TEST(DBTest, IteratorPinsRef) {
   delete iter;
 }
 
+TEST(DBTest, IterPinnedData) {
+  Options options;
+  options.env = env_;
+  options.block_size = 256;     // Spread the data over many blocks
+  options.block_delta_encoding = false;
+  Reopen(&options);
+
+  Random rnd(301);
+  std::map<std::string, std::string> expected;
+  for (int i = 0; i < 200; i++) {
+    expected[Key(i)] = RandomString(&rnd, 50);
+    ASSERT_OK(Put(Key(i), expected[Key(i)]));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int i = 0; i < 200; i += 7) {
+    expected[Key(i)] = RandomString(&rnd, 50);
+    ASSERT_OK(Put(Key(i), expected[Key(i)]));
+  }
+  ASSERT_OK(Delete(Key(3)));
+  expected.erase(Key(3));
+
+  ReadOptions ropts;
+  ropts.pin_data = true;
+  for (int reverse = 0; reverse < 2; reverse++) {
+    std::vector<Slice> keys, values;
+    Iterator* iter = db_->NewIterator(ropts);
+    if (reverse) {
+      for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+        ASSERT_TRUE(iter->IsKeyPinned());
+        keys.push_back(iter->key());
+        values.push_back(iter->value());
+      }
+    } else {
+      for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+        ASSERT_TRUE(iter->IsKeyPinned());
+        keys.push_back(iter->key());
+        values.push_back(iter->value());
+      }
+    }
+    ASSERT_OK(iter->status());
+
+    // Slices collected during the scan must still be intact
+    ASSERT_EQ(expected.size(), keys.size());
+    int i = reverse ? keys.size() - 1 : 0;
+    for (std::map<std::string, std::string>::const_iterator it =
+             expected.begin();
+         it != expected.end(); ++it) {
+      ASSERT_EQ(it->first, keys[i].ToString());
+      ASSERT_EQ(it->second, values[i].ToString());
+      i += reverse ? -1 : 1;
+    }
+    delete iter;
+  }
+
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->SeekToFirst();
+  ASSERT_TRUE(!iter->IsKeyPinned());
+  delete iter;
+}
+
 TEST(DBTest, Snapshot) {
   Put("foo", "v1");
   const Snapshot* s1 = db_->GetSnapshot();
@@ -985,6 +1599,355 @@ TEST(DBTest, DeletionMarkers2) {
   ASSERT_EQ(AllEntriesFor("foo"), "[ ]");
 }
 
+static void RecordProgress(void* arg, int done, int total) {
+  std::string* steps = reinterpret_cast<std::string*>(arg);
+  char buf[50];
+  snprintf(buf, sizeof(buf), "%d/%d ", done, total);
+  steps->append(buf);
+}
+
+TEST(DBTest, CompactRange) {
+  Put("foo", "v1");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);   // foo => v1 is now in last level
+  Put("a", "begin");
+  Put("z", "end");
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(NumTableFilesAtLevel(last-1), 1);
+
+  const Snapshot* snapshot = db_->GetSnapshot();
+  Delete("foo");
+
+  // Everything is pushed to the last level, but the snapshot keeps both
+  // entries for "foo" alive
+  CompactRangeOptions options;
+  std::string steps;
+  options.progress = &RecordProgress;
+  options.progress_arg = &steps;
+  ASSERT_OK(db_->CompactRange(NULL, NULL, options));
+  ASSERT_EQ("1/2 2/2 ", steps);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_EQ(NumTableFilesAtLevel(last-1), 0);
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);
+  ASSERT_EQ(AllEntriesFor("foo"), "[ DEL, v1 ]");
+
+  // Without a level to merge into, the last level is left alone unless
+  // it is rewritten
+  db_->ReleaseSnapshot(snapshot);
+  ASSERT_OK(db_->CompactRange(NULL, NULL, CompactRangeOptions()));
+  ASSERT_EQ(AllEntriesFor("foo"), "[ DEL, v1 ]");
+  Slice begin("f"), end("g");
+  steps.clear();
+  options.rewrite_bottommost = true;
+  ASSERT_OK(db_->CompactRange(&begin, &end, options));
+  ASSERT_EQ("1/3 2/3 3/3 ", steps);
+  ASSERT_EQ(AllEntriesFor("foo"), "[ ]");
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);
+  ASSERT_EQ("begin", Get("a"));
+  ASSERT_EQ("end", Get("z"));
+
+  // A range without data is a no-op
+  Slice past("zz");
+  steps.clear();
+  ASSERT_OK(db_->CompactRange(&past, NULL, options));
+  ASSERT_EQ("", steps);
+}
+
+TEST(DBTest, UniversalCompaction) {
+  Options options;
+  options.env = env_;
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.compaction_style = kCompactionStyleUniversal;
+  Reopen(&options);
+
+  const int kNum = 1000;
+  Random rnd(301);
+  std::vector<std::string> values(kNum);
+  for (int i = 0; i < 5 * kNum; i++) {
+    const int k = rnd.Uniform(kNum);
+    if (rnd.OneIn(10)) {
+      values[k].clear();
+      ASSERT_OK(Delete(Key(k)));
+    } else {
+      values[k] = RandomString(&rnd, 200);
+      ASSERT_OK(Put(Key(k), values[k]));
+    }
+  }
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_WaitForBackgroundWork();
+
+  // All runs stay in level-0, and merges keep their number down
+  std::string log;
+  ASSERT_OK(ReadFileToString(env_, InfoLogFileName(dbname_), &log));
+  ASSERT_TRUE(log.find("Universal compaction of ") != std::string::npos);
+  for (int level = 1; level < config::kNumLevels; level++) {
+    ASSERT_EQ(NumTableFilesAtLevel(level), 0);
+  }
+  ASSERT_LT(NumTableFilesAtLevel(0), config::kL0_CompactionTrigger);
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(values[i].empty() ? "NOT_FOUND" : values[i], Get(Key(i)));
+  }
+
+  // A full merge leaves a single run without deletion markers
+  ASSERT_OK(Delete(Key(0)));
+  values[0].clear();
+  ASSERT_OK(db_->CompactRange(NULL, NULL, CompactRangeOptions()));
+  ASSERT_EQ(NumTableFilesAtLevel(0), 1);
+  ASSERT_EQ(AllEntriesFor(Key(0)), "[ ]");
+  Reopen(&options);
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(values[i].empty() ? "NOT_FOUND" : values[i], Get(Key(i)));
+  }
+}
+
+TEST(DBTest, DynamicLevelSizing) {
+  Options options;
+  options.env = env_;
+  options.write_buffer_size = 100000;
+  options.max_bytes_for_level_base = 64 << 10;
+  options.target_file_size_base = 64 << 10;
+  options.level_compaction_dynamic_level_bytes = true;
+  Reopen(&options);
+
+  // The first level-0 compaction goes straight to the last level
+  const int last = config::kNumLevels - 1;
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 4 * 20; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+    if (i % 20 == 19) {
+      dbfull()->TEST_CompactMemTable();
+    }
+  }
+  dbfull()->TEST_WaitForBackgroundWork();
+  for (int level = 1; level < last; level++) {
+    ASSERT_EQ(NumTableFilesAtLevel(level), 0);
+  }
+  ASSERT_GT(NumTableFilesAtLevel(last), 0);
+
+  // With about 2MB of data, the base level is level-4: its limit is
+  // 1/100 of the size of the last level, under 64KB
+  for (int i = 4 * 20; i < 2000; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_WaitForBackgroundWork();
+  for (int level = 1; level < 4; level++) {
+    ASSERT_EQ(NumTableFilesAtLevel(level), 0);
+  }
+  for (int level = 0; level < last; level++) {
+    ASSERT_LT(NumTableFilesAtLevel(level), NumTableFilesAtLevel(last));
+  }
+  for (int i = 0; i < 2000; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+
+  // A full compaction ends in the last level
+  ASSERT_OK(db_->CompactRange(NULL, NULL, CompactRangeOptions()));
+  for (int level = 0; level < last; level++) {
+    ASSERT_EQ(NumTableFilesAtLevel(level), 0);
+  }
+  ASSERT_EQ(values[1234], Get(Key(1234)));
+}
+
+TEST(DBTest, FIFOCompaction) {
+  Options options;
+  options.env = env_;
+  options.compaction_style = kCompactionStyleFIFO;
+  options.fifo_max_table_files_size = 500000;
+  Reopen(&options);
+
+  // Each round of writes makes a table of about 100KB
+  Random rnd(301);
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(Put(Key(round * 100 + i), RandomString(&rnd, 1000)));
+    }
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_WaitForBackgroundWork();
+  }
+
+  // The oldest tables are gone, and nothing was merged
+  std::string log;
+  ASSERT_OK(ReadFileToString(env_, InfoLogFileName(dbname_), &log));
+  ASSERT_TRUE(log.find("FIFO compaction deletes ") != std::string::npos);
+  ASSERT_LT(NumTableFilesAtLevel(0), 6);
+  ASSERT_GT(NumTableFilesAtLevel(0), 2);
+  for (int level = 1; level < config::kNumLevels; level++) {
+    ASSERT_EQ(NumTableFilesAtLevel(level), 0);
+  }
+  ASSERT_EQ("NOT_FOUND", Get(Key(0)));
+  ASSERT_EQ("NOT_FOUND", Get(Key(499)));
+  ASSERT_EQ(1000, Get(Key(700)).size());
+  ASSERT_EQ(1000, Get(Key(999)).size());
+
+  // Past the file count limit the oldest tables are deleted as well
+  options.fifo_max_table_files_size = 1 << 30;
+  options.fifo_max_table_files = 4;
+  Reopen(&options);
+  for (int i = 0; i < 6; i++) {
+    ASSERT_OK(Put(Key(1000 + i), "small"));
+    dbfull()->TEST_CompactMemTable();
+    dbfull()->TEST_WaitForBackgroundWork();
+  }
+  ASSERT_EQ(NumTableFilesAtLevel(0), 4);
+  ASSERT_EQ("NOT_FOUND", Get(Key(999)));
+  ASSERT_EQ("NOT_FOUND", Get(Key(1001)));
+  ASSERT_EQ("small", Get(Key(1002)));
+
+  // Tables that outlive the TTL are deleted even if the DB is idle
+  options.fifo_ttl_seconds = 1;
+  Reopen(&options);
+  for (int i = 0; i < 100 && NumTableFilesAtLevel(0) > 0; i++) {
+    env_->SleepForMicroseconds(100000);
+  }
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_EQ("NOT_FOUND", Get(Key(1005)));
+  ASSERT_OK(Put(Key(2000), "new"));
+  ASSERT_EQ("new", Get(Key(2000)));
+}
+
+TEST(DBTest, RateLimiter) {
+  RateLimiter* limiter = NewGenericRateLimiter(100 << 20);
+  Options options;
+  options.env = env_;
+  options.write_buffer_size = 100000;  // Small write buffer
+  options.rate_limiter = limiter;
+  Reopen(&options);
+
+  // Both flushes and compactions are charged
+  Random rnd(301);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_OK(Put(Key(i), RandomString(&rnd, 1000)));
+  }
+  dbfull()->TEST_WaitForBackgroundWork();
+  const uint64_t written = limiter->GetTotalBytesThrough();
+  ASSERT_GT(written, 500000);
+  CompactRangeOptions compact_options;
+  compact_options.rewrite_bottommost = true;
+  ASSERT_OK(db_->CompactRange(NULL, NULL, compact_options));
+  ASSERT_GT(limiter->GetTotalBytesThrough(), written + 500000);
+
+  delete db_;
+  db_ = NULL;
+  delete limiter;
+}
+
+TEST(DBTest, CompactionReadahead) {
+  Options options;
+  options.env = env_;
+  options.compaction_readahead_size = 1 << 20;
+  env_->copy_sstable_reads_.Release_Store(env_);
+  Reopen(&options);
+
+  // Two overlapping tables of a few hundred blocks each
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 1000; i++) {
+    values.push_back(RandomString(&rnd, 1000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  dbfull()->TEST_CompactMemTable();
+  for (int i = 0; i < 1000; i += 2) {
+    values[i] = RandomString(&rnd, 1000);
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(2, TotalTableFiles());
+
+  // Each table is read with a handful of large reads instead of one
+  // read per block
+  env_->sstable_read_counter_.Reset();
+  CompactRangeOptions compact_options;
+  compact_options.rewrite_bottommost = true;
+  ASSERT_OK(db_->CompactRange(NULL, NULL, compact_options));
+  ASSERT_LT(env_->sstable_read_counter_.Read(), 20);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+  env_->copy_sstable_reads_.Release_Store(NULL);
+}
+
+namespace {
+// Drops the values "drop" and changes the values "change" to "changed"
+class TestCompactionFilter : public CompactionFilter {
+ public:
+  virtual bool Filter(int level, const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value, bool* value_changed) const {
+    if (existing_value == "drop") {
+      return true;
+    }
+    if (existing_value == "change") {
+      *new_value = "changed";
+      *value_changed = true;
+    }
+    return false;
+  }
+  virtual const char* Name() const { return "TestCompactionFilter"; }
+};
+}
+
+TEST(DBTest, CompactionFilter) {
+  TestCompactionFilter filter;
+  Options options;
+  options.env = env_;
+  options.compaction_filter = &filter;
+  Reopen(&options);
+
+  Put("foo", "keep");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  const int last = config::kMaxMemCompactLevel;
+  ASSERT_EQ(NumTableFilesAtLevel(last), 1);   // foo => keep is in last level
+
+  // Place a table at level last-1 to prevent merging with preceding mutation
+  Put("a", "change");
+  Put("z", "keep");
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ(NumTableFilesAtLevel(last-1), 1);
+
+  Put("foo", "drop");
+  Put("bar", "change");
+  const Snapshot* snapshot = db_->GetSnapshot();
+  Put("baz", "drop");
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());  // Moves to level last-2
+  dbfull()->TEST_CompactRange(last-2, "", "z");
+  // Only baz => drop, written after the snapshot, is filtered.  It turns
+  // into a deletion, since older entries kept for snapshots could be
+  // left behind it.
+  ASSERT_EQ(AllEntriesFor("foo"), "[ drop, keep ]");
+  ASSERT_EQ(AllEntriesFor("baz"), "[ DEL ]");
+  ASSERT_EQ("change", Get("a"));
+  ASSERT_EQ("change", Get("bar"));
+  ASSERT_EQ("keep", Get("z"));
+  ASSERT_EQ("drop", Get("foo", snapshot));
+  ASSERT_EQ("change", Get("a", snapshot));
+  ASSERT_EQ("change", Get("bar", snapshot));
+  ASSERT_EQ("NOT_FOUND", Get("baz", snapshot));
+
+  // Merging last-1 w/ last without the snapshot: foo => drop is removed
+  // outright along with foo => keep below it
+  db_->ReleaseSnapshot(snapshot);
+  dbfull()->TEST_CompactRange(last-1, "", "z");
+  ASSERT_EQ(AllEntriesFor("foo"), "[ ]");
+  ASSERT_EQ(AllEntriesFor("baz"), "[ ]");
+  ASSERT_EQ("changed", Get("a"));
+  ASSERT_EQ("changed", Get("bar"));
+  ASSERT_EQ("keep", Get("z"));
+
+  std::string stats;
+  ASSERT_TRUE(db_->GetProperty("leveldb.compaction-filter-stats", &stats));
+  ASSERT_EQ("Filtered: 5 entries\n"
+            "  dropped: 2, 1 without a deletion\n"
+            "  changed: 2\n", stats);
+
+  delete db_;
+  db_ = NULL;
+}
+
 TEST(DBTest, ComparatorCheck) {
   class NewComparator : public Comparator {
    public:
@@ -1211,6 +2174,10 @@ class ModelDB: public DB {
       sizes[i] = 0;
     }
   }
+  virtual Status CompactRange(const Slice* begin, const Slice* end,
+                              const CompactRangeOptions& options) {
+    return Status::OK();
+  }
  private:
   class ModelIter: public Iterator {
    public:
@@ -0,0 +1,304 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/file_index.h"
+
+#include <assert.h>
+#include <algorithm>
+#include "db/version_edit.h"
+#include "leveldb/comparator.h"
+
+namespace leveldb {
+
+FileIndex::FileIndex()
+    : icmp_(NULL),
+      disjoint_(true),
+      use_prefixes_(false) {
+}
+
+void FileIndex::Build(const InternalKeyComparator* icmp,
+                      const std::vector<FileMetaData*>& files,
+                      bool disjoint) {
+  icmp_ = icmp;
+  disjoint_ = disjoint;
+  use_prefixes_ = (icmp->user_comparator() == BytewiseComparator());
+  files_ = files;
+
+  size_t total = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    total += files[i]->smallest.Encode().size() +
+        files[i]->largest.Encode().size();
+  }
+  keys_.clear();
+  keys_.reserve(total);
+  smallest_.resize(files.size());
+  largest_.resize(files.size());
+  largest_prefix_.resize(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    const Slice smallest = files[i]->smallest.Encode();
+    const Slice largest = files[i]->largest.Encode();
+    smallest_[i].offset = static_cast<uint32_t>(keys_.size());
+    smallest_[i].size = static_cast<uint32_t>(smallest.size());
+    keys_.append(smallest.data(), smallest.size());
+    largest_[i].offset = static_cast<uint32_t>(keys_.size());
+    largest_[i].size = static_cast<uint32_t>(largest.size());
+    keys_.append(largest.data(), largest.size());
+    largest_prefix_[i] = Prefix(ExtractUserKey(largest));
+  }
+
+  bounds_.clear();
+  bound_prefix_.clear();
+  region_start_.clear();
+  region_files_.clear();
+  if (!disjoint_ && size() <= kMaxIntervalFiles) {
+    BuildIntervals();
+  }
+}
+
+namespace {
+struct BoundLess {
+  const Comparator* ucmp;
+  const std::string* keys;
+  template <typename Ref>
+  bool operator()(const Ref& a, const Ref& b) const {
+    return ucmp->Compare(Slice(keys->data() + a.offset, a.size),
+                         Slice(keys->data() + b.offset, b.size)) < 0;
+  }
+};
+}
+
+void FileIndex::BuildIntervals() {
+  const Comparator* ucmp = icmp_->user_comparator();
+
+  // The distinct boundary user keys, in order.  They point at the user
+  // key parts of the internal keys already in keys_.
+  for (uint32_t i = 0; i < size(); i++) {
+    KeyRef ref = smallest_[i];
+    ref.size -= 8;
+    bounds_.push_back(ref);
+    ref = largest_[i];
+    ref.size -= 8;
+    bounds_.push_back(ref);
+  }
+  BoundLess less;
+  less.ucmp = ucmp;
+  less.keys = &keys_;
+  std::sort(bounds_.begin(), bounds_.end(), less);
+  size_t m = 0;
+  for (size_t i = 0; i < bounds_.size(); i++) {
+    if (m == 0 || ucmp->Compare(Key(bounds_[m - 1]), Key(bounds_[i])) != 0) {
+      bounds_[m++] = bounds_[i];
+    }
+  }
+  bounds_.resize(m);
+  bound_prefix_.resize(m);
+  for (size_t j = 0; j < m; j++) {
+    bound_prefix_[j] = Prefix(Key(bounds_[j]));
+  }
+
+  // File i covers the regions from its smallest to its largest boundary
+  std::vector<uint32_t> first(size()), last(size());
+  for (uint32_t i = 0; i < size(); i++) {
+    KeyRef ref = smallest_[i];
+    ref.size -= 8;
+    first[i] = 2 * static_cast<uint32_t>(
+        std::lower_bound(bounds_.begin(), bounds_.end(), ref, less) -
+        bounds_.begin()) + 1;
+    ref = largest_[i];
+    ref.size -= 8;
+    last[i] = 2 * static_cast<uint32_t>(
+        std::lower_bound(bounds_.begin(), bounds_.end(), ref, less) -
+        bounds_.begin()) + 1;
+  }
+
+  // Count the files of each region in one sweep over the regions, with
+  // a file entering at first[i] and leaving after last[i], then place
+  // the files in file order.
+  const uint32_t regions = 2 * static_cast<uint32_t>(m) + 1;
+  std::vector<int> delta(regions + 1, 0);
+  for (uint32_t i = 0; i < size(); i++) {
+    delta[first[i]]++;
+    delta[last[i] + 1]--;
+  }
+  region_start_.resize(regions + 1);
+  uint32_t total = 0;
+  int covering = 0;
+  for (uint32_t r = 0; r < regions; r++) {
+    region_start_[r] = total;
+    covering += delta[r];
+    total += covering;
+  }
+  region_start_[regions] = total;
+  region_files_.resize(total);
+  std::vector<uint32_t> next(region_start_.begin(), region_start_.end() - 1);
+  for (uint32_t i = 0; i < size(); i++) {
+    for (uint32_t r = first[i]; r <= last[i]; r++) {
+      region_files_[next[r]++] = files_[i];
+    }
+  }
+}
+
+void FileIndex::FilesContaining(const Slice& user_key,
+                                std::vector<FileMetaData*>* scratch,
+                                FileMetaData* const** files,
+                                uint32_t* n) const {
+  assert(!disjoint_);
+  if (size() > kMaxIntervalFiles) {
+    const Comparator* ucmp = icmp_->user_comparator();
+    scratch->clear();
+    for (uint32_t i = 0; i < size(); i++) {
+      if (ucmp->Compare(user_key, SmallestUserKey(i)) >= 0 &&
+          ucmp->Compare(user_key, LargestUserKey(i)) <= 0) {
+        scratch->push_back(files_[i]);
+      }
+    }
+    *n = static_cast<uint32_t>(scratch->size());
+    *files = (*n > 0) ? &(*scratch)[0] : NULL;
+    return;
+  }
+  if (region_files_.empty()) {
+    *files = NULL;
+    *n = 0;
+    return;
+  }
+
+  // Find the first boundary >= user_key
+  const Comparator* ucmp = icmp_->user_comparator();
+  const uint64_t prefix = use_prefixes_ ? Prefix(user_key) : 0;
+  uint32_t left = 0;
+  uint32_t right = static_cast<uint32_t>(bounds_.size());
+  while (left < right) {
+    const uint32_t mid = (left + right) / 2;
+    bool before;
+    if (use_prefixes_ && bound_prefix_[mid] != prefix) {
+      before = (bound_prefix_[mid] < prefix);
+    } else {
+      before = ucmp->Compare(Key(bounds_[mid]), user_key) < 0;
+    }
+    if (before) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  uint32_t region = 2 * right;
+  if (right < bounds_.size() &&
+      ucmp->Compare(Key(bounds_[right]), user_key) == 0) {
+    region++;
+  }
+  *n = region_start_[region + 1] - region_start_[region];
+  *files = (*n > 0) ? &region_files_[region_start_[region]] : NULL;
+}
+
+uint64_t FileIndex::Prefix(const Slice& user_key) {
+  const unsigned char* p =
+      reinterpret_cast<const unsigned char*>(user_key.data());
+  const size_t n = (user_key.size() < 8) ? user_key.size() : 8;
+  uint64_t result = 0;
+  for (size_t i = 0; i < 8; i++) {
+    result = (result << 8) | (i < n ? p[i] : 0);
+  }
+  return result;
+}
+
+uint32_t FileIndex::FindFile(const Slice& key) const {
+  assert(disjoint_);
+  const uint64_t prefix = use_prefixes_ ? Prefix(ExtractUserKey(key)) : 0;
+  uint32_t left = 0;
+  uint32_t right = size();
+  while (left < right) {
+    const uint32_t mid = (left + right) / 2;
+    bool before;  // Is the largest key of "mid" before "key"?
+    if (use_prefixes_ && largest_prefix_[mid] != prefix) {
+      before = (largest_prefix_[mid] < prefix);
+    } else {
+      before = icmp_->InternalKeyComparator::Compare(Key(largest_[mid]),
+                                                     key) < 0;
+    }
+    if (before) {
+      // All files at or before "mid" are uninteresting
+      left = mid + 1;
+    } else {
+      // All files after "mid" are uninteresting
+      right = mid;
+    }
+  }
+  return right;
+}
+
+uint32_t FileIndex::FindFirstUserKeyAtOrAfter(const Slice& user_key) const {
+  if (files_.empty()) {
+    return 0;
+  }
+  const Comparator* ucmp = icmp_->user_comparator();
+  const uint64_t prefix = use_prefixes_ ? Prefix(user_key) : 0;
+  uint32_t left = 0;
+  uint32_t right = size();
+  while (left < right) {
+    const uint32_t mid = (left + right) / 2;
+    bool before;
+    if (use_prefixes_ && largest_prefix_[mid] != prefix) {
+      before = (largest_prefix_[mid] < prefix);
+    } else {
+      before = ucmp->Compare(LargestUserKey(mid), user_key) < 0;
+    }
+    if (before) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  return right;
+}
+
+bool FileIndex::SomeFileOverlapsRange(const Slice& smallest_user_key,
+                                      const Slice& largest_user_key) const {
+  if (files_.empty()) {
+    return false;
+  }
+  const Comparator* ucmp = icmp_->user_comparator();
+  if (!disjoint_) {
+    // Need to check against all files
+    for (uint32_t i = 0; i < size(); i++) {
+      if (ucmp->Compare(smallest_user_key, LargestUserKey(i)) <= 0 &&
+          ucmp->Compare(largest_user_key, SmallestUserKey(i)) >= 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const uint32_t index = FindFirstUserKeyAtOrAfter(smallest_user_key);
+  return (index < size() &&
+          ucmp->Compare(largest_user_key, SmallestUserKey(index)) >= 0);
+}
+
+void FileIndex::GetOverlappingFiles(const Slice& user_begin,
+                                    const Slice& user_end,
+                                    std::vector<FileMetaData*>* inputs) const {
+  inputs->clear();
+  if (files_.empty()) {
+    return;
+  }
+  const Comparator* ucmp = icmp_->user_comparator();
+  if (!disjoint_) {
+    for (uint32_t i = 0; i < size(); i++) {
+      if (ucmp->Compare(LargestUserKey(i), user_begin) < 0 ||
+          ucmp->Compare(SmallestUserKey(i), user_end) > 0) {
+        // Either completely before or after range; skip it
+      } else {
+        inputs->push_back(files_[i]);
+      }
+    }
+    return;
+  }
+
+  for (uint32_t i = FindFirstUserKeyAtOrAfter(user_begin);
+       i < size() && ucmp->Compare(SmallestUserKey(i), user_end) <= 0;
+       i++) {
+    inputs->push_back(files_[i]);
+  }
+}
+
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A FileIndex is an immutable search structure over the files of one
+// level of a Version.  The boundary keys of all the files are copied
+// into a single buffer, and an array of fixed-width key prefixes sits
+// next to it, so that a binary search usually compares integers held
+// in a few cache lines instead of following a pointer to a
+// FileMetaData and on to the heap-allocated key for every probe.  Full
+// keys are compared only when the prefixes are equal.
+//
+// Prefixes are only used with the bytewise comparator; for other
+// comparators every probe compares full keys, which still saves the
+// pointer chasing.
+//
+// For files that may overlap each other (level-0) the index also keeps
+// an interval structure: the distinct boundary user keys cut the key
+// space into points and open ranges, and for each of those the index
+// lists the files that cover it, in the order in which the files were
+// given.  A point lookup is then a binary search over the boundaries.
+// The lists can take space quadratic in the number of files, so past
+// kMaxIntervalFiles files no interval structure is built and lookups
+// check every file instead.
+
+#ifndef STORAGE_LEVELDB_DB_FILE_INDEX_H_
+#define STORAGE_LEVELDB_DB_FILE_INDEX_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "db/dbformat.h"
+
+namespace leveldb {
+
+struct FileMetaData;
+
+class FileIndex {
+ public:
+  FileIndex();
+
+  // Index "files", which must stay alive for as long as the index is
+  // used.  If "disjoint" is true, the files must be sorted and must not
+  // overlap each other.
+  void Build(const InternalKeyComparator* icmp,
+             const std::vector<FileMetaData*>& files,
+             bool disjoint);
+
+  uint32_t size() const { return static_cast<uint32_t>(files_.size()); }
+  FileMetaData* file(uint32_t i) const { return files_[i]; }
+  Slice SmallestUserKey(uint32_t i) const {
+    return ExtractUserKey(Key(smallest_[i]));
+  }
+  Slice LargestUserKey(uint32_t i) const {
+    return ExtractUserKey(Key(largest_[i]));
+  }
+
+  // Internal keys bounding file(i), stored in the index
+  Slice SmallestKey(uint32_t i) const { return Key(smallest_[i]); }
+  Slice LargestKey(uint32_t i) const { return Key(largest_[i]); }
+
+  // Set *files to the first of *n files whose key range includes
+  // "user_key", in the order in which they were passed to Build().  The
+  // array belongs to the index or, when the index has too many files
+  // for an interval structure, to *scratch, which the files are then
+  // collected in.  REQUIRES: the files are not disjoint.
+  void FilesContaining(const Slice& user_key,
+                       std::vector<FileMetaData*>* scratch,
+                       FileMetaData* const** files,
+                       uint32_t* n) const;
+
+  // Return the smallest index i such that file(i)->largest >= key,
+  // where "key" is an internal key.  Return size() if there is no such
+  // file.  REQUIRES: the files are disjoint.
+  uint32_t FindFile(const Slice& key) const;
+
+  // Returns true iff some file overlaps the user key range
+  // [smallest_user_key,largest_user_key].
+  bool SomeFileOverlapsRange(const Slice& smallest_user_key,
+                             const Slice& largest_user_key) const;
+
+  // Store in "*inputs" all files that overlap the user key range
+  // [user_begin,user_end].
+  void GetOverlappingFiles(const Slice& user_begin,
+                           const Slice& user_end,
+                           std::vector<FileMetaData*>* inputs) const;
+
+ private:
+  struct KeyRef {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  Slice Key(const KeyRef& ref) const {
+    return Slice(keys_.data() + ref.offset, ref.size);
+  }
+
+  // Big-endian value of the first eight bytes of "user_key", padded with
+  // zeroes, so that prefixes compare like the keys they were taken from
+  // unless they are equal.
+  static uint64_t Prefix(const Slice& user_key);
+
+  // Returns the first file whose largest user key is >= "user_key".
+  uint32_t FindFirstUserKeyAtOrAfter(const Slice& user_key) const;
+
+  void BuildIntervals();
+
+  // Largest number of overlapping files given an interval structure
+  enum { kMaxIntervalFiles = 64 };
+
+  const InternalKeyComparator* icmp_;
+  bool disjoint_;
+  bool use_prefixes_;
+  std::vector<FileMetaData*> files_;
+  std::vector<uint64_t> largest_prefix_;   // Prefix of largest user key
+  std::vector<KeyRef> smallest_;           // Internal keys in keys_
+  std::vector<KeyRef> largest_;
+  std::string keys_;
+
+  // Interval structure for overlapping files.  With m distinct boundary
+  // user keys b[0..m-1], region 2j+1 is the point b[j] and region 2j
+  // the keys strictly between b[j-1] and b[j]; region 2m lies past
+  // b[m-1].  The files covering region r are
+  // region_files_[region_start_[r] .. region_start_[r+1]-1].  All of
+  // them are empty past kMaxIntervalFiles files.
+  std::vector<KeyRef> bounds_;              // User keys in keys_
+  std::vector<uint64_t> bound_prefix_;
+  std::vector<uint32_t> region_start_;
+  std::vector<FileMetaData*> region_files_;
+};
+
+}
+
+#endif  // STORAGE_LEVELDB_DB_FILE_INDEX_H_
@@ -65,6 +65,8 @@ class MemTableIterator: public Iterator {
   }
 
   virtual Status status() const { return Status::OK(); }
+  // Keys live in the memtable's arena, which outlives this iterator
+  virtual bool IsKeyPinned() const { return true; }
 
  private:
   MemTable::Table::Iterator iter_;
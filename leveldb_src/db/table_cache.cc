@@ -4,23 +4,34 @@
 
 #include "db/table_cache.h"
 
+#include <string.h>
 #include "db/filename.h"
 #include "leveldb/env.h"
+#include "leveldb/rate_limiter.h"
+#include "leveldb/persistent_cache.h"
 #include "leveldb/table.h"
+#include "table/persist_target.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
 struct TableAndFile {
   RandomAccessFile* file;
   Table* table;
+  volatile int refs;    // Held by the cache entry and by a pin
 };
 
+static void UnrefTableAndFile(TableAndFile* tf) {
+  if (port::AtomicAdd(&tf->refs, -1) == 0) {
+    delete tf->table;
+    delete tf->file;
+    delete tf;
+  }
+}
+
 static void DeleteEntry(const Slice& key, void* value) {
-  TableAndFile* tf = reinterpret_cast<TableAndFile*>(value);
-  delete tf->table;
-  delete tf->file;
-  delete tf;
+  UnrefTableAndFile(reinterpret_cast<TableAndFile*>(value));
 }
 
 static void UnrefEntry(void* arg1, void* arg2) {
@@ -29,38 +40,133 @@ static void UnrefEntry(void* arg1, void* arg2) {
   cache->Release(h);
 }
 
+namespace {
+// Serves the reads of a single pass over a table file from a buffer
+// that is refilled with one large read at a time, so that a compaction
+// issues a few big sequential reads instead of one small read per
+// block.
+class ReadaheadFile : public RandomAccessFile {
+ public:
+  ReadaheadFile(RandomAccessFile* file, size_t readahead,
+                RateLimiter* limiter)
+      : file_(file),
+        readahead_(readahead),
+        limiter_(limiter),
+        buffer_(new char[readahead]),
+        buffer_offset_(0),
+        buffer_size_(0),
+        direct_(false) {
+    file_->Hint(kSequential);
+  }
+
+  virtual ~ReadaheadFile() {
+    // The pages read by this pass are not needed by anybody else
+    file_->Hint(kDontNeed);
+    delete[] buffer_;
+    delete file_;
+  }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    MutexLock l(&mutex_);
+    if (direct_ || n >= readahead_) {
+      Charge(n);
+      return file_->Read(offset, n, result, scratch);
+    }
+    if (offset < buffer_offset_ || offset + n > buffer_offset_ + buffer_size_) {
+      Slice data;
+      Charge(readahead_);
+      Status s = file_->Read(offset, readahead_, &data, buffer_);
+      if (!s.ok()) {
+        buffer_size_ = 0;
+        return s;
+      }
+      if (data.data() != buffer_) {
+        // The file hands out memory of its own (e.g. it is mmapped), so
+        // there is nothing to gain from copying it through the buffer
+        direct_ = true;
+        buffer_size_ = 0;
+        return file_->Read(offset, n, result, scratch);
+      }
+      buffer_offset_ = offset;
+      buffer_size_ = data.size();
+    }
+    const size_t skip = static_cast<size_t>(offset - buffer_offset_);
+    const size_t avail = (buffer_size_ > skip) ? buffer_size_ - skip : 0;
+    const size_t len = (n < avail) ? n : avail;
+    memcpy(scratch, buffer_ + skip, len);
+    *result = Slice(scratch, len);
+    return Status::OK();
+  }
+
+ private:
+  void Charge(size_t bytes) const {
+    if (limiter_ != NULL) {
+      limiter_->Request(bytes, RateLimiter::kLow);
+    }
+  }
+
+  RandomAccessFile* const file_;
+  const size_t readahead_;
+  RateLimiter* const limiter_;
+
+  mutable port::Mutex mutex_;
+  char* const buffer_;
+  mutable uint64_t buffer_offset_;      // File offset of buffer_[0]
+  mutable size_t buffer_size_;
+  mutable bool direct_;                 // Bypass the buffer
+
+  // No copying allowed
+  ReadaheadFile(const ReadaheadFile&);
+  void operator=(const ReadaheadFile&);
+};
+}
+
+static void DeleteTableAndFile(void* arg1, void* arg2) {
+  delete reinterpret_cast<Table*>(arg1);
+  delete reinterpret_cast<RandomAccessFile*>(arg2);
+}
+
 TableCache::TableCache(const std::string& dbname,
                        const Options* options,
                        int entries)
     : env_(options->env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      cache_(NewLRUCache(entries)),
+      persistent_cache_id_(0),
+      persist_target_(NULL),
+      entries_(entries),
+      pinned_(0) {
+  if (options_->persistent_cache != NULL) {
+    persistent_cache_id_ = options_->persistent_cache->NewId();
+    persist_target_ = new PersistTarget(options_->persistent_cache);
+  }
 }
 
 TableCache::~TableCache() {
   delete cache_;
-}
-
-Iterator* TableCache::NewIterator(const ReadOptions& options,
-                                  uint64_t file_number,
-                                  uint64_t file_size,
-                                  Table** tableptr) {
-  if (tableptr != NULL) {
-    *tableptr = NULL;
+  if (persist_target_ != NULL) {
+    persist_target_->Close();
+    persist_target_->Unref();
   }
+}
 
+Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
+                             Cache::Handle** handle) {
+  Status s;
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
   Slice key(buf, sizeof(buf));
-  Cache::Handle* handle = cache_->Lookup(key);
-  if (handle == NULL) {
+  *handle = cache_->Lookup(key);
+  if (*handle == NULL) {
     std::string fname = TableFileName(dbname_, file_number);
     RandomAccessFile* file = NULL;
     Table* table = NULL;
-    Status s = env_->NewRandomAccessFile(fname, &file);
+    s = env_->NewRandomAccessFile(fname, &file);
     if (s.ok()) {
-      s = Table::Open(*options_, file, file_size, &table);
+      s = Table::Open(*options_, file, file_size, persistent_cache_id_,
+                      file_number, persist_target_, &table);
     }
 
     if (!s.ok()) {
@@ -68,13 +174,29 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
       delete file;
       // We do not cache error results so that if the error is transient,
       // or somebody repairs the file, we recover automatically.
-      return NewErrorIterator(s);
+    } else {
+      TableAndFile* tf = new TableAndFile;
+      tf->file = file;
+      tf->table = table;
+      tf->refs = 1;
+      *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
+  }
+  return s;
+}
 
-    TableAndFile* tf = new TableAndFile;
-    tf->file = file;
-    tf->table = table;
-    handle = cache_->Insert(key, tf, 1, &DeleteEntry);
+Iterator* TableCache::NewIterator(const ReadOptions& options,
+                                  uint64_t file_number,
+                                  uint64_t file_size,
+                                  Table** tableptr) {
+  if (tableptr != NULL) {
+    *tableptr = NULL;
+  }
+
+  Cache::Handle* handle = NULL;
+  Status s = FindTable(file_number, file_size, &handle);
+  if (!s.ok()) {
+    return NewErrorIterator(s);
   }
 
   Table* table = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
@@ -86,6 +208,146 @@ Iterator* TableCache::NewIterator(const ReadOptions& options,
   return result;
 }
 
+// Take one of the "entries" slots for a pinned table away from the
+// cache, if any is left.
+bool TableCache::ReservePin() {
+  MutexLock l(&pin_mutex_);
+  if (pinned_ >= entries_) {
+    return false;
+  }
+  pinned_++;
+  cache_->SetCapacity(entries_ - pinned_);
+  return true;
+}
+
+void TableCache::ReleasePin() {
+  MutexLock l(&pin_mutex_);
+  pinned_--;
+  cache_->SetCapacity(entries_ - pinned_);
+}
+
+// Store the table of "f" in *table.  If it is not pinned in
+// f->table_handle, *handle is set to the cache handle holding it, which
+// the caller must release; otherwise *handle is set to NULL.  A table
+// is pinned by taking it over from the cache, so one that the cache
+// has open already is not opened again.
+Status TableCache::FindPinnedTable(const FileMetaData* f,
+                                   Cache::Handle** handle,
+                                   Table** table) {
+  TableAndFile* tf =
+      reinterpret_cast<TableAndFile*>(f->table_handle.Acquire_Load());
+  if (tf != NULL) {
+    *handle = NULL;
+    *table = tf->table;
+    return Status::OK();
+  }
+
+  const bool reserved = ReservePin();
+  Status s = FindTable(f->number, f->file_size, handle);
+  if (!s.ok()) {
+    if (reserved) {
+      ReleasePin();
+    }
+    return s;
+  }
+  tf = reinterpret_cast<TableAndFile*>(cache_->Value(*handle));
+  *table = tf->table;
+  if (!reserved) {
+    return s;
+  }
+
+  bool raced = false;
+  {
+    MutexLock l(&pin_mutex_);
+    TableAndFile* current =
+        reinterpret_cast<TableAndFile*>(f->table_handle.NoBarrier_Load());
+    if (current == NULL) {
+      port::AtomicAdd(&tf->refs, 1);
+      f->table_handle.Release_Store(tf);
+    } else {
+      // Pinned by another thread in the meantime
+      *table = current->table;
+      raced = true;
+    }
+  }
+  cache_->Release(*handle);
+  *handle = NULL;
+  if (raced) {
+    ReleasePin();
+  } else {
+    // The slot the table took up in the cache went to the pin
+    Evict(f->number);
+  }
+  return s;
+}
+
+Iterator* TableCache::NewIterator(const ReadOptions& options,
+                                  const FileMetaData* f,
+                                  Table** tableptr) {
+  if (tableptr != NULL) {
+    *tableptr = NULL;
+  }
+
+  Cache::Handle* handle = NULL;
+  Table* table = NULL;
+  Status s = FindPinnedTable(f, &handle, &table);
+  if (!s.ok()) {
+    return NewErrorIterator(s);
+  }
+
+  Iterator* result = table->NewIterator(options);
+  if (handle != NULL) {
+    result->RegisterCleanup(&UnrefEntry, cache_, handle);
+  }
+  if (tableptr != NULL) {
+    *tableptr = table;
+  }
+  return result;
+}
+
+Iterator* TableCache::NewReadaheadIterator(const ReadOptions& options,
+                                           const FileMetaData* f) {
+  std::string fname = TableFileName(dbname_, f->number);
+  RandomAccessFile* base = NULL;
+  Status s = env_->NewRandomAccessFile(fname, &base);
+  if (!s.ok()) {
+    return NewErrorIterator(s);
+  }
+  RandomAccessFile* file = new ReadaheadFile(
+      base, options_->compaction_readahead_size, options_->rate_limiter);
+  Table* table = NULL;
+  s = Table::Open(*options_, file, f->file_size, persistent_cache_id_,
+                  f->number, persist_target_, &table);
+  if (!s.ok()) {
+    assert(table == NULL);
+    delete file;
+    return NewErrorIterator(s);
+  }
+  Iterator* result = table->NewIterator(options);
+  result->RegisterCleanup(&DeleteTableAndFile, table, file);
+  return result;
+}
+
+Status TableCache::Preload(const FileMetaData* f) {
+  Cache::Handle* handle = NULL;
+  Table* table = NULL;
+  Status s = FindPinnedTable(f, &handle, &table);
+  if (handle != NULL) {
+    cache_->Release(handle);
+  }
+  return s;
+}
+
+void TableCache::Unpin(const FileMetaData* f) {
+  TableAndFile* tf =
+      reinterpret_cast<TableAndFile*>(f->table_handle.NoBarrier_Load());
+  if (tf != NULL) {
+    f->table_handle.NoBarrier_Store(NULL);
+    UnrefTableAndFile(tf);
+    ReleasePin();
+  }
+}
+
 void TableCache::Evict(uint64_t file_number) {
   char buf[sizeof(file_number)];
   EncodeFixed64(buf, file_number);
@@ -10,6 +10,7 @@
 #include <string>
 #include <stdint.h>
 #include "db/dbformat.h"
+#include "db/version_edit.h"
 #include "leveldb/cache.h"
 #include "leveldb/table.h"
 #include "port/port.h"
@@ -17,6 +18,8 @@
 namespace leveldb {
 
 class Env;
+class PersistTarget;
+struct TableAndFile;
 
 class TableCache {
  public:
@@ -35,6 +38,31 @@ class TableCache {
                         uint64_t file_size,
                         Table** tableptr = NULL);
 
+  // Like the above, but for the file described by "f".  The table is
+  // pinned in f->table_handle on first use, after which it is reached
+  // without a cache lookup.  Pinned tables are held apart from the
+  // cache, whose capacity drops by one for every pin, so that up to
+  // "entries" tables can be pinned while no more than "entries" tables
+  // are open; once that many are pinned, calls behave like the above.
+  Iterator* NewIterator(const ReadOptions& options,
+                        const FileMetaData* f,
+                        Table** tableptr = NULL);
+
+  // Return an iterator over the file described by "f" for a single pass
+  // from start to end, as done by compactions.  The file is opened
+  // apart from the cache and read in chunks of
+  // options->compaction_readahead_size bytes (see Options).
+  Iterator* NewReadaheadIterator(const ReadOptions& options,
+                                 const FileMetaData* f);
+
+  // Open the file described by "f" and pin its table, so that later
+  // accesses to it need not open it.
+  Status Preload(const FileMetaData* f);
+
+  // Close the table pinned in "f", if any.
+  // REQUIRES: no other thread is using "f".
+  void Unpin(const FileMetaData* f);
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
@@ -43,6 +71,24 @@ class TableCache {
   const std::string dbname_;
   const Options* options_;
   Cache* cache_;
+
+  // Blocks of this DB's tables are kept in options_->persistent_cache
+  // under persistent_cache_id_ and their file numbers, so that they
+  // outlive the Table objects; persist_target_ is closed along with the
+  // cache.  NULL without a persistent cache.
+  uint64_t persistent_cache_id_;
+  PersistTarget* persist_target_;
+
+  port::Mutex pin_mutex_;
+  const int entries_;
+  int pinned_;                  // Protected by pin_mutex_
+
+  Status FindTable(uint64_t file_number, uint64_t file_size,
+                   Cache::Handle** handle);
+  Status FindPinnedTable(const FileMetaData* f, Cache::Handle** handle,
+                         Table** table);
+  bool ReservePin();
+  void ReleasePin();
 };
 
 }
@@ -20,7 +20,8 @@ enum Tag {
   kDeletedFile          = 6,
   kNewFile              = 7,
   // 8 was used for large value refs
-  kPrevLogNumber        = 9
+  kPrevLogNumber        = 9,
+  kFileCreationTime     = 10    // Of a file added earlier in the same edit
 };
 
 void VersionEdit::Clear() {
@@ -82,6 +83,11 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutVarint64(dst, f.file_size);
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
+    if (f.creation_time != 0) {
+      PutVarint32(dst, kFileCreationTime);
+      PutVarint64(dst, f.number);
+      PutVarint64(dst, f.creation_time);
+    }
   }
 }
 
@@ -115,6 +121,7 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   // Temporary storage for parsing
   int level;
   uint64_t number;
+  uint64_t creation_time;
   FileMetaData f;
   Slice str;
   InternalKey key;
@@ -192,6 +199,17 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kFileCreationTime:
+        if (GetVarint64(&input, &number) &&
+            GetVarint64(&input, &creation_time) &&
+            !new_files_.empty() &&
+            new_files_.back().second.number == number) {
+          new_files_.back().second.creation_time = creation_time;
+        } else {
+          msg = "file creation time";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -260,6 +278,10 @@ std::string VersionEdit::DebugString() const {
     r.append("' .. '");
     AppendEscapedStringTo(&r, f.largest.Encode());
     r.append("'");
+    if (f.creation_time != 0) {
+      r.append(" @");
+      AppendNumberTo(&r, f.creation_time);
+    }
   }
   r.append("\n}\n");
   return r;
@@ -9,6 +9,7 @@
 #include <utility>
 #include <vector>
 #include "db/dbformat.h"
+#include "port/port.h"
 
 namespace leveldb {
 
@@ -21,8 +22,39 @@ struct FileMetaData {
   uint64_t file_size;         // File size in bytes
   InternalKey smallest;       // Smallest internal key served by table
   InternalKey largest;        // Largest internal key served by table
-
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) { }
+  uint64_t creation_time;     // Seconds since the epoch; 0 if unknown
+
+  // Table opened and pinned by TableCache for the lifetime of this
+  // metadata, so that reads get at it without a cache lookup.
+  // NULL until the table is first used.  Copies start out unpinned.
+  mutable port::AtomicPointer table_handle;
+
+  // True while the file is an input of a compaction in progress.
+  // Protected by the DB mutex.  Copies start out false.
+  bool being_compacted;
+
+  FileMetaData()
+      : refs(0), allowed_seeks(1 << 30), file_size(0), creation_time(0),
+        table_handle(NULL), being_compacted(false) { }
+
+  FileMetaData(const FileMetaData& f)
+      : refs(f.refs), allowed_seeks(f.allowed_seeks), number(f.number),
+        file_size(f.file_size), smallest(f.smallest), largest(f.largest),
+        creation_time(f.creation_time), table_handle(NULL),
+        being_compacted(false) { }
+
+  FileMetaData& operator=(const FileMetaData& f) {
+    refs = f.refs;
+    allowed_seeks = f.allowed_seeks;
+    number = f.number;
+    file_size = f.file_size;
+    smallest = f.smallest;
+    largest = f.largest;
+    creation_time = f.creation_time;
+    table_handle.NoBarrier_Store(NULL);
+    being_compacted = false;
+    return *this;
+  }
 };
 
 class VersionEdit {
@@ -59,15 +91,18 @@ class VersionEdit {
   // Add the specified file at the specified number.
   // REQUIRES: This version has not been saved (see VersionSet::SaveTo)
   // REQUIRES: "smallest" and "largest" are smallest and largest keys in file
+  // "creation_time" is only recorded if non-zero.
   void AddFile(int level, uint64_t file,
                uint64_t file_size,
                const InternalKey& smallest,
-               const InternalKey& largest) {
+               const InternalKey& largest,
+               uint64_t creation_time = 0) {
     FileMetaData f;
     f.number = file;
     f.file_size = file_size;
     f.smallest = smallest;
     f.largest = largest;
+    f.creation_time = creation_time;
     new_files_.push_back(std::make_pair(level, f));
   }
 
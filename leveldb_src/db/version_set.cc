@@ -6,6 +6,8 @@
 
 #include <algorithm>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include "db/filename.h"
 #include "db/log_reader.h"
 #include "db/log_writer.h"
@@ -20,25 +22,35 @@
 
 namespace leveldb {
 
-static const int kTargetFileSize = 2 * 1048576;
-
-// Maximum bytes of overlaps in grandparent (i.e., level+2) before we
-// stop building a single file in a level->level+1 compaction.
-static const int64_t kMaxGrandParentOverlapBytes = 10 * kTargetFileSize;
-
-static double MaxBytesForLevel(int level) {
+static double MaxBytesForLevel(const Options* options, int level) {
   // Note: the result for level zero is not really used since we set
   // the level-0 compaction threshold based on number of files.
-  double result = 10 * 1048576.0;  // Result for both level-0 and level-1
+  double result = static_cast<double>(options->max_bytes_for_level_base);
   while (level > 1) {
-    result *= 10;
+    result *= options->max_bytes_for_level_multiplier;
     level--;
   }
   return result;
 }
 
-static uint64_t MaxFileSizeForLevel(int level) {
-  return kTargetFileSize;  // We could vary per level to reduce number of files?
+// Upper bound on the target file size of any level, however often
+// target_file_size_multiplier is applied.  Ten times as much (see
+// MaxGrandParentOverlapBytes) still fits easily in an int64_t.
+static const uint64_t kMaxTargetFileSize = 1ULL << 40;
+
+static uint64_t MaxFileSizeForLevel(const Options* options, int level) {
+  uint64_t result = options->target_file_size_base;
+  while (level > 1 && result < kMaxTargetFileSize) {
+    result *= options->target_file_size_multiplier;
+    level--;
+  }
+  return std::min(result, kMaxTargetFileSize);
+}
+
+// Maximum bytes of overlaps in grandparent (i.e., output level+1)
+// before we stop building a single file in a compaction into "level".
+static int64_t MaxGrandParentOverlapBytes(const Options* options, int level) {
+  return 10 * MaxFileSizeForLevel(options, level);
 }
 
 namespace {
@@ -69,6 +81,7 @@ Version::~Version() {
       assert(f->refs > 0);
       f->refs--;
       if (f->refs <= 0) {
+        vset_->table_cache_->Unpin(f);
         delete f;
       }
     }
@@ -111,22 +124,26 @@ bool SomeFileOverlapsRange(
 
 // An internal iterator.  For a given version/level pair, yields
 // information about the files in the level.  For a given entry, key()
-// is the largest key that occurs in the file, and value() is an
-// 16-byte value containing the file number and file size, both
-// encoded using EncodeFixed64.
+// is the largest key that occurs in the file, and value() holds the
+// address of the file's FileMetaData (see DecodeFileValue).  The
+// metadata stays alive for as long as the list of files does.
 class Version::LevelFileNumIterator : public Iterator {
  public:
+  // "file_index", if non-NULL, indexes *flist and is used for seeks
   LevelFileNumIterator(const InternalKeyComparator& icmp,
-                       const std::vector<FileMetaData*>* flist)
+                       const std::vector<FileMetaData*>* flist,
+                       const FileIndex* file_index = NULL)
       : icmp_(icmp),
         flist_(flist),
+        file_index_(file_index),
         index_(flist->size()) {        // Marks as invalid
   }
   virtual bool Valid() const {
     return index_ < flist_->size();
   }
   virtual void Seek(const Slice& target) {
-    index_ = FindFile(icmp_, *flist_, target);
+    index_ = (file_index_ != NULL) ? file_index_->FindFile(target)
+                                   : FindFile(icmp_, *flist_, target);
   }
   virtual void SeekToFirst() { index_ = 0; }
   virtual void SeekToLast() {
@@ -150,48 +167,255 @@ class Version::LevelFileNumIterator : public Iterator {
   }
   Slice value() const {
     assert(Valid());
-    EncodeFixed64(value_buf_, (*flist_)[index_]->number);
-    EncodeFixed64(value_buf_+8, (*flist_)[index_]->file_size);
+    const FileMetaData* f = (*flist_)[index_];
+    memcpy(value_buf_, &f, sizeof(f));
     return Slice(value_buf_, sizeof(value_buf_));
   }
   virtual Status status() const { return Status::OK(); }
  private:
   const InternalKeyComparator icmp_;
   const std::vector<FileMetaData*>* const flist_;
+  const FileIndex* const file_index_;
   uint32_t index_;
 
-  // Backing store for value().  Holds the file number and size.
-  mutable char value_buf_[16];
+  // Backing store for value().  Holds a FileMetaData pointer.
+  mutable char value_buf_[sizeof(FileMetaData*)];
 };
 
+// Returns the file referred to by a LevelFileNumIterator value, or NULL
+// if "file_value" is malformed.
+static const FileMetaData* DecodeFileValue(const Slice& file_value) {
+  if (file_value.size() != sizeof(FileMetaData*)) {
+    return NULL;
+  }
+  const FileMetaData* f;
+  memcpy(&f, file_value.data(), sizeof(f));
+  return f;
+}
+
 static Iterator* GetFileIterator(void* arg,
                                  const ReadOptions& options,
                                  const Slice& file_value) {
   TableCache* cache = reinterpret_cast<TableCache*>(arg);
-  if (file_value.size() != 16) {
+  const FileMetaData* f = DecodeFileValue(file_value);
+  if (f == NULL) {
     return NewErrorIterator(
         Status::Corruption("FileReader invoked with unexpected value"));
   } else {
-    return cache->NewIterator(options,
-                              DecodeFixed64(file_value.data()),
-                              DecodeFixed64(file_value.data() + 8));
+    return cache->NewIterator(options, f);
+  }
+}
+
+// Like GetFileIterator, but for a single pass over the file by a
+// compaction (see TableCache::NewReadaheadIterator).
+static Iterator* GetReadaheadFileIterator(void* arg,
+                                          const ReadOptions& options,
+                                          const Slice& file_value) {
+  TableCache* cache = reinterpret_cast<TableCache*>(arg);
+  const FileMetaData* f = DecodeFileValue(file_value);
+  if (f == NULL) {
+    return NewErrorIterator(
+        Status::Corruption("FileReader invoked with unexpected value"));
+  } else {
+    return cache->NewReadaheadIterator(options, f);
+  }
+}
+
+namespace {
+// An iterator over a single table file that does not open the table
+// until it has to.  Positioning at the first or last entry of the file,
+// or at a target outside of the file's key range, is answered from the
+// smallest and largest keys recorded in the file's metadata, so a
+// merging iterator can order this child against its siblings without
+// touching the file.  The table is opened once the entry's value is
+// needed or the iterator has to step from one entry to the next.
+class LazyFileIterator : public Iterator {
+ public:
+  // "smallest" and "largest" are the file's boundary keys, which must
+  // stay alive as long as the iterator
+  LazyFileIterator(TableCache* cache,
+                   const InternalKeyComparator* icmp,
+                   const ReadOptions& options,
+                   const FileMetaData* f,
+                   const Slice& smallest,
+                   const Slice& largest)
+      : cache_(cache),
+        icmp_(icmp),
+        options_(options),
+        file_(f),
+        smallest_(smallest),
+        largest_(largest),
+        iter_(NULL),
+        state_(kInvalid),
+        missing_(false) {
+  }
+  virtual ~LazyFileIterator() {
+    delete iter_;
+  }
+
+  virtual bool Valid() const {
+    return (state_ == kOpen) ? iter_->Valid() : (state_ != kInvalid);
+  }
+  // Once the table is open, positioning goes through it: the boundary
+  // keys no longer save anything, and they would hide that the table
+  // turned out to be unreadable.
+  virtual void Seek(const Slice& target) {
+    missing_ = false;
+    if (iter_ == NULL && icmp_->Compare(target, largest_) > 0) {
+      state_ = kInvalid;
+    } else if (iter_ == NULL && icmp_->Compare(target, smallest_) <= 0) {
+      state_ = kAtSmallest;
+    } else {
+      Open();
+      iter_->Seek(target);
+      state_ = kOpen;
+    }
+  }
+  virtual void SeekToFirst() {
+    missing_ = false;
+    if (iter_ == NULL) {
+      state_ = kAtSmallest;
+    } else {
+      iter_->SeekToFirst();
+      state_ = kOpen;
+    }
+  }
+  virtual void SeekToLast() {
+    missing_ = false;
+    if (iter_ == NULL) {
+      state_ = kAtLargest;
+    } else {
+      iter_->SeekToLast();
+      state_ = kOpen;
+    }
+  }
+  // Note that value() may have found the table unreadable, in which case
+  // iter_ is no longer valid and stepping just leaves it that way.
+  virtual void Next() {
+    assert(state_ != kInvalid);
+    missing_ = false;
+    Materialize();
+    if (iter_->Valid()) iter_->Next();
+  }
+  virtual void Prev() {
+    assert(state_ != kInvalid);
+    missing_ = false;
+    Materialize();
+    if (iter_->Valid()) iter_->Prev();
+  }
+  virtual Slice key() const {
+    assert(Valid());
+    switch (state_) {
+      case kAtSmallest:
+        return smallest_;
+      case kAtLargest:
+        return largest_;
+      default:
+        return iter_->key();
+    }
+  }
+  // If the table turns out to be unreadable, the boundary entry that
+  // key() reported is not really there: the value is empty and status()
+  // reports why.  DBIter checks for this (see DBIter::EntryMissing).
+  // Callers that cache Valid() may still call this after the table
+  // failed to open, so only the state is asserted.
+  virtual Slice value() const {
+    assert(state_ != kInvalid);
+    if (state_ != kOpen) {
+      const Slice boundary = key();
+      Materialize();
+      missing_ = !iter_->Valid() ||
+                 icmp_->Compare(iter_->key(), boundary) != 0;
+      if (missing_ && iter_->status().ok()) {
+        status_ = Status::Corruption("table does not start or end at its "
+                                     "recorded boundary key");
+      }
+    }
+    return (missing_ || !iter_->Valid()) ? Slice() : iter_->value();
+  }
+  virtual Status status() const {
+    if (iter_ != NULL && !iter_->status().ok()) {
+      return iter_->status();
+    }
+    return status_;
+  }
+  virtual bool IsKeyPinned() const {
+    assert(Valid());
+    // The boundary keys outlive iterators over the version holding them
+    return (state_ == kOpen) ? iter_->IsKeyPinned() : true;
+  }
+
+ private:
+  enum State {
+    kInvalid,
+    kAtSmallest,
+    kAtLargest,
+    kOpen           // iter_ holds the position
+  };
+
+  void Open() const {
+    if (iter_ == NULL) {
+      iter_ = cache_->NewIterator(options_, file_);
+    }
+  }
+
+  // Opens the table and positions it at the entry that state_ refers to.
+  void Materialize() const {
+    if (state_ != kOpen) {
+      Open();
+      if (state_ == kAtSmallest) {
+        iter_->SeekToFirst();
+      } else {
+        iter_->SeekToLast();
+      }
+      state_ = kOpen;
+    }
+  }
+
+  TableCache* const cache_;
+  const InternalKeyComparator* const icmp_;
+  const ReadOptions options_;
+  const FileMetaData* const file_;
+  const Slice smallest_;
+  const Slice largest_;
+  mutable Iterator* iter_;      // NULL until the table is first needed
+  mutable State state_;
+  mutable bool missing_;        // value() found the entry not there
+  mutable Status status_;       // Why, if the table did not say
+};
+}  // namespace
+
+Iterator* Version::GetLazyFileIterator(void* arg,
+                                       const ReadOptions& options,
+                                       const Slice& file_value) {
+  VersionSet* vset = reinterpret_cast<VersionSet*>(arg);
+  const FileMetaData* f = DecodeFileValue(file_value);
+  if (f == NULL) {
+    return NewErrorIterator(
+        Status::Corruption("FileReader invoked with unexpected value"));
+  } else {
+    return new LazyFileIterator(vset->table_cache_, &vset->icmp_, options, f,
+                                f->smallest.Encode(), f->largest.Encode());
   }
 }
 
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
   return NewTwoLevelIterator(
-      new LevelFileNumIterator(vset_->icmp_, &files_[level]),
-      &GetFileIterator, vset_->table_cache_, options);
+      new LevelFileNumIterator(vset_->icmp_, &files_[level], &index_[level]),
+      &GetLazyFileIterator, vset_, options);
 }
 
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
-  // Merge all level zero files together since they may overlap
-  for (size_t i = 0; i < files_[0].size(); i++) {
-    iters->push_back(
-        vset_->table_cache_->NewIterator(
-            options, files_[0][i]->number, files_[0][i]->file_size));
+  // Merge all level zero files together since they may overlap.  The
+  // tables are only opened once a seek lands inside their key range,
+  // which is checked against the boundary keys held by the index.
+  const FileIndex& index = index_[0];
+  for (uint32_t i = 0; i < index.size(); i++) {
+    iters->push_back(new LazyFileIterator(
+        vset_->table_cache_, &vset_->icmp_, options, index.file(i),
+        index.SmallestKey(i), index.LargestKey(i)));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
@@ -255,39 +479,28 @@ Status Version::Get(const ReadOptions& options,
   // We can search level-by-level since entries never hop across
   // levels.  Therefore we are guaranteed that if we find data
   // in an smaller level, later levels are irrelevant.
-  std::vector<FileMetaData*> tmp;
   FileMetaData* tmp2;
+  std::vector<FileMetaData*> tmp;
   for (int level = 0; level < config::kNumLevels; level++) {
-    size_t num_files = files_[level].size();
+    uint32_t num_files = files_[level].size();
     if (num_files == 0) continue;
 
     // Get the list of files to search in this level
     FileMetaData* const* files = &files_[level][0];
     if (level == 0) {
-      // Level-0 files may overlap each other.  Find all files that
-      // overlap user_key and process them in order from newest to oldest.
-      tmp.reserve(num_files);
-      for (uint32_t i = 0; i < num_files; i++) {
-        FileMetaData* f = files[i];
-        if (ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
-            ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
-          tmp.push_back(f);
-        }
-      }
-      if (tmp.empty()) continue;
-
-      std::sort(tmp.begin(), tmp.end(), NewestFirst);
-      files = &tmp[0];
-      num_files = tmp.size();
+      // Level-0 files may overlap each other.  The index lists the files
+      // that overlap user_key in order from newest to oldest.
+      index_[0].FilesContaining(user_key, &tmp, &files, &num_files);
+      if (num_files == 0) continue;
     } else {
       // Binary search to find earliest index whose largest key >= ikey.
-      uint32_t index = FindFile(vset_->icmp_, files_[level], ikey);
+      uint32_t index = index_[level].FindFile(ikey);
       if (index >= num_files) {
         files = NULL;
         num_files = 0;
       } else {
         tmp2 = files[index];
-        if (ucmp->Compare(user_key, tmp2->smallest.user_key()) < 0) {
+        if (ucmp->Compare(user_key, index_[level].SmallestUserKey(index)) < 0) {
           // All of "tmp2" is past any data for user_key
           files = NULL;
           num_files = 0;
@@ -309,10 +522,7 @@ Status Version::Get(const ReadOptions& options,
       last_file_read = f;
       last_file_read_level = level;
 
-      Iterator* iter = vset_->table_cache_->NewIterator(
-          options,
-          f->number,
-          f->file_size);
+      Iterator* iter = vset_->table_cache_->NewIterator(options, f);
       iter->Seek(ikey);
       const bool done = GetValue(iter, user_key, value, &s);
       if (!iter->status().ok()) {
@@ -333,7 +543,8 @@ Status Version::Get(const ReadOptions& options,
 
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
-  if (f != NULL) {
+  if (f != NULL &&
+      vset_->options_->compaction_style == kCompactionStyleLevel) {
     f->allowed_seeks--;
     if (f->allowed_seeks <= 0 && file_to_compact_ == NULL) {
       file_to_compact_ = f;
@@ -360,9 +571,17 @@ void Version::Unref() {
 bool Version::OverlapInLevel(int level,
                              const Slice& smallest_user_key,
                              const Slice& largest_user_key) {
-  return SomeFileOverlapsRange(vset_->icmp_, files_[level],
-                               smallest_user_key,
-                               largest_user_key);
+  return index_[level].SomeFileOverlapsRange(smallest_user_key,
+                                             largest_user_key);
+}
+
+void Version::GetFilesInReadOrder(std::vector<FileMetaData*>* files) {
+  for (uint32_t i = 0; i < index_[0].size(); i++) {
+    files->push_back(index_[0].file(i));
+  }
+  for (int level = 1; level < config::kNumLevels; level++) {
+    files->insert(files->end(), files_[level].begin(), files_[level].end());
+  }
 }
 
 std::string Version::DebugString() const {
@@ -583,15 +802,19 @@ VersionSet::VersionSet(const std::string& dbname,
       descriptor_file_(NULL),
       descriptor_log_(NULL),
       dummy_versions_(this),
-      current_(NULL) {
+      current_(NULL),
+      manifest_writing_(false),
+      manifest_cv_(NULL) {
   AppendVersion(new Version(this));
 }
 
 VersionSet::~VersionSet() {
   current_->Unref();
   assert(dummy_versions_.next_ == &dummy_versions_);  // List must be empty
+  assert(running_compactions_.empty());
   delete descriptor_log_;
   delete descriptor_file_;
+  delete manifest_cv_;
 }
 
 void VersionSet::AppendVersion(Version* v) {
@@ -612,6 +835,18 @@ void VersionSet::AppendVersion(Version* v) {
 }
 
 Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
+  // Wait for any other call to finish, so that "edit" is applied to the
+  // version it installs.  Edits of compactions that finish out of order
+  // only delete their own inputs and add their own outputs, so they
+  // apply to whatever version is current.
+  if (manifest_cv_ == NULL) {
+    manifest_cv_ = new port::CondVar(mu);
+  }
+  while (manifest_writing_) {
+    manifest_cv_->Wait();
+  }
+  manifest_writing_ = true;
+
   if (edit->has_log_number_) {
     assert(edit->log_number_ >= log_number_);
     assert(edit->log_number_ < next_file_number_);
@@ -690,6 +925,8 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     }
   }
 
+  manifest_writing_ = false;
+  manifest_cv_->SignalAll();
   return s;
 }
 
@@ -795,6 +1032,10 @@ Status VersionSet::Recover() {
   if (s.ok()) {
     Version* v = new Version(this);
     builder.SaveTo(v);
+    if (options_->compaction_style == kCompactionStyleFIFO &&
+        options_->fifo_ttl_seconds > 0) {
+      SetMissingCreationTimes(v);
+    }
     // Install recovered version
     Finalize(v);
     AppendVersion(v);
@@ -823,13 +1064,34 @@ static int64_t TotalFileSize(const std::vector<FileMetaData*>& files) {
 }
 
 void VersionSet::Finalize(Version* v) {
+  // Level-0 files are indexed newest first, the order reads visit them
+  std::vector<FileMetaData*> level0(v->files_[0]);
+  std::sort(level0.begin(), level0.end(), NewestFirst);
+  v->index_[0].Build(&icmp_, level0, false);
+  for (int level = 1; level < config::kNumLevels; level++) {
+    v->index_[level].Build(&icmp_, v->files_[level], true);
+  }
+
+  double max_bytes[config::kNumLevels];
+  ComputeLevelLimits(v, max_bytes);
+
   // Precomputed best level for next compaction
   int best_level = -1;
   double best_score = -1;
 
   for (int level = 0; level < config::kNumLevels-1; level++) {
     double score;
-    if (level == 0) {
+    if (level == 0 && options_->compaction_style == kCompactionStyleFIFO) {
+      // Files are only ever deleted, once there are too many bytes or
+      // more than fifo_max_table_files files
+      score = static_cast<double>(TotalFileSize(v->files_[level])) /
+          static_cast<double>(options_->fifo_max_table_files_size);
+      const double files_score = v->files_[level].size() /
+          (options_->fifo_max_table_files + 1.0);
+      if (files_score > score) {
+        score = files_score;
+      }
+    } else if (level == 0) {
       // We treat level-0 specially by bounding the number of files
       // instead of number of bytes for two reasons:
       //
@@ -843,12 +1105,20 @@ void VersionSet::Finalize(Version* v) {
       // overwrites/deletions).
       score = v->files_[level].size() /
           static_cast<double>(config::kL0_CompactionTrigger);
+    } else if (options_->compaction_style != kCompactionStyleLevel) {
+      // Only level-0 is compacted; other levels keep data written under
+      // the level style until the DB is switched back
+      score = 0;
+    } else if (level < v->base_level_) {
+      // Level-0 is compacted past this level, which stays empty
+      score = 0;
     } else {
       // Compute the ratio of current size to size limit.
       const uint64_t level_bytes = TotalFileSize(v->files_[level]);
-      score = static_cast<double>(level_bytes) / MaxBytesForLevel(level);
+      score = static_cast<double>(level_bytes) / max_bytes[level];
     }
 
+    v->level_score_[level] = score;
     if (score > best_score) {
       best_level = level;
       best_score = score;
@@ -859,6 +1129,60 @@ void VersionSet::Finalize(Version* v) {
   v->compaction_score_ = best_score;
 }
 
+// With level_compaction_dynamic_level_bytes the limits are worked out
+// from the largest level, which is treated as the last one: each level
+// above it gets 1/multiplier of the limit of the level below, until a
+// limit falls to max_bytes_for_level_base.  That level is the base
+// level; the empty levels above it are skipped.
+void VersionSet::ComputeLevelLimits(Version* v, double* max_bytes) {
+  v->base_level_ = 1;
+  for (int level = 1; level < config::kNumLevels; level++) {
+    max_bytes[level] = MaxBytesForLevel(options_, level);
+  }
+  if (!options_->level_compaction_dynamic_level_bytes ||
+      options_->compaction_style != kCompactionStyleLevel) {
+    return;
+  }
+
+  int first_level_with_files = 0;
+  uint64_t max_level_bytes = 0;
+  for (int level = 1; level < config::kNumLevels; level++) {
+    const uint64_t level_bytes = TotalFileSize(v->files_[level]);
+    if (level_bytes > 0 && first_level_with_files == 0) {
+      first_level_with_files = level;
+    }
+    max_level_bytes = std::max(max_level_bytes, level_bytes);
+  }
+  if (first_level_with_files == 0) {
+    // Level-0 is compacted straight into the last level
+    v->base_level_ = config::kNumLevels - 1;
+    return;
+  }
+
+  const double multiplier = options_->max_bytes_for_level_multiplier;
+  const double base_bytes =
+      static_cast<double>(options_->max_bytes_for_level_base);
+  double limit = static_cast<double>(max_level_bytes);
+  for (int level = config::kNumLevels - 2; level >= first_level_with_files;
+       level--) {
+    limit /= multiplier;
+  }
+  int base_level = first_level_with_files;
+  while (base_level > 1 && limit > base_bytes) {
+    base_level--;
+    limit /= multiplier;
+  }
+  // The levels holding data may be too many for the amount of it, in
+  // which case the upper ones get small limits and drain downwards
+  limit = std::max(limit, base_bytes / multiplier);
+  limit = std::min(limit, base_bytes);
+  v->base_level_ = base_level;
+  for (int level = base_level; level < config::kNumLevels; level++) {
+    max_bytes[level] = limit;
+    limit *= multiplier;
+  }
+}
+
 Status VersionSet::WriteSnapshot(log::Writer* log) {
   // TODO: Break up into multiple records to reduce memory usage on recovery?
 
@@ -880,7 +1204,8 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<FileMetaData*>& files = current_->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
       const FileMetaData* f = files[i];
-      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest);
+      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest,
+                   f->creation_time);
     }
   }
 
@@ -913,35 +1238,107 @@ const char* VersionSet::LevelSummary(LevelSummaryStorage* scratch) const {
 uint64_t VersionSet::ApproximateOffsetOf(Version* v, const InternalKey& ikey) {
   uint64_t result = 0;
   for (int level = 0; level < config::kNumLevels; level++) {
-    const std::vector<FileMetaData*>& files = v->files_[level];
-    for (size_t i = 0; i < files.size(); i++) {
-      if (icmp_.Compare(files[i]->largest, ikey) <= 0) {
-        // Entire file is before "ikey", so just add the file size
-        result += files[i]->file_size;
-      } else if (icmp_.Compare(files[i]->smallest, ikey) > 0) {
-        // Entire file is after "ikey", so ignore
-        if (level > 0) {
-          // Files other than level 0 are sorted by meta->smallest, so
-          // no further files in this level will contain data for
-          // "ikey".
-          break;
-        }
-      } else {
-        // "ikey" falls in the range for this table.  Add the
-        // approximate offset of "ikey" within the table.
-        Table* tableptr;
-        Iterator* iter = table_cache_->NewIterator(
-            ReadOptions(), files[i]->number, files[i]->file_size, &tableptr);
-        if (tableptr != NULL) {
-          result += tableptr->ApproximateOffsetOf(ikey.Encode());
-        }
-        delete iter;
+    result += ApproximateOffsetOf(v->files_[level], level > 0, ikey);
+  }
+  return result;
+}
+
+uint64_t VersionSet::ApproximateOffsetOf(
+    const std::vector<FileMetaData*>& files,
+    bool sorted,
+    const InternalKey& ikey) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (icmp_.Compare(files[i]->largest, ikey) <= 0) {
+      // Entire file is before "ikey", so just add the file size
+      result += files[i]->file_size;
+    } else if (icmp_.Compare(files[i]->smallest, ikey) > 0) {
+      // Entire file is after "ikey", so ignore
+      if (sorted) {
+        // Files other than level 0 are sorted by meta->smallest, so
+        // no further files in this level will contain data for
+        // "ikey".
+        break;
+      }
+    } else {
+      // "ikey" falls in the range for this table.  Add the
+      // approximate offset of "ikey" within the table.
+      Table* tableptr;
+      Iterator* iter = table_cache_->NewIterator(
+          ReadOptions(), files[i], &tableptr);
+      if (tableptr != NULL) {
+        result += tableptr->ApproximateOffsetOf(ikey.Encode());
       }
+      delete iter;
     }
   }
   return result;
 }
 
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  bool operator()(const Slice& a, const Slice& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+}
+
+void VersionSet::GetSubcompactionBoundaries(
+    Compaction* c,
+    int max_parts,
+    std::vector<std::string>* boundaries) {
+  boundaries->clear();
+  uint64_t total = 0;
+  for (int which = 0; which < 2; which++) {
+    total += TotalFileSize(c->inputs_[which]);
+  }
+  // Each part should fill at least one output file
+  const uint64_t parts = std::min<uint64_t>(
+      max_parts, total / c->MaxOutputFileSize());
+  if (parts <= 1) {
+    return;
+  }
+
+  // Candidate boundaries are the user keys at the edges of the input
+  // files, strictly inside the key range of the compaction.
+  const Comparator* ucmp = icmp_.user_comparator();
+  const Slice smallest = c->smallest_.user_key();
+  const Slice largest = c->largest_.user_key();
+  std::vector<Slice> keys;
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      const FileMetaData* f = c->inputs_[which][i];
+      keys.push_back(f->smallest.user_key());
+      keys.push_back(f->largest.user_key());
+    }
+  }
+  UserKeyLess less;
+  less.ucmp = ucmp;
+  std::sort(keys.begin(), keys.end(), less);
+
+  // Cut at the first candidate past each multiple of total/parts bytes
+  // of input data.
+  uint64_t next_cut = total / parts;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (ucmp->Compare(keys[i], smallest) <= 0 ||
+        ucmp->Compare(keys[i], largest) >= 0 ||
+        (i > 0 && ucmp->Compare(keys[i], keys[i-1]) == 0)) {
+      continue;
+    }
+    InternalKey key(keys[i], kMaxSequenceNumber, kValueTypeForSeek);
+    uint64_t offset = ApproximateOffsetOf(c->inputs_[0], c->level() > 0, key) +
+        ApproximateOffsetOf(c->inputs_[1], true, key);
+    if (offset >= next_cut) {
+      boundaries->push_back(keys[i].ToString());
+      if (boundaries->size() + 1 == parts) {
+        break;
+      }
+      next_cut = total / parts * (boundaries->size() + 1);
+    }
+  }
+}
+
 void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
   for (Version* v = dummy_versions_.next_;
        v != &dummy_versions_;
@@ -983,19 +1380,9 @@ void VersionSet::GetOverlappingInputs(
     const InternalKey& begin,
     const InternalKey& end,
     std::vector<FileMetaData*>* inputs) {
-  inputs->clear();
-  Slice user_begin = begin.user_key();
-  Slice user_end = end.user_key();
-  const Comparator* user_cmp = icmp_.user_comparator();
-  for (size_t i = 0; i < current_->files_[level].size(); i++) {
-    FileMetaData* f = current_->files_[level][i];
-    if (user_cmp->Compare(f->largest.user_key(), user_begin) < 0 ||
-        user_cmp->Compare(f->smallest.user_key(), user_end) > 0) {
-      // Either completely before or after range; skip it
-    } else {
-      inputs->push_back(f);
-    }
-  }
+  current_->index_[level].GetOverlappingFiles(begin.user_key(),
+                                              end.user_key(),
+                                              inputs);
 }
 
 // Stores the minimal range that covers all entries in inputs in
@@ -1039,6 +1426,7 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   ReadOptions options;
   options.verify_checksums = options_->paranoid_checks;
   options.fill_cache = false;
+  const bool readahead = (options_->compaction_readahead_size > 0);
 
   // Level-0 files have to be merged together.  For other levels,
   // we will make a concatenating iterator per level.
@@ -1051,14 +1439,16 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
       if (c->level() + which == 0) {
         const std::vector<FileMetaData*>& files = c->inputs_[which];
         for (size_t i = 0; i < files.size(); i++) {
-          list[num++] = table_cache_->NewIterator(
-              options, files[i]->number, files[i]->file_size);
+          list[num++] =
+              readahead ? table_cache_->NewReadaheadIterator(options, files[i])
+                        : table_cache_->NewIterator(options, files[i]);
         }
       } else {
         // Create concatenating iterator for the files from this level
         list[num++] = NewTwoLevelIterator(
             new Version::LevelFileNumIterator(icmp_, &c->inputs_[which]),
-            &GetFileIterator, table_cache_, options);
+            readahead ? &GetReadaheadFileIterator : &GetFileIterator,
+            table_cache_, options);
       }
     }
   }
@@ -1068,46 +1458,264 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   return result;
 }
 
+static bool AnyBeingCompacted(const std::vector<FileMetaData*>& files) {
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i]->being_compacted) {
+      return true;
+    }
+  }
+  return false;
+}
+
 Compaction* VersionSet::PickCompaction() {
-  Compaction* c;
-  int level;
+  Version* v = current_;
+  if (options_->compaction_style == kCompactionStyleUniversal) {
+    return PickUniversalCompaction(false);
+  } else if (options_->compaction_style == kCompactionStyleFIFO) {
+    return PickFIFOCompaction();
+  }
 
   // We prefer compactions triggered by too much data in a level over
-  // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
-    assert(level+1 < config::kNumLevels);
-    c = new Compaction(level);
-
-    // Pick the first file that comes after compact_pointer_[level]
-    for (size_t i = 0; i < current_->files_[level].size(); i++) {
-      FileMetaData* f = current_->files_[level][i];
-      if (compact_pointer_[level].empty() ||
-          icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0) {
-        c->inputs_[0].push_back(f);
-        break;
+  // the compactions triggered by seeks.  Levels are tried in order of
+  // decreasing score, since the files of the best level may all be
+  // taken by compactions in progress.
+  int levels[config::kNumLevels - 1];
+  int num_levels = 0;
+  for (int level = 0; level < config::kNumLevels - 1; level++) {
+    if (v->level_score_[level] >= 1) {
+      int i = num_levels++;
+      while (i > 0 && v->level_score_[levels[i-1]] < v->level_score_[level]) {
+        levels[i] = levels[i-1];
+        i--;
       }
+      levels[i] = level;
     }
-    if (c->inputs_[0].empty()) {
-      // Wrap-around to the beginning of the key space
-      c->inputs_[0].push_back(current_->files_[level][0]);
+  }
+  for (int i = 0; i < num_levels; i++) {
+    Compaction* c = PickLevelCompaction(levels[i]);
+    if (c != NULL) {
+      return c;
     }
-  } else if (seek_compaction) {
-    level = current_->file_to_compact_level_;
-    c = new Compaction(level);
-    c->inputs_[0].push_back(current_->file_to_compact_);
+  }
+
+  FileMetaData* f = v->file_to_compact_;
+  if (f != NULL && !f->being_compacted) {
+    const int level = v->file_to_compact_level_;
+    Compaction* c = new Compaction(options_, level,
+                                   level == 0 ? v->base_level_ : level + 1);
+    c->inputs_[0].push_back(f);
+    if (StartCompaction(c)) {
+      return c;
+    }
+    delete c;
+  }
+  return NULL;
+}
+
+// Level-0 files are the sorted runs, newest first in index_[0].  A
+// merge always starts at the newest run and takes consecutive older
+// ones, so its output, which gets a file number newer than every run,
+// is still read before the runs it did not take.  The caller must
+// reserve that number before any memtable flush can take one.
+Compaction* VersionSet::PickUniversalCompaction(bool merge_all) {
+  const FileIndex& index = current_->index_[0];
+  const int n = index.size();
+  if (n == 0 || (n < 2 && !merge_all)) {
+    return NULL;
+  }
+  std::vector<FileMetaData*> runs(n);
+  for (int i = 0; i < n; i++) {
+    runs[i] = index.file(i);
+  }
+  if (AnyBeingCompacted(runs)) {
+    // Only one merge of level-0 runs at a time
+    return NULL;
+  }
+
+  int count = 0;
+  const char* reason = "";
+  if (merge_all) {
+    count = n;
+    reason = "manual";
+  } else if (n < config::kL0_CompactionTrigger) {
+    return NULL;
   } else {
+    // Merge everything if the newer runs take up too much space next
+    // to the oldest one, which holds most of the data
+    const uint64_t oldest = runs[n-1]->file_size;
+    uint64_t newer = 0;
+    for (int i = 0; i < n - 1; i++) {
+      newer += runs[i]->file_size;
+    }
+    if (newer * 100 >
+        static_cast<uint64_t>(
+            options_->universal_max_size_amplification_percent) * oldest) {
+      count = n;
+      reason = "space amplification";
+    }
+
+    // Else merge the newest runs while they are of similar size
+    if (count == 0) {
+      uint64_t picked = runs[0]->file_size;
+      int k = 1;
+      while (k < n && k < options_->universal_max_merge_width &&
+             runs[k]->file_size * 100 <=
+             picked * (100 + options_->universal_size_ratio)) {
+        picked += runs[k]->file_size;
+        k++;
+      }
+      if (k >= options_->universal_min_merge_width) {
+        count = k;
+        reason = "size ratio";
+      }
+    }
+
+    // Else merge enough of the newest runs to get back under the trigger
+    if (count == 0) {
+      count = std::max(options_->universal_min_merge_width,
+                       n - config::kL0_CompactionTrigger + 1);
+      count = std::min(count, options_->universal_max_merge_width);
+      count = std::min(count, n);
+      reason = "run count";
+    }
+  }
+
+  Compaction* c = new Compaction(options_, 0, 0);
+  c->max_output_file_size_ = ~static_cast<uint64_t>(0);  // A single run
+  c->older_runs_ = (count < n);
+  c->input_version_ = current_;
+  c->input_version_->Ref();
+  c->inputs_[0].assign(runs.begin(), runs.begin() + count);
+  GetRange(c->inputs_[0], &c->smallest_, &c->largest_);
+  RegisterCompaction(c);
+  Log(options_->info_log, "Universal compaction of %d of %d runs (%s)",
+      count, n, reason);
+  return c;
+}
+
+// Level-0 files are deleted oldest first, from the back of index_[0].
+// Since nothing is merged, the files that are left read exactly as they
+// did before.
+Compaction* VersionSet::PickFIFOCompaction() {
+  const FileIndex& index = current_->index_[0];
+  const int n = index.size();
+  std::vector<FileMetaData*> files(n);
+  for (int i = 0; i < n; i++) {
+    files[i] = index.file(i);
+  }
+  if (n == 0 || AnyBeingCompacted(files)) {
+    return NULL;
+  }
+
+  // Drop the oldest files until the others fit within the size and file
+  // count limits, then those of the others that have outlived the TTL
+  uint64_t total = static_cast<uint64_t>(TotalFileSize(files));
+  int keep = n;
+  while (keep > 0 && (total > options_->fifo_max_table_files_size ||
+                      keep > options_->fifo_max_table_files)) {
+    keep--;
+    total -= files[keep]->file_size;
+  }
+  const char* reason = (keep < n) ? "size" : "ttl";
+  if (options_->fifo_ttl_seconds > 0) {
+    const uint64_t now = static_cast<uint64_t>(time(NULL));
+    while (keep > 0 && FileExpired(files[keep-1], now)) {
+      keep--;
+    }
+  }
+  if (keep == n) {
     return NULL;
   }
 
+  Compaction* c = new Compaction(options_, 0, 0);
+  c->deletion_compaction_ = true;
+  c->input_version_ = current_;
+  c->input_version_->Ref();
+  c->inputs_[0].assign(files.begin() + keep, files.end());
+  GetRange(c->inputs_[0], &c->smallest_, &c->largest_);
+  RegisterCompaction(c);
+  Log(options_->info_log, "FIFO compaction deletes %d of %d files (%s)",
+      n - keep, n, reason);
+  return c;
+}
+
+bool VersionSet::FileExpired(const FileMetaData* f, uint64_t now) const {
+  return (f->creation_time != 0 &&
+          f->creation_time + options_->fifo_ttl_seconds < now);
+}
+
+bool VersionSet::OldestFileExpired() const {
+  if (options_->compaction_style != kCompactionStyleFIFO ||
+      options_->fifo_ttl_seconds == 0) {
+    return false;
+  }
+  const FileIndex& index = current_->index_[0];
+  if (index.size() == 0) {
+    return false;
+  }
+  return FileExpired(index.file(index.size() - 1),
+                     static_cast<uint64_t>(time(NULL)));
+}
+
+void VersionSet::SetMissingCreationTimes(Version* v) {
+  const std::vector<FileMetaData*>& files = v->files_[0];
+  for (size_t i = 0; i < files.size(); i++) {
+    uint64_t mtime;
+    if (files[i]->creation_time == 0 &&
+        env_->GetFileModificationTime(TableFileName(dbname_, files[i]->number),
+                                      &mtime).ok()) {
+      files[i]->creation_time = mtime;
+    }
+  }
+}
+
+Compaction* VersionSet::PickLevelCompaction(int level) {
+  assert(level >= 0);
+  assert(level+1 < config::kNumLevels);
+  const std::vector<FileMetaData*>& files = current_->files_[level];
+  if (files.empty()) {
+    return NULL;
+  }
+
+  // Start with the first file that comes after compact_pointer_[level],
+  // wrapping around to the beginning of the key space.
+  size_t start = 0;
+  if (!compact_pointer_[level].empty()) {
+    while (start < files.size() &&
+           icmp_.Compare(files[start]->largest.Encode(),
+                         compact_pointer_[level]) <= 0) {
+      start++;
+    }
+    if (start == files.size()) {
+      start = 0;
+    }
+  }
+  for (size_t i = 0; i < files.size(); i++) {
+    FileMetaData* f = files[(start + i) % files.size()];
+    if (f->being_compacted) {
+      continue;
+    }
+    Compaction* c = new Compaction(
+        options_, level, level == 0 ? current_->base_level_ : level + 1);
+    c->inputs_[0].push_back(f);
+    if (StartCompaction(c)) {
+      return c;
+    }
+    delete c;
+    if (level == 0) {
+      // Only one compaction out of level-0 can run at a time
+      break;
+    }
+  }
+  return NULL;
+}
+
+bool VersionSet::StartCompaction(Compaction* c) {
   c->input_version_ = current_;
   c->input_version_->Ref();
 
   // Files in level 0 may overlap each other, so pick up all overlapping ones
-  if (level == 0) {
+  if (c->level() == 0) {
     InternalKey smallest, largest;
     GetRange(c->inputs_[0], &smallest, &largest);
     // Note that the next call will discard the file we placed in
@@ -1118,8 +1726,67 @@ Compaction* VersionSet::PickCompaction() {
   }
 
   SetupOtherInputs(c);
+  if (ConflictsWithRunningCompaction(c)) {
+    return false;
+  }
+  RegisterCompaction(c);
+  return true;
+}
 
-  return c;
+// Besides sharing no input files with a compaction in progress, a
+// compaction into the same level must cover a disjoint key range, or
+// the two could produce overlapping files there.  The files of level-0
+// overlap each other, so only one compaction out of level-0 may run at
+// a time.
+bool VersionSet::ConflictsWithRunningCompaction(const Compaction* c) const {
+  if (AnyBeingCompacted(c->inputs_[0]) || AnyBeingCompacted(c->inputs_[1])) {
+    return true;
+  }
+  const Comparator* ucmp = icmp_.user_comparator();
+  for (size_t i = 0; i < running_compactions_.size(); i++) {
+    const Compaction* r = running_compactions_[i];
+    if (r->output_level() != c->output_level()) {
+      continue;
+    }
+    if (c->level() == 0 ||
+        (ucmp->Compare(c->smallest_.user_key(), r->largest_.user_key()) <= 0 &&
+         ucmp->Compare(c->largest_.user_key(), r->smallest_.user_key()) >= 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void VersionSet::RegisterCompaction(Compaction* c) {
+  assert(!c->running_);
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      c->inputs_[which][i]->being_compacted = true;
+    }
+  }
+  running_compactions_.push_back(c);
+  c->running_ = true;
+
+  // Update the place where we will do the next compaction for this level.
+  // We update this immediately instead of waiting for the VersionEdit
+  // to be applied so that if the compaction fails, we will try a different
+  // key range next time.
+  InternalKey smallest, largest;
+  GetRange(c->inputs_[0], &smallest, &largest);
+  compact_pointer_[c->level()] = largest.Encode().ToString();
+  c->edit_.SetCompactPointer(c->level(), largest);
+}
+
+void VersionSet::UnregisterCompaction(Compaction* c) {
+  assert(c->running_);
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < c->inputs_[which].size(); i++) {
+      c->inputs_[which][i]->being_compacted = false;
+    }
+  }
+  running_compactions_.erase(std::find(running_compactions_.begin(),
+                                       running_compactions_.end(), c));
+  c->running_ = false;
 }
 
 void VersionSet::SetupOtherInputs(Compaction* c) {
@@ -1127,23 +1794,28 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   InternalKey smallest, largest;
   GetRange(c->inputs_[0], &smallest, &largest);
 
-  GetOverlappingInputs(level+1, smallest, largest, &c->inputs_[1]);
+  if (c->output_level_ != level) {
+    GetOverlappingInputs(c->output_level_, smallest, largest, &c->inputs_[1]);
+  }
 
   // Get entire range covered by compaction
   InternalKey all_start, all_limit;
   GetRange2(c->inputs_[0], c->inputs_[1], &all_start, &all_limit);
 
   // See if we can grow the number of inputs in "level" without
-  // changing the number of "level+1" files we pick up.
+  // changing the number of output level files we pick up.
   if (!c->inputs_[1].empty()) {
     std::vector<FileMetaData*> expanded0;
     GetOverlappingInputs(level, all_start, all_limit, &expanded0);
-    if (expanded0.size() > c->inputs_[0].size()) {
+    if (expanded0.size() > c->inputs_[0].size() &&
+        !AnyBeingCompacted(expanded0)) {
       InternalKey new_start, new_limit;
       GetRange(expanded0, &new_start, &new_limit);
       std::vector<FileMetaData*> expanded1;
-      GetOverlappingInputs(level+1, new_start, new_limit, &expanded1);
-      if (expanded1.size() == c->inputs_[1].size()) {
+      GetOverlappingInputs(c->output_level_, new_start, new_limit,
+                           &expanded1);
+      if (expanded1.size() == c->inputs_[1].size() &&
+          !AnyBeingCompacted(expanded1)) {
         Log(options_->info_log,
             "Expanding@%d %d+%d to %d+%d\n",
             level,
@@ -1161,9 +1833,10 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   }
 
   // Compute the set of grandparent files that overlap this compaction
-  // (parent == level+1; grandparent == level+2)
-  if (level + 2 < config::kNumLevels) {
-    GetOverlappingInputs(level + 2, all_start, all_limit, &c->grandparents_);
+  // (parent == output level; grandparent == output level + 1)
+  if (c->output_level_ + 1 < config::kNumLevels) {
+    GetOverlappingInputs(c->output_level_ + 1, all_start, all_limit,
+                         &c->grandparents_);
   }
 
   if (false) {
@@ -1173,74 +1846,97 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
         EscapeString(largest.Encode()).c_str());
   }
 
-  // Update the place where we will do the next compaction for this level.
-  // We update this immediately instead of waiting for the VersionEdit
-  // to be applied so that if the compaction fails, we will try a different
-  // key range next time.
-  compact_pointer_[level] = largest.Encode().ToString();
-  c->edit_.SetCompactPointer(level, largest);
+  c->smallest_ = all_start;
+  c->largest_ = all_limit;
 }
 
 Compaction* VersionSet::CompactRange(
     int level,
     const InternalKey& begin,
-    const InternalKey& end) {
+    const InternalKey& end,
+    bool in_place) {
+  if (options_->compaction_style == kCompactionStyleUniversal) {
+    assert(level == 0 && in_place);
+    return PickUniversalCompaction(true);
+  }
+  assert(level > 0 || !in_place);
   std::vector<FileMetaData*> inputs;
   GetOverlappingInputs(level, begin, end, &inputs);
   if (inputs.empty()) {
     return NULL;
   }
 
-  Compaction* c = new Compaction(level);
+  int output_level = level + 1;
+  if (in_place) {
+    output_level = level;
+  } else if (level == 0) {
+    output_level = current_->base_level_;
+  }
+  Compaction* c = new Compaction(options_, level, output_level);
   c->input_version_ = current_;
   c->input_version_->Ref();
   c->inputs_[0] = inputs;
   SetupOtherInputs(c);
+  RegisterCompaction(c);
   return c;
 }
 
-Compaction::Compaction(int level)
+Compaction::Compaction(const Options* options, int level, int output_level)
     : level_(level),
-      max_output_file_size_(MaxFileSizeForLevel(level)),
+      output_level_(output_level),
+      max_output_file_size_(MaxFileSizeForLevel(options, output_level)),
+      max_grandparent_overlap_bytes_(
+          MaxGrandParentOverlapBytes(options, output_level)),
+      older_runs_(false),
+      deletion_compaction_(false),
       input_version_(NULL),
-      grandparent_index_(0),
-      seen_key_(false),
-      overlapped_bytes_(0) {
+      running_(false) {
+}
+
+Compaction::Cursor::Cursor()
+    : grandparent_index(0),
+      seen_key(false),
+      overlapped_bytes(0) {
   for (int i = 0; i < config::kNumLevels; i++) {
-    level_ptrs_[i] = 0;
+    level_ptrs[i] = 0;
   }
 }
 
 Compaction::~Compaction() {
-  if (input_version_ != NULL) {
-    input_version_->Unref();
-  }
+  ReleaseInputs();
 }
 
 bool Compaction::IsTrivialMove() const {
   // Avoid a move if there is lots of overlapping grandparent data.
   // Otherwise, the move could create a parent file that will require
   // a very expensive merge later on.
-  return (num_input_files(0) == 1 &&
+  return (output_level_ > level_ &&
+          num_input_files(0) == 1 &&
           num_input_files(1) == 0 &&
-          TotalFileSize(grandparents_) <= kMaxGrandParentOverlapBytes);
+          TotalFileSize(grandparents_) <= max_grandparent_overlap_bytes_);
 }
 
 void Compaction::AddInputDeletions(VersionEdit* edit) {
   for (int which = 0; which < 2; which++) {
     for (size_t i = 0; i < inputs_[which].size(); i++) {
-      edit->DeleteFile(level_ + which, inputs_[which][i]->number);
+      edit->DeleteFile(which == 0 ? level_ : output_level_,
+                       inputs_[which][i]->number);
     }
   }
 }
 
-bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
+bool Compaction::IsBaseLevelForKey(const Slice& user_key,
+                                   Cursor* cursor) const {
+  if (older_runs_) {
+    return false;
+  }
+
   // Maybe use binary search to find right entry instead of linear search?
   const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
-  for (int lvl = level_ + 2; lvl < config::kNumLevels; lvl++) {
+  for (int lvl = output_level_ + 1; lvl < config::kNumLevels; lvl++) {
     const std::vector<FileMetaData*>& files = input_version_->files_[lvl];
-    for (; level_ptrs_[lvl] < files.size(); ) {
-      FileMetaData* f = files[level_ptrs_[lvl]];
+    for (; cursor->level_ptrs[lvl] < files.size(); ) {
+      FileMetaData* f = files[cursor->level_ptrs[lvl]];
       if (user_cmp->Compare(user_key, f->largest.user_key()) <= 0) {
         // We've advanced far enough
         if (user_cmp->Compare(user_key, f->smallest.user_key()) >= 0) {
@@ -1249,28 +1945,30 @@ bool Compaction::IsBaseLevelForKey(const Slice& user_key) {
         }
         break;
       }
-      level_ptrs_[lvl]++;
+      cursor->level_ptrs[lvl]++;
     }
   }
   return true;
 }
 
-bool Compaction::ShouldStopBefore(const Slice& internal_key) {
+bool Compaction::ShouldStopBefore(const Slice& internal_key,
+                                  Cursor* cursor) const {
   // Scan to find earliest grandparent file that contains key.
   const InternalKeyComparator* icmp = &input_version_->vset_->icmp_;
-  while (grandparent_index_ < grandparents_.size() &&
+  while (cursor->grandparent_index < grandparents_.size() &&
       icmp->Compare(internal_key,
-                    grandparents_[grandparent_index_]->largest.Encode()) > 0) {
-    if (seen_key_) {
-      overlapped_bytes_ += grandparents_[grandparent_index_]->file_size;
+          grandparents_[cursor->grandparent_index]->largest.Encode()) > 0) {
+    if (cursor->seen_key) {
+      cursor->overlapped_bytes +=
+          grandparents_[cursor->grandparent_index]->file_size;
     }
-    grandparent_index_++;
+    cursor->grandparent_index++;
   }
-  seen_key_ = true;
+  cursor->seen_key = true;
 
-  if (overlapped_bytes_ > kMaxGrandParentOverlapBytes) {
+  if (cursor->overlapped_bytes > max_grandparent_overlap_bytes_) {
     // Too much overlap for current output; start new output
-    overlapped_bytes_ = 0;
+    cursor->overlapped_bytes = 0;
     return true;
   } else {
     return false;
@@ -1278,6 +1976,9 @@ bool Compaction::ShouldStopBefore(const Slice& internal_key) {
 }
 
 void Compaction::ReleaseInputs() {
+  if (running_) {
+    input_version_->vset_->UnregisterCompaction(this);
+  }
   if (input_version_ != NULL) {
     input_version_->Unref();
     input_version_ = NULL;
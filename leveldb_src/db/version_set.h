@@ -19,6 +19,7 @@
 #include <set>
 #include <vector>
 #include "db/dbformat.h"
+#include "db/file_index.h"
 #include "db/version_edit.h"
 #include "port/port.h"
 
@@ -85,6 +86,12 @@ class Version {
 
   int NumFiles(int level) const { return files_[level].size(); }
 
+  // Append the files of this version to *files in the order in which
+  // reads consult them: level-0 files newest first, then the files of
+  // each level below in key order.  The entries are only valid while
+  // this version is referenced.
+  void GetFilesInReadOrder(std::vector<FileMetaData*>* files);
+
   // Return a human readable string that describes this version's contents.
   std::string DebugString() const;
 
@@ -95,6 +102,13 @@ class Version {
   class LevelFileNumIterator;
   Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
 
+  // Block function for a TwoLevelIterator over a LevelFileNumIterator
+  // that defers opening each file until it is needed.  "arg" is the
+  // VersionSet.
+  static Iterator* GetLazyFileIterator(void* arg,
+                                       const ReadOptions& options,
+                                       const Slice& file_value);
+
   VersionSet* vset_;            // VersionSet to which this Version belongs
   Version* next_;               // Next version in linked list
   Version* prev_;               // Previous version in linked list
@@ -103,6 +117,9 @@ class Version {
   // List of files per level
   std::vector<FileMetaData*> files_[config::kNumLevels];
 
+  // Search structure over files_, per level.  Built by Finalize().
+  FileIndex index_[config::kNumLevels];
+
   // Next file to compact based on seek stats.
   FileMetaData* file_to_compact_;
   int file_to_compact_level_;
@@ -113,12 +130,24 @@ class Version {
   double compaction_score_;
   int compaction_level_;
 
+  // Compaction score of every level, also initialized by Finalize().
+  double level_score_[config::kNumLevels];
+
+  // Level that level-0 is compacted into (see
+  // Options::level_compaction_dynamic_level_bytes).  Also initialized
+  // by Finalize().
+  int base_level_;
+
   explicit Version(VersionSet* vset)
       : vset_(vset), next_(this), prev_(this), refs_(0),
         file_to_compact_(NULL),
         file_to_compact_level_(-1),
         compaction_score_(-1),
-        compaction_level_(-1) {
+        compaction_level_(-1),
+        base_level_(1) {
+    for (int level = 0; level < config::kNumLevels; level++) {
+      level_score_[level] = -1;
+    }
   }
 
   ~Version();
@@ -139,8 +168,9 @@ class VersionSet {
   // Apply *edit to the current version to form a new descriptor that
   // is both saved to persistent state and installed as the new
   // current version.  Will release *mu while actually writing to the file.
-  // REQUIRES: *mu is held on entry.
-  // REQUIRES: no other thread concurrently calls LogAndApply()
+  // Concurrent calls are applied one after another, each to the version
+  // installed by the previous one.
+  // REQUIRES: *mu is held on entry, and is the same mutex on every call.
   Status LogAndApply(VersionEdit* edit, port::Mutex* mu);
 
   // Recover the last saved descriptor from persistent storage.
@@ -181,19 +211,29 @@ class VersionSet {
   uint64_t PrevLogNumber() const { return prev_log_number_; }
 
   // Pick level and inputs for a new compaction.
-  // Returns NULL if there is no compaction to be done.
+  // Returns NULL if there is no compaction to be done, or if all the
+  // work there is to do involves files that are inputs of compactions
+  // in progress.
   // Otherwise returns a pointer to a heap-allocated object that
-  // describes the compaction.  Caller should delete the result.
+  // describes the compaction.  The compaction is in progress until the
+  // caller deletes the result.
   Compaction* PickCompaction();
 
   // Return a compaction object for compacting the range [begin,end] in
   // the specified level.  Returns NULL if there is nothing in that
   // level that overlaps the specified range.  Caller should delete
-  // the result.
+  // the result.  If "in_place" is true the files are rewritten into
+  // "level" itself instead of being merged into the next level.  Under
+  // kCompactionStyleUniversal all level-0 runs are merged into one,
+  // whatever the range.
+  // REQUIRES: no other compaction is in progress.
+  // REQUIRES: level > 0 if in_place, unless the style is universal, in
+  // which case level == 0 and in_place.
   Compaction* CompactRange(
       int level,
       const InternalKey& begin,
-      const InternalKey& end);
+      const InternalKey& end,
+      bool in_place = false);
 
   // Return the maximum overlapping data (in bytes) at next level for any
   // file at a level >= 1.
@@ -203,10 +243,20 @@ class VersionSet {
   // The caller should delete the iterator when no longer needed.
   Iterator* MakeInputIterator(Compaction* c);
 
+  // Return the level that level-0 is compacted into.  Levels between
+  // level-0 and the base level are empty.
+  int BaseLevel() const { return current_->base_level_; }
+
+  // Return the number of compactions in progress.
+  int NumRunningCompactions() const {
+    return static_cast<int>(running_compactions_.size());
+  }
+
   // Returns true iff some level needs a compaction.
   bool NeedsCompaction() const {
     Version* v = current_;
-    return (v->compaction_score_ >= 1) || (v->file_to_compact_ != NULL);
+    return (v->compaction_score_ >= 1) || (v->file_to_compact_ != NULL) ||
+        OldestFileExpired();
   }
 
   // Add all files listed in any live version to *live.
@@ -217,6 +267,15 @@ class VersionSet {
   // "key" as of version "v".
   uint64_t ApproximateOffsetOf(Version* v, const InternalKey& key);
 
+  // Store in *boundaries at most max_parts-1 user keys, in increasing
+  // order, that cut the key range of "c" into parts holding roughly
+  // equal amounts of input data.  The keys are taken from the edges of
+  // the input files.  *boundaries is left empty if "c" is too small to
+  // be worth splitting.  Does not need the DB mutex, since it only reads
+  // the input version of "c".
+  void GetSubcompactionBoundaries(Compaction* c, int max_parts,
+                                  std::vector<std::string>* boundaries);
+
   // Return a human-readable short (single-line) summary of the number
   // of files per level.  Uses *scratch as backing store.
   struct LevelSummaryStorage {
@@ -232,6 +291,10 @@ class VersionSet {
 
   void Finalize(Version* v);
 
+  // Store in max_bytes[1..kNumLevels-1] the size limits of the levels
+  // of "v", and set v->base_level_.
+  void ComputeLevelLimits(Version* v, double* max_bytes);
+
   void GetOverlappingInputs(
       int level,
       const InternalKey& begin,
@@ -249,6 +312,45 @@ class VersionSet {
 
   void SetupOtherInputs(Compaction* c);
 
+  // Approximate offset of "key" within the data of "files", which must
+  // be sorted by key if "sorted" is true.
+  uint64_t ApproximateOffsetOf(const std::vector<FileMetaData*>& files,
+                               bool sorted, const InternalKey& key);
+
+  // Pick a compaction of "level" whose inputs are all free, or NULL.
+  Compaction* PickLevelCompaction(int level);
+
+  // Pick a merge of level-0 runs for kCompactionStyleUniversal, or
+  // NULL.  If "merge_all" is true all runs are merged.
+  Compaction* PickUniversalCompaction(bool merge_all);
+
+  // Pick the oldest level-0 files that kCompactionStyleFIFO should
+  // delete, or NULL.
+  Compaction* PickFIFOCompaction();
+
+  // Returns true iff "f" was created more than
+  // options_->fifo_ttl_seconds before "now" (in seconds since the epoch).
+  // Files of unknown age never expire.
+  bool FileExpired(const FileMetaData* f, uint64_t now) const;
+
+  // Returns true iff kCompactionStyleFIFO has a TTL and the oldest
+  // level-0 file has outlived it.
+  bool OldestFileExpired() const;
+
+  // Date the level-0 files of "v" whose creation time was not recorded,
+  // such as those written under another compaction style, by the time
+  // they were last modified.
+  void SetMissingCreationTimes(Version* v);
+
+  // Complete the inputs of "c", which has its first input file(s) in
+  // inputs_[0], and start it.  Returns false if "c" cannot run beside
+  // the compactions in progress.
+  bool StartCompaction(Compaction* c);
+
+  bool ConflictsWithRunningCompaction(const Compaction* c) const;
+  void RegisterCompaction(Compaction* c);
+  void UnregisterCompaction(Compaction* c);
+
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
 
@@ -275,6 +377,16 @@ class VersionSet {
   // Either an empty string, or a valid InternalKey.
   std::string compact_pointer_[config::kNumLevels];
 
+  // Compactions in progress.  Their input files are marked
+  // being_compacted.
+  std::vector<Compaction*> running_compactions_;
+
+  // Set while a LogAndApply() call has released the mutex to write the
+  // MANIFEST.  Other calls wait on manifest_cv_, which is created on the
+  // first call since only then is the mutex known.
+  bool manifest_writing_;
+  port::CondVar* manifest_cv_;
+
   // No copying allowed
   VersionSet(const VersionSet&);
   void operator=(const VersionSet&);
@@ -285,10 +397,40 @@ class Compaction {
  public:
   ~Compaction();
 
+  // State of one pass over the keys of the compaction, in increasing
+  // order, kept by IsBaseLevelForKey() and ShouldStopBefore().  Passes
+  // over disjoint parts of the key range may run concurrently, each
+  // with its own Cursor.
+  struct Cursor {
+    // State used to check for number of of overlapping grandparent files
+    // (parent == output_level_, grandparent == output_level_ + 1)
+    size_t grandparent_index;  // Index in grandparents_
+    bool seen_key;             // Some output key has been seen
+    int64_t overlapped_bytes;  // Bytes of overlap between current output
+                               // and grandparent files
+
+    // State for implementing IsBaseLevelForKey
+
+    // level_ptrs holds indices into input_version_->levels_: our state
+    // is that we are positioned at one of the file ranges for each
+    // higher level than the ones involved in this compaction (i.e. for
+    // all L > output_level_).
+    size_t level_ptrs[config::kNumLevels];
+
+    Cursor();
+  };
+
   // Return the level that is being compacted.  Inputs from "level"
-  // and "level+1" will be merged to produce a set of "level+1" files.
+  // and "output_level" will be merged to produce a set of
+  // "output_level" files.
   int level() const { return level_; }
 
+  // Return the level the outputs go to.  That is "level+1", except that
+  // level-0 goes to the base level (see VersionSet::BaseLevel()), and
+  // that a compaction which rewrites the files of "level" in place has
+  // "level" itself as output level and no inputs from another level.
+  int output_level() const { return output_level_; }
+
   // Return the object that holds the edits to the descriptor done
   // by this compaction.
   VersionEdit* edit() { return &edit_; }
@@ -296,12 +438,17 @@ class Compaction {
   // "which" must be either 0 or 1
   int num_input_files(int which) const { return inputs_[which].size(); }
 
-  // Return the ith input file at "level()+which" ("which" must be 0 or 1).
+  // Return the ith input file at "level()" if "which" is 0, or at
+  // "output_level()" if "which" is 1.
   FileMetaData* input(int which, int i) const { return inputs_[which][i]; }
 
   // Maximum size of files to build during this compaction.
   uint64_t MaxOutputFileSize() const { return max_output_file_size_; }
 
+  // Returns true if the inputs are simply deleted, without being read
+  // or replaced by any output (kCompactionStyleFIFO).
+  bool deletion_compaction() const { return deletion_compaction_; }
+
   // Is this a trivial compaction that can be implemented by just
   // moving a single input file to the next level (no merging or splitting)
   bool IsTrivialMove() const;
@@ -310,47 +457,43 @@ class Compaction {
   void AddInputDeletions(VersionEdit* edit);
 
   // Returns true if the information we have available guarantees that
-  // the compaction is producing data in "level+1" for which no data exists
-  // in levels greater than "level+1".
-  bool IsBaseLevelForKey(const Slice& user_key);
+  // the compaction is producing data in "output_level" for which no data
+  // exists in levels greater than "output_level".
+  bool IsBaseLevelForKey(const Slice& user_key, Cursor* cursor) const;
 
   // Returns true iff we should stop building the current output
   // before processing "internal_key".
-  bool ShouldStopBefore(const Slice& internal_key);
+  bool ShouldStopBefore(const Slice& internal_key, Cursor* cursor) const;
 
   // Release the input version for the compaction, once the compaction
-  // is successful.
+  // is successful.  The compaction is no longer in progress afterwards.
   void ReleaseInputs();
 
  private:
   friend class Version;
   friend class VersionSet;
 
-  explicit Compaction(int level);
+  Compaction(const Options* options, int level, int output_level);
 
   int level_;
+  int output_level_;
   uint64_t max_output_file_size_;
+  int64_t max_grandparent_overlap_bytes_;
+  bool older_runs_;           // Level-0 holds runs older than the inputs
+  bool deletion_compaction_;
   Version* input_version_;
   VersionEdit edit_;
 
-  // Each compaction reads inputs from "level_" and "level_+1"
+  // Each compaction reads inputs from "level_" and "output_level_"
   std::vector<FileMetaData*> inputs_[2];      // The two sets of inputs
 
-  // State used to check for number of of overlapping grandparent files
-  // (parent == level_ + 1, grandparent == level_ + 2)
+  // Key range covered by both sets of inputs
+  InternalKey smallest_;
+  InternalKey largest_;
+  bool running_;              // Registered with the VersionSet
+
+  // Files at output_level_ + 1 that overlap the compaction
   std::vector<FileMetaData*> grandparents_;
-  size_t grandparent_index_;  // Index in grandparent_starts_
-  bool seen_key_;             // Some output key has been seen
-  int64_t overlapped_bytes_;  // Bytes of overlap between current output
-                              // and grandparent files
-
-  // State for implementing IsBaseLevelForKey
-
-  // level_ptrs_ holds indices into input_version_->levels_: our state
-  // is that we are positioned at one of the file ranges for each
-  // higher level than the ones involved in this compaction (i.e. for
-  // all L >= level_ + 2).
-  size_t level_ptrs_[config::kNumLevels];
 };
 
 }
@@ -29,15 +29,62 @@ class FindFileTest {
     files_.push_back(f);
   }
 
+  // Checks that FileIndex agrees with the plain vector search
   int Find(const char* key) {
     InternalKey target(key, 100, kTypeValue);
     InternalKeyComparator cmp(BytewiseComparator());
-    return FindFile(cmp, files_, target.Encode());
+    FileIndex index;
+    index.Build(&cmp, files_, true);
+    const int result = FindFile(cmp, files_, target.Encode());
+    ASSERT_EQ(result, index.FindFile(target.Encode()));
+    return result;
   }
 
   bool Overlaps(const char* smallest, const char* largest) {
     InternalKeyComparator cmp(BytewiseComparator());
-    return SomeFileOverlapsRange(cmp, files_, smallest, largest);
+    FileIndex index;
+    index.Build(&cmp, files_, true);
+    const bool result = SomeFileOverlapsRange(cmp, files_, smallest, largest);
+    ASSERT_EQ(result, index.SomeFileOverlapsRange(smallest, largest));
+    return result;
+  }
+
+  // Checks that FileIndex::FilesContaining agrees with a scan of files_
+  void CheckFilesContaining(const char* key) {
+    InternalKeyComparator cmp(BytewiseComparator());
+    FileIndex index;
+    index.Build(&cmp, files_, false);
+    std::string expected, actual;
+    for (size_t i = 0; i < files_.size(); i++) {
+      if (Slice(key).compare(files_[i]->smallest.user_key()) >= 0 &&
+          Slice(key).compare(files_[i]->largest.user_key()) <= 0) {
+        AppendNumberTo(&expected, files_[i]->number);
+      }
+    }
+    std::vector<FileMetaData*> scratch;
+    FileMetaData* const* files;
+    uint32_t n;
+    index.FilesContaining(key, &scratch, &files, &n);
+    for (uint32_t i = 0; i < n; i++) {
+      AppendNumberTo(&actual, files[i]->number);
+    }
+    ASSERT_EQ(expected, actual) << key;
+  }
+
+  // Numbers of the files a FileIndex over files_ finds in [begin,end]
+  std::string Overlapping(const char* begin, const char* end,
+                          bool disjoint = true) {
+    InternalKeyComparator cmp(BytewiseComparator());
+    FileIndex index;
+    index.Build(&cmp, files_, disjoint);
+    std::vector<FileMetaData*> inputs;
+    index.GetOverlappingFiles(begin, end, &inputs);
+    std::string result;
+    for (size_t i = 0; i < inputs.size(); i++) {
+      if (i > 0) result += ",";
+      AppendNumberTo(&result, inputs[i]->number);
+    }
+    return result;
   }
 };
 
@@ -108,6 +155,97 @@ TEST(FindFileTest, Multiple) {
   ASSERT_TRUE(Overlaps("450", "500"));
 }
 
+TEST(FindFileTest, LongCommonPrefixes) {
+  // Keys that only differ after the first eight bytes, or in length
+  Add("prefix00a", "prefix00c");
+  Add("prefix00d", "prefix00d");
+  Add("prefix00e", "prefix01");
+  Add("prefix01\x01", "prefix01\x01");
+  ASSERT_EQ(0, Find("prefix00"));
+  ASSERT_EQ(0, Find("prefix00c"));
+  ASSERT_EQ(1, Find("prefix00c1"));
+  ASSERT_EQ(2, Find("prefix00e"));
+  ASSERT_EQ(2, Find("prefix01"));
+  ASSERT_EQ(3, Find("prefix01\x01"));
+  ASSERT_EQ(4, Find("prefix01\x02"));
+
+  ASSERT_TRUE(! Overlaps("prefix00c1", "prefix00c9"));
+  ASSERT_TRUE(Overlaps("prefix00c1", "prefix00d"));
+  ASSERT_TRUE(Overlaps("prefix01", "prefix02"));
+}
+
+TEST(FindFileTest, OverlappingFiles) {
+  Add("150", "200");
+  Add("200", "250");
+  Add("300", "350");
+  Add("400", "450");
+  ASSERT_EQ("", Overlapping("100", "149"));
+  ASSERT_EQ("1,2", Overlapping("100", "200"));
+  ASSERT_EQ("2,3", Overlapping("201", "300"));
+  ASSERT_EQ("", Overlapping("351", "399"));
+  ASSERT_EQ("1,2,3,4", Overlapping("0", "9"));
+}
+
+TEST(FindFileTest, OverlappingFilesNotDisjoint) {
+  // Level-0 files may overlap, so sorting by smallest key is not enough
+  // to find them by binary search.
+  Add("100", "900");
+  Add("200", "300");
+  Add("400", "500");
+  ASSERT_EQ("1,3", Overlapping("450", "460", false));
+  ASSERT_EQ("1", Overlapping("600", "700", false));
+  ASSERT_EQ("", Overlapping("950", "990", false));
+
+  InternalKeyComparator cmp(BytewiseComparator());
+  FileIndex index;
+  index.Build(&cmp, files_, false);
+  ASSERT_TRUE(index.SomeFileOverlapsRange("600", "700"));
+  ASSERT_TRUE(! index.SomeFileOverlapsRange("950", "990"));
+}
+
+TEST(FindFileTest, FilesContaining) {
+  // In the order a lookup should visit them
+  Add("100", "900");
+  Add("200", "300");
+  Add("300", "500");
+  Add("600", "600");
+  Add("000", "150");
+
+  const char* kKeys[] = { "0", "000", "100", "120", "150", "151", "250",
+                          "300", "301", "500", "550", "600", "601", "900",
+                          "901", "999" };
+  for (size_t k = 0; k < sizeof(kKeys) / sizeof(kKeys[0]); k++) {
+    CheckFilesContaining(kKeys[k]);
+  }
+}
+
+TEST(FindFileTest, FilesContainingManyFiles) {
+  // More files than get an interval structure
+  char smallest[10], largest[10];
+  for (int i = 0; i < 100; i++) {
+    snprintf(smallest, sizeof(smallest), "%03d", (i * 37) % 900);
+    snprintf(largest, sizeof(largest), "%03d", (i * 37) % 900 + i % 50);
+    Add(smallest, largest);
+  }
+  const char* kKeys[] = { "0", "000", "100", "120", "150", "151", "250",
+                          "300", "301", "500", "550", "600", "601", "900",
+                          "901", "999" };
+  for (size_t k = 0; k < sizeof(kKeys) / sizeof(kKeys[0]); k++) {
+    CheckFilesContaining(kKeys[k]);
+  }
+}
+
+TEST(FindFileTest, FilesContainingEmpty) {
+  InternalKeyComparator cmp(BytewiseComparator());
+  FileIndex index;
+  index.Build(&cmp, files_, false);
+  std::vector<FileMetaData*> scratch;
+  FileMetaData* const* files;
+  uint32_t n;
+  index.FilesContaining("foo", &scratch, &files, &n);
+  ASSERT_EQ(0, n);
+}
+
 TEST(FindFileTest, OverlapSequenceChecks) {
   Add("200", "200", 5000, 3000);
   ASSERT_TRUE(! Overlaps("199", "199"));
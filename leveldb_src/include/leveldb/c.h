@@ -53,6 +53,7 @@ extern "C" {
 typedef struct leveldb_t               leveldb_t;
 typedef struct leveldb_cache_t         leveldb_cache_t;
 typedef struct leveldb_comparator_t    leveldb_comparator_t;
+typedef struct leveldb_compactrangeoptions_t leveldb_compactrangeoptions_t;
 typedef struct leveldb_env_t           leveldb_env_t;
 typedef struct leveldb_filelock_t      leveldb_filelock_t;
 typedef struct leveldb_iterator_t      leveldb_iterator_t;
@@ -127,6 +128,14 @@ extern void leveldb_approximate_sizes(
     const char* const* range_limit_key, const size_t* range_limit_key_len,
     uint64_t* sizes);
 
+/* A NULL start_key or limit_key leaves that end of the range open. */
+extern void leveldb_compact_range(
+    leveldb_t* db,
+    const leveldb_compactrangeoptions_t* options,
+    const char* start_key, size_t start_key_len,
+    const char* limit_key, size_t limit_key_len,
+    char** errptr);
+
 /* Management operations */
 
 extern void leveldb_destroy_db(
@@ -229,6 +238,18 @@ extern void leveldb_writeoptions_destroy(leveldb_writeoptions_t*);
 extern void leveldb_writeoptions_set_sync(
     leveldb_writeoptions_t*, unsigned char);
 
+/* Compact range options */
+
+extern leveldb_compactrangeoptions_t* leveldb_compactrangeoptions_create();
+extern void leveldb_compactrangeoptions_destroy(
+    leveldb_compactrangeoptions_t*);
+extern void leveldb_compactrangeoptions_set_rewrite_bottommost(
+    leveldb_compactrangeoptions_t*, unsigned char);
+extern void leveldb_compactrangeoptions_set_progress(
+    leveldb_compactrangeoptions_t*,
+    void* state,
+    void (*progress)(void*, int done, int total));
+
 /* Cache */
 
 extern leveldb_cache_t* leveldb_cache_create_lru(size_t capacity);
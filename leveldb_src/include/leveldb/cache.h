@@ -10,10 +10,11 @@
 // length strings, may use the length of the string as the charge for
 // the string.
 //
-// A builtin cache implementation with a least-recently-used eviction
-// policy is provided.  Clients may use their own implementations if
-// they want something more sophisticated (like scan-resistance, a
-// custom eviction policy, variable cache sizing, etc.)
+// Builtin cache implementations with a least-recently-used eviction
+// policy and with its CLOCK approximation are provided.  Clients may
+// use their own implementations if they want something more
+// sophisticated (like scan-resistance, a custom eviction policy,
+// variable cache sizing, etc.)
 
 #ifndef STORAGE_LEVELDB_INCLUDE_CACHE_H_
 #define STORAGE_LEVELDB_INCLUDE_CACHE_H_
@@ -30,6 +31,22 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Like NewLRUCache(capacity), but the given fraction of the capacity
+// forms a protected pool for entries inserted with Cache::HIGH and for
+// entries that have been hit at least once.  Other entries are inserted
+// below that pool, so a burst of entries that are never looked up
+// again (e.g. the blocks read by a long scan) only displaces other
+// such entries.  A ratio of zero gives a plain LRU cache.
+extern Cache* NewLRUCache(size_t capacity, double high_pri_pool_ratio);
+
+// Create a new cache with a fixed size capacity, split into
+// 2^num_shard_bits independently locked shards.  This implementation of
+// Cache uses the CLOCK approximation of least-recently-used eviction.
+// Lookups never modify shared lists, so concurrent hits scale better
+// than with NewLRUCache(); inserts and evictions still lock their
+// shard.
+extern Cache* NewClockCache(size_t capacity, int num_shard_bits);
+
 class LEVELDB_EXPORT Cache {
  public:
   Cache() { }
@@ -41,6 +58,12 @@ class LEVELDB_EXPORT Cache {
   // Opaque handle to an entry stored in the cache.
   struct Handle { };
 
+  // Eviction priority of an entry, for caches that support it.
+  enum Priority {
+    HIGH,
+    LOW
+  };
+
   // Insert a mapping from key->value into the cache and assign it
   // the specified charge against the total cache capacity.
   //
@@ -53,6 +76,14 @@ class LEVELDB_EXPORT Cache {
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) = 0;
 
+  // Like Insert() above, but with the given priority.  The entry is
+  // retained longer than entries inserted with Priority LOW, which is
+  // what Insert() above uses.  The default implementation ignores the
+  // priority.
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority);
+
   // If the cache has no mapping for "key", returns NULL.
   //
   // Else return a handle that corresponds to the mapping.  The caller
@@ -82,6 +113,11 @@ class LEVELDB_EXPORT Cache {
   // its cache keys.
   virtual uint64_t NewId() = 0;
 
+  // Change the capacity the charges of the entries are held against.
+  // Lowering it evicts entries that are not in use right away, until the
+  // cache fits the new capacity.
+  virtual void SetCapacity(size_t capacity) = 0;
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
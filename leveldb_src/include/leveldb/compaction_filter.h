@@ -0,0 +1,49 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A CompactionFilter lets an application drop or rewrite entries while
+// compactions rewrite them anyway, e.g. to expire old data without
+// reading the whole DB and writing a deletion for every expired key.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+#define STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
+
+#include "win32exports.h"
+#include <string>
+
+namespace leveldb {
+
+class Slice;
+
+// A CompactionFilter implementation must be thread-safe since leveldb
+// may invoke its methods concurrently from multiple threads.
+class LEVELDB_EXPORT CompactionFilter {
+ public:
+  virtual ~CompactionFilter();
+
+  // Called by a compaction of "level" for the newest value of "key"
+  // among its inputs, if no live snapshot can read that value: either
+  // there are no snapshots, or the value was written after the newest
+  // one.  Values that some snapshot may still read, older values,
+  // deleted keys, and files that are moved to another level without
+  // being rewritten are not passed to the filter.  Snapshots taken
+  // while the compaction runs may see its result.
+  //
+  // Return true to drop the entry: the key then reads as deleted.
+  // Otherwise the entry is kept, with its value replaced by *new_value
+  // if the method sets *value_changed to true.  *value_changed is false
+  // and *new_value is empty on entry.
+  virtual bool Filter(int level,
+                      const Slice& key,
+                      const Slice& existing_value,
+                      std::string* new_value,
+                      bool* value_changed) const = 0;
+
+  // The name of the filter.  Used in the info log.
+  virtual const char* Name() const = 0;
+};
+
+}
+
+#endif  // STORAGE_LEVELDB_INCLUDE_COMPACTION_FILTER_H_
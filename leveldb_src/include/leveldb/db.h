@@ -19,6 +19,7 @@ static const int kMinorVersion = 2;
 struct Options;
 struct ReadOptions;
 struct WriteOptions;
+struct CompactRangeOptions;
 class WriteBatch;
 
 // Abstract handle to particular state of a DB.
@@ -113,6 +114,21 @@ class LEVELDB_EXPORT DB {
   //     where <N> is an ASCII representation of a level number (e.g. "0").
   //  "leveldb.stats" - returns a multi-line string that describes statistics
   //     about the internal operation of the DB.
+  //  "leveldb.recovery-stats" - returns a multi-line string that describes
+  //     how long DB::Open spent reading the descriptor and replaying the
+  //     logs, split into decoding, inserting into memtables and writing
+  //     level-0 tables, and how much log data it replayed.
+  //  "leveldb.iterator-reseeks" - returns the number of times iterators
+  //     sought past a run of hidden entries of one key instead of stepping
+  //     over them (see Options::max_sequential_skip_in_iterations).
+  //     Iterators add to the count when they are deleted.
+  //  "leveldb.flush-stats" - returns a multi-line string that describes
+  //     how long memtable flushes took, how long they waited to start,
+  //     and how long writers stalled waiting for them.
+  //  "leveldb.compaction-filter-stats" - returns a multi-line string that
+  //     describes how many entries were passed to
+  //     Options::compaction_filter, and how many of them it dropped or
+  //     changed.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -126,8 +142,26 @@ class LEVELDB_EXPORT DB {
   virtual void GetApproximateSizes(const Range* range, int n,
                                    uint64_t* sizes) = 0;
 
-  // Possible extensions:
-  // (1) Add a method to compact a range of keys
+  // Compact the underlying storage for the key range [*begin,*end].
+  // In particular, deleted and overwritten versions are discarded,
+  // and the data is rearranged to reduce the cost of operations
+  // needed to access the data.  This operation should typically only
+  // be invoked by users who understand the underlying implementation.
+  //
+  // begin==NULL is treated as a key before all keys in the database.
+  // end==NULL is treated as a key after all keys in the database.
+  // Therefore the following call will compact the entire database:
+  //    db->CompactRange(NULL, NULL, CompactRangeOptions());
+  //
+  // The memtable is written out first, then the range is pushed from
+  // each level into the next one down to the last level that holds
+  // data in it.  The work is done by the background compaction
+  // threads, and is split among several of them if
+  // Options::max_subcompactions allows it; this call blocks until it
+  // is done.  Under kCompactionStyleUniversal all sorted runs are
+  // merged into one instead, whatever the range.
+  virtual Status CompactRange(const Slice* begin, const Slice* end,
+                              const CompactRangeOptions& options) = 0;
 
  private:
   // No copying allowed
@@ -91,6 +91,12 @@ class LEVELDB_EXPORT Env {
   // Store the size of fname in *file_size.
   virtual Status GetFileSize(const std::string& fname, uint64_t* file_size) = 0;
 
+  // Store in *file_mtime the time at which fname was last modified, in
+  // seconds since the Unix epoch.  The default implementation returns
+  // NotSupported.
+  virtual Status GetFileModificationTime(const std::string& fname,
+                                         uint64_t* file_mtime);
+
   // Rename file src to target.
   virtual Status RenameFile(const std::string& src,
                             const std::string& target) = 0;
@@ -126,10 +132,39 @@ class LEVELDB_EXPORT Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // Like Schedule(), but for short, urgent work items that should not
+  // wait behind long-running ones added by Schedule().  The default
+  // implementation calls Schedule(), which is good enough if those
+  // items already run concurrently; an Env that runs them one at a time
+  // should run these on a thread of their own.
+  virtual void ScheduleHighPriority(void (*function)(void* arg), void* arg);
+
+  // Like Schedule(), but for reads that a foreground operation is about
+  // to wait for, such as blocks prefetched by iterators.  They should
+  // neither wait behind nor hold up the work items added by Schedule()
+  // or ScheduleHighPriority().  The default implementation calls
+  // Schedule().
+  virtual void SchedulePrefetch(void (*function)(void* arg), void* arg);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
 
+  // Ask for at least "number" threads to run the work items passed to
+  // Schedule(), so that that many of them can make progress at once.
+  // Never reduces the number of threads.  The default implementation
+  // does nothing, which suits environments whose background work
+  // already runs on a pool of threads.
+  virtual void SetBackgroundThreads(int number);
+
+  // Allow the files opened by NewRandomAccessFile() to be memory-mapped,
+  // as long as at most "bytes" bytes are mapped at a time, so that their
+  // reads return pointers into the mapping instead of copying.  Files
+  // are not mapped until this is called.  Never reduces the budget.  The
+  // default implementation does nothing, which suits environments that
+  // do not map files.
+  virtual void SetMmapReadBudget(uint64_t bytes);
+
   // *path is set to a temporary directory that can be used for testing. It may
   // or many not have just been created. The directory may or may not differ
   // between runs of the same process, but subsequent calls will return the
@@ -188,9 +223,25 @@ class LEVELDB_EXPORT RandomAccessFile {
   // successfully read).  If an error was encountered, returns a
   // non-OK status.
   //
+  // "*result" may point at memory other than "scratch" (for example a
+  // memory-mapped view of the file).  Such memory must stay valid and
+  // unchanged for as long as this file object exists.
+  //
   // Safe for concurrent use by multiple threads.
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
+
+  // Ways in which a file may be about to be read (see Hint()).
+  enum AccessPattern {
+    kNormal,
+    kSequential,        // Read once, from start to end
+    kDontNeed           // Not read again soon
+  };
+
+  // Tell the OS how the file is about to be read, so that it can read
+  // ahead or drop cached pages of the file.  The default implementation
+  // does nothing.
+  virtual void Hint(AccessPattern pattern);
 };
 
 // A file abstraction for sequential writing.  The implementation
@@ -286,6 +337,9 @@ class EnvWrapper : public Env {
   Status GetFileSize(const std::string& f, uint64_t* s) {
     return target_->GetFileSize(f, s);
   }
+  Status GetFileModificationTime(const std::string& f, uint64_t* t) {
+    return target_->GetFileModificationTime(f, t);
+  }
   Status RenameFile(const std::string& s, const std::string& t) {
     return target_->RenameFile(s, t);
   }
@@ -296,9 +350,21 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void ScheduleHighPriority(void (*f)(void*), void* a) {
+    return target_->ScheduleHighPriority(f, a);
+  }
+  void SchedulePrefetch(void (*f)(void*), void* a) {
+    return target_->SchedulePrefetch(f, a);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
+  void SetBackgroundThreads(int number) {
+    return target_->SetBackgroundThreads(number);
+  }
+  void SetMmapReadBudget(uint64_t bytes) {
+    return target_->SetMmapReadBudget(bytes);
+  }
   virtual Status GetTestDirectory(std::string* path) {
     return target_->GetTestDirectory(path);
   }
@@ -68,6 +68,13 @@ class LEVELDB_EXPORT Iterator {
   // If an error has occurred, return it.  Else return an ok status.
   virtual Status status() const = 0;
 
+  // Returns true if the slice returned by key() refers to memory that
+  // stays valid until this iterator is deleted.  Iterators returned by
+  // DB::NewIterator() only return true if ReadOptions::pin_data was set.
+  // The default implementation returns false.
+  // REQUIRES: Valid()
+  virtual bool IsKeyPinned() const;
+
   // Clients are allowed to register function/arg1/arg2 triples that
   // will be invoked when this iterator is destroyed.
   //
@@ -7,13 +7,17 @@
 
 #include "win32exports.h"
 #include <stddef.h>
+#include <stdint.h>
 
 namespace leveldb {
 
 class Cache;
+class CompactionFilter;
 class Comparator;
 class Env;
 class Logger;
+class PersistentCache;
+class RateLimiter;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -27,6 +31,23 @@ enum CompressionType {
   kSnappyCompression = 0x1
 };
 
+// How the files of a DB are organized and compacted (see
+// Options::compaction_style).
+enum CompactionStyle {
+  // Files are arranged in levels of increasing size, and data is
+  // merged from each level into the next.
+  kCompactionStyleLevel     = 0x0,
+
+  // Every memtable flush adds a sorted run to level-0, and runs of
+  // similar size are merged with each other, newest first.
+  kCompactionStyleUniversal = 0x1,
+
+  // Every memtable flush adds a file to level-0 and files are never
+  // merged.  The oldest files are deleted once the DB grows too large
+  // or the files grow too old.
+  kCompactionStyleFIFO      = 0x2
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct LEVELDB_EXPORT Options {
   // -------------------
@@ -40,6 +61,16 @@ struct LEVELDB_EXPORT Options {
   // comparator provided to previous open calls on the same DB.
   const Comparator* comparator;
 
+  // If non-NULL, compactions pass the entries they rewrite to this
+  // filter, which may drop them or change their values (see
+  // compaction_filter.h).  Dropped entries are removed outright when no
+  // deeper level may hold the key, and are turned into deletions
+  // otherwise.
+  //
+  // REQUIRES: compaction_filter outlives the DB.
+  // Default: NULL
+  const CompactionFilter* compaction_filter;
+
   // If true, the database will be created if it is missing.
   // Default: false
   bool create_if_missing;
@@ -89,6 +120,152 @@ struct LEVELDB_EXPORT Options {
   // Default: 1000
   int max_open_files;
 
+  // If non-zero, table files may be memory-mapped, up to this many bytes
+  // of them at a time, and uncompressed blocks are then read in place
+  // instead of being copied.  The budget is shared by every DB that uses
+  // "env", and is raised to the largest value any of them asks for (see
+  // Env::SetMmapReadBudget).  Mapping a lot of data only makes sense on
+  // 64-bit hosts.
+  // Default: 0
+  uint64_t mmap_read_budget;
+
+  // If true, DB::Open opens the table files of the database (up to half
+  // of the tables that max_open_files allows to be open) before it
+  // returns, so that the first reads after a restart do not pay for
+  // opening tables.  Level-0 files are opened first, followed by the
+  // levels below in order.
+  // Default: false
+  bool preload_tables;
+
+  // Number of threads used to open table files when preload_tables is
+  // true.
+  // Default: 4
+  int max_file_opening_threads;
+
+  // Maximum number of background jobs (memtable flushes and compactions)
+  // that may run at the same time.  Concurrent compactions always work
+  // on disjoint sets of files, so raising this mostly helps when several
+  // levels need compacting at once.  The background thread pool of
+  // "env" is grown to match (see Env::SetBackgroundThreads).
+  // Default: 1
+  int max_background_compactions;
+
+  // Maximum number of threads a single compaction is split across.  The
+  // key range of a large compaction is cut at the edges of its input
+  // files into parts of about equal size, which are merged at the same
+  // time; the results are installed together.  Parts are at least as
+  // large as an output file, so small compactions are not split.
+  // Default: 1
+  int max_subcompactions;
+
+  // If non-NULL, the table files written by memtable flushes and by
+  // compactions are written no faster than this limiter allows, so that
+  // background work leaves some disk bandwidth to foreground reads.
+  // Compaction input reads are charged as well when
+  // compaction_readahead_size is set.  Flushes are served ahead of
+  // compactions.  See leveldb/rate_limiter.h.
+  //
+  // REQUIRES: rate_limiter outlives the DB.
+  // Default: NULL
+  RateLimiter* rate_limiter;
+
+  // If non-zero, compactions open their input files apart from the
+  // table cache and read them in chunks of this many bytes, instead of
+  // one block at a time.  The OS is told that the files are read
+  // sequentially, and that their pages are not needed once a
+  // compaction is done with them.  If rate_limiter is set, every chunk
+  // read is charged against it at the priority of compaction writes,
+  // so the limit covers the reads and the writes of compactions
+  // together.  A few megabytes is a good size when the disk is much
+  // faster at sequential than at random reads.
+  // Default: 0
+  size_t compaction_readahead_size;
+
+  // Under kCompactionStyleLevel, level-1 may hold up to this many bytes,
+  // and each deeper level max_bytes_for_level_multiplier times as many
+  // as the level above it.  A level that grows past its limit is
+  // compacted into the next one.
+  // Default: 10MB and 10
+  uint64_t max_bytes_for_level_base;
+  int max_bytes_for_level_multiplier;
+
+  // Compactions into level-1 write files of about target_file_size_base
+  // bytes, and compactions into each deeper level files that are
+  // target_file_size_multiplier times as large as those of the level
+  // above it, up to 1TB.
+  // Default: 2MB and 1
+  uint64_t target_file_size_base;
+  int target_file_size_multiplier;
+
+  // If true, the level limits follow the amount of data in the DB
+  // instead: they are worked out backwards from the size of the largest
+  // level, each level getting 1/max_bytes_for_level_multiplier of the
+  // limit of the one below it, up to the first level whose limit falls
+  // to max_bytes_for_level_base.  Level-0 is compacted straight into
+  // that level and the levels above it stay empty.  This keeps the
+  // older, deeper data about max_bytes_for_level_multiplier times as
+  // large as everything above it, so little space is taken by
+  // overwritten or deleted entries, whatever the size of the DB.
+  // Default: false
+  bool level_compaction_dynamic_level_bytes;
+
+  // With kCompactionStyleLevel, data is rewritten roughly ten times for
+  // each level it passes through.  kCompactionStyleUniversal writes
+  // every entry far fewer times, at the cost of reads that check more
+  // files and of up to universal_max_size_amplification_percent extra
+  // space.  Under kCompactionStyleUniversal all data lives in level-0,
+  // where each file is a sorted run.  A DB may be switched between
+  // styles when it is reopened.
+  // Default: kCompactionStyleLevel
+  CompactionStyle compaction_style;
+
+  // The options below only apply to kCompactionStyleUniversal.  Runs are
+  // merged once there are four or more of them.  Starting from the
+  // newest run, each older run is added to the merge while its size is
+  // at most the sum of the runs picked so far, plus this percentage.
+  // Default: 1
+  int universal_size_ratio;
+
+  // Minimum and maximum number of runs merged by one compaction picked
+  // by size ratio.
+  // Default: 2 and 64
+  int universal_min_merge_width;
+  int universal_max_merge_width;
+
+  // If the runs other than the oldest one add up to more than this
+  // percentage of the oldest run, all runs are merged into one.
+  // Default: 200
+  int universal_max_size_amplification_percent;
+
+  // The options below only apply to kCompactionStyleFIFO, which suits
+  // data that is only kept for a while, such as a cache or a log of
+  // recent events: every entry is written to a table once, and old
+  // entries disappear along with the file holding them, no matter
+  // whether newer files overwrite or delete them.  Reads check every
+  // file whose key range includes the key.
+  //
+  // Once the level-0 files add up to more than this many bytes, the
+  // oldest ones are deleted.  Files that another compaction style left
+  // in deeper levels are kept.
+  // Default: 1GB
+  uint64_t fifo_max_table_files_size;
+
+  // Once there are more than this many level-0 files, the oldest ones
+  // are deleted as well.  Writes are slowed down and then stopped while
+  // there are more, as with the level-0 limits of the other styles.
+  // Default: 1000
+  int fifo_max_table_files;
+
+  // If non-zero, files created more than this many seconds ago are
+  // deleted as well.  The DB checks for such files every minute (or
+  // every fifo_ttl_seconds, if shorter), even while it is idle.
+  // Creation times are recorded when the files are written; files
+  // written before, under another compaction style, are dated by
+  // Env::GetFileModificationTime() when the DB is opened, and never
+  // expire if the Env does not support it.
+  // Default: 0
+  uint64_t fifo_ttl_seconds;
+
   // Control over blocks (user data is stored in a set of blocks, and
   // a block is the unit of reading from disk).
 
@@ -97,6 +274,25 @@ struct LEVELDB_EXPORT Options {
   // Default: NULL
   Cache* block_cache;
 
+  // If non-NULL, use the specified cache for compressed blocks.  A block
+  // that misses in block_cache is looked up here before it is read from
+  // the file, and is decompressed from memory on a hit.  Blocks that are
+  // stored uncompressed on disk are never inserted into this cache.
+  // Since compressed blocks are smaller, this cache holds more of the
+  // database than block_cache for the same amount of memory.
+  // Default: NULL
+  Cache* block_cache_compressed;
+
+  // If non-NULL, blocks evicted from block_cache are written to this
+  // cache, and it is checked for a block that misses in block_cache
+  // before the block is read from its table file.  See
+  // leveldb/persistent_cache.h.
+  //
+  // REQUIRES: persistent_cache outlives the DB.  Blocks evicted from
+  // block_cache after the DB is closed are not written to it.
+  // Default: NULL
+  PersistentCache* persistent_cache;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -112,6 +308,16 @@ struct LEVELDB_EXPORT Options {
   // Default: 16
   int block_restart_interval;
 
+  // If false, every key in a data block is stored in full instead of
+  // being delta encoded against the previous key.  Blocks become
+  // somewhat larger, but iterators can return keys that point directly
+  // into the block contents (see ReadOptions::pin_data).  Tables written
+  // with either setting are readable by all versions of leveldb.  This
+  // parameter can be changed dynamically.
+  //
+  // Default: true
+  bool block_delta_encoding;
+
   // Compress blocks using the specified compression algorithm.  This
   // parameter can be changed dynamically.
   //
@@ -128,6 +334,14 @@ struct LEVELDB_EXPORT Options {
   // efficiently detect that and will switch to uncompressed mode.
   CompressionType compression;
 
+  // An iterator steps over the hidden entries of a key (overwritten
+  // versions, deletion markers, and versions newer than its snapshot)
+  // one entry at a time.  Once it has skipped this many of them it
+  // seeks directly past the rest instead.  Zero disables reseeking.
+  //
+  // Default: 8
+  int max_sequential_skip_in_iterations;
+
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -151,10 +365,28 @@ struct LEVELDB_EXPORT ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // If true, an iterator keeps every block it visits in memory until the
+  // iterator is deleted.  The slice returned by value() then stays valid
+  // for the lifetime of the iterator, and so does the slice returned by
+  // key() whenever Iterator::IsKeyPinned() returns true (always the case
+  // for data written with Options::block_delta_encoding == false).
+  // Long scans with this option set hold on to all of the data they read.
+  // Default: false
+  bool pin_data;
+
+  // Number of data blocks following the current one that an iterator
+  // reads ahead in the background (see Env::SchedulePrefetch) while it moves
+  // forward through a table, so that scans overlap I/O with decoding.
+  // One or two blocks are usually enough.  Zero disables prefetching.
+  // Default: 0
+  size_t prefetch_blocks;
+
   ReadOptions()
       : verify_checksums(false),
         fill_cache(true),
-        snapshot(NULL) {
+        snapshot(NULL),
+        pin_data(false),
+        prefetch_blocks(0) {
   }
 };
 
@@ -196,6 +428,31 @@ struct LEVELDB_EXPORT WriteOptions {
   }
 };
 
+// Options that control DB::CompactRange()
+struct LEVELDB_EXPORT CompactRangeOptions {
+  // If true, the files of the last level that holds data in the range
+  // are rewritten as well, although there is no level below to merge
+  // them into.  This drops deletion markers and overwritten values that
+  // earlier compactions into that level had to keep, e.g. because a
+  // snapshot still needed them.
+  // Default: false
+  bool rewrite_bottommost;
+
+  // If non-NULL, called from the thread running CompactRange() after
+  // each step of the compaction as (*progress)(progress_arg, done, total):
+  // "done" steps out of "total" are complete.  Each step compacts the
+  // range out of one level.
+  // Default: NULL
+  void (*progress)(void* arg, int done, int total);
+  void* progress_arg;
+
+  CompactRangeOptions()
+      : rewrite_bottommost(false),
+        progress(NULL),
+        progress_arg(NULL) {
+  }
+};
+
 }
 
 #endif  // STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
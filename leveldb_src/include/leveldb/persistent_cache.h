@@ -0,0 +1,82 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A PersistentCache is a second tier behind the block cache that keeps
+// blocks in files on a local device, typically a small fast disk sitting
+// in front of the large slow volume that holds the database.  Blocks
+// evicted from Options::block_cache are written to it, and it is checked
+// before a block is read from its table file.
+//
+// The builtin implementation is log structured: blocks are appended to
+// an in-memory segment, full segments are written to files of their
+// own by a background thread, and the oldest segment is dropped when
+// the cache grows past its capacity.  Blocks are dropped rather than
+// waited for when that thread falls behind.  Its contents do not
+// survive a restart.  The ids that tie cached blocks to table files are only
+// meaningful for the lifetime of a process, so opening a cache discards
+// whatever a previous process left behind in its directory.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
+#define STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
+
+#include "win32exports.h"
+#include <stdint.h>
+#include <string>
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Env;
+class PersistentCache;
+
+// Open a persistent cache that keeps at most "capacity" bytes of blocks
+// in files under the directory "dir", creating the directory if needed.
+// All file accesses go through "env".  On success stores a pointer to
+// the new cache in *result and returns OK.  On failure stores NULL in
+// *result and returns non-OK.
+//
+// The directory must not be shared with anything else: existing cache
+// files in it are deleted.  The caller should delete *result when it
+// is no longer needed, which also deletes the cache files.
+extern Status NewPersistentCache(Env* env, const std::string& dir,
+                                 uint64_t capacity,
+                                 PersistentCache** result);
+
+class LEVELDB_EXPORT PersistentCache {
+ public:
+  PersistentCache() { }
+
+  virtual ~PersistentCache();
+
+  // Store a copy of "contents" under "key".  Does nothing if the cache
+  // already holds "key".  Failures to write are not reported: the entry
+  // is simply not cached.
+  //
+  // Called from the block cache's deleter, with the block cache locked,
+  // so this should not block on IO.
+  virtual void Insert(const Slice& key, const Slice& contents) = 0;
+
+  // If the cache holds an intact copy of the contents for "key", store
+  // it in *contents and return true.  Else return false.
+  virtual bool Lookup(const Slice& key, std::string* contents) = 0;
+
+  // Return a new numeric id.  Used like Cache::NewId() to partition the
+  // key space among the clients sharing this cache.
+  virtual uint64_t NewId() = 0;
+
+  // Wait until the entries that the cache has started writing to its
+  // files in the background have been written.  Mostly useful for tests.
+  // The default implementation does nothing.
+  virtual void WaitForWrites();
+
+ private:
+  // No copying allowed
+  PersistentCache(const PersistentCache&);
+  void operator=(const PersistentCache&);
+};
+
+}
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PERSISTENT_CACHE_H_
@@ -0,0 +1,72 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A RateLimiter bounds the rate at which background work does IO, so
+// that a large compaction does not take all of the bandwidth that
+// foreground reads need.  The table files written by memtable flushes
+// and compactions are charged against it, and so are the chunks that
+// compactions read their inputs in when
+// Options::compaction_readahead_size is set.  One limiter may be shared
+// by several DBs, and it has internal synchronization.
+//
+// The builtin implementation is a token bucket: tokens worth a tenth of
+// a second of IO are added ten times per second, and a request waits
+// until there are tokens for it.  Memtable flushes take tokens ahead of
+// compactions, since writes stall when flushes fall behind.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+
+#include "win32exports.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace leveldb {
+
+class RateLimiter;
+
+// Create a rate limiter that lets at most "bytes_per_second" bytes
+// through each second.  If "auto_tuned" is true the rate follows the
+// demand instead, between a twentieth of "bytes_per_second" and
+// "bytes_per_second": it is raised while requests keep draining the
+// bucket, as they do while compactions fall behind, and lowered while
+// they do not.
+extern RateLimiter* NewGenericRateLimiter(int64_t bytes_per_second,
+                                          bool auto_tuned = false);
+
+class LEVELDB_EXPORT RateLimiter {
+ public:
+  enum Priority {
+    kLow,                       // Compaction writes and readahead reads
+    kHigh                       // Memtable flushes
+  };
+
+  RateLimiter() { }
+
+  virtual ~RateLimiter();
+
+  // Block until "bytes" bytes may be written or read at priority "pri".
+  // Low priority requests wait while high priority ones are waiting.
+  virtual void Request(size_t bytes, Priority pri) = 0;
+
+  // Return the number of bytes that may currently be written or read
+  // per second.
+  virtual int64_t GetBytesPerSecond() const = 0;
+
+  // Change the limit.  With an auto-tuned limiter this sets the upper
+  // end of the range the rate is tuned within.
+  virtual void SetBytesPerSecond(int64_t bytes_per_second) = 0;
+
+  // Return the number of bytes let through so far.
+  virtual uint64_t GetTotalBytesThrough() const = 0;
+
+ private:
+  // No copying allowed
+  RateLimiter(const RateLimiter&);
+  void operator=(const RateLimiter&);
+};
+
+}
+
+#endif  // STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
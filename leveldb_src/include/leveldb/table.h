@@ -14,6 +14,7 @@ namespace leveldb {
 class Block;
 class BlockHandle;
 struct Options;
+class PersistTarget;
 class RandomAccessFile;
 struct ReadOptions;
 
@@ -39,6 +40,23 @@ class LEVELDB_EXPORT Table {
                      uint64_t file_size,
                      Table** table);
 
+  // Like the above, but for a table file of a DB, whose blocks are
+  // written to options.persistent_cache under keys made of
+  // "persistent_cache_id" and "file_number" rather than of an id of the
+  // new Table, so that they are found again after the file is closed
+  // and opened anew.  They are written through "persist_target"
+  // (see table/persist_target.h), which the caller closes once it no
+  // longer opens the file.  For use by the DB implementation.
+  //
+  // REQUIRES: "persist_target" is non-NULL iff options.persistent_cache is
+  static Status Open(const Options& options,
+                     RandomAccessFile* file,
+                     uint64_t file_size,
+                     uint64_t persistent_cache_id,
+                     uint64_t file_number,
+                     PersistTarget* persist_target,
+                     Table** table);
+
   ~Table();
 
   // Returns a new iterator over the table contents.
@@ -62,6 +62,24 @@ class Mutex {
   void operator=(const Mutex&);
 };
 
+class RWMutex {
+ public:
+  RWMutex();
+  ~RWMutex();
+
+  void ReadLock();
+  void WriteLock();
+  void ReadUnlock();
+  void WriteUnlock();
+
+ private:
+  pthread_rwlock_t mu_;
+
+  // No copying
+  RWMutex(const RWMutex&);
+  void operator=(const RWMutex&);
+};
+
 class CondVar {
  public:
   explicit CondVar(Mutex* mu);
@@ -117,6 +135,11 @@ class AtomicPointer {
   }
 };
 
+// Atomically add "delta" to *value and return the new value.
+inline int AtomicAdd(volatile int* value, int delta) {
+  return __sync_add_and_fetch(value, delta);
+}
+
 // TODO(gabor): Implement compress
 inline bool Snappy_Compress(
     const char* input,
@@ -42,6 +42,27 @@ class Mutex {
   void AssertHeld();
 };
 
+// A RWMutex is a lock that may be held either by any number of readers
+// or by a single writer.
+class RWMutex {
+ public:
+  RWMutex();
+  ~RWMutex();
+
+  // Lock the mutex for reading.  Waits until any writer has exited.
+  void ReadLock();
+
+  // Lock the mutex for writing.  Waits until all other lockers have
+  // exited.
+  void WriteLock();
+
+  // Unlock the mutex.
+  // REQUIRES: This mutex was locked for reading (resp. writing) by
+  // this thread.
+  void ReadUnlock();
+  void WriteUnlock();
+};
+
 class CondVar {
  public:
   explicit CondVar(Mutex* mu);
@@ -89,6 +110,10 @@ class AtomicPointer {
   void NoBarrier_Store(void* v);
 };
 
+// Atomically add "delta" to *value and return the new value.  The
+// operation is a full memory barrier.
+extern int AtomicAdd(volatile int* value, int delta);
+
 // ------------------ Compression -------------------
 
 // Store the snappy compression of "input[0,input_length-1]" in *output.
@@ -68,6 +68,24 @@ class Mutex {
   void operator=(const Mutex&);
 };
 
+class RWMutex {
+ public:
+  RWMutex();
+  ~RWMutex();
+
+  void ReadLock();
+  void WriteLock();
+  void ReadUnlock();
+  void WriteUnlock();
+
+ private:
+  pthread_rwlock_t mu_;
+
+  // No copying
+  RWMutex(const RWMutex&);
+  void operator=(const RWMutex&);
+};
+
 class CondVar {
  public:
   explicit CondVar(Mutex* mu);
@@ -80,6 +98,11 @@ class CondVar {
   Mutex* mu_;
 };
 
+// Atomically add "delta" to *value and return the new value.
+inline int AtomicAdd(volatile int* value, int delta) {
+  return __sync_add_and_fetch(value, delta);
+}
+
 inline bool Snappy_Compress(const char* input, size_t length,
                             ::std::string* output) {
 #ifdef SNAPPY
@@ -9,6 +9,7 @@
 #include <vector>
 #include <algorithm>
 #include "leveldb/comparator.h"
+#include "table/format.h"
 #include "util/coding.h"
 #include "util/logging.h"
 
@@ -19,9 +20,10 @@ inline uint32_t Block::NumRestarts() const {
   return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
 }
 
-Block::Block(const char* data, size_t size)
-    : data_(data),
-      size_(size) {
+Block::Block(const BlockContents& contents)
+    : data_(contents.data.data()),
+      size_(contents.data.size()),
+      owned_(contents.heap_allocated) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
   } else {
@@ -35,7 +37,9 @@ Block::Block(const char* data, size_t size)
 }
 
 Block::~Block() {
-  delete[] data_;
+  if (owned_) {
+    delete[] data_;
+  }
 }
 
 // Helper routine: decode the next block entry starting at "p",
@@ -78,10 +82,26 @@ class Block::Iter : public Iterator {
   // current_ is offset in data_ of current entry.  >= restarts_ if !Valid
   uint32_t current_;
   uint32_t restart_index_;  // Index of restart block in which current_ falls
-  std::string key_;
+  Slice key_;               // Points into data_ iff key_pinned_
+  bool key_pinned_;
+  std::string key_buf_;     // Backing store for delta encoded keys
   Slice value_;
   Status status_;
 
+  // Entries of the restart interval holding current_, decoded once so
+  // that Prev() can walk backwards without reparsing the interval from
+  // its restart point on every step.
+  struct CachedEntry {
+    uint32_t offset;        // Offset of the entry in data_
+    uint32_t key_offset;    // Offset of the key in data_ or prev_keys_
+    uint32_t key_size;
+    bool key_pinned;        // Is the key stored in data_?
+    Slice value;
+  };
+  std::vector<CachedEntry> prev_entries_;
+  std::string prev_keys_;   // Delta encoded keys of prev_entries_
+  int prev_index_;          // Index of current_ in prev_entries_, or -1
+
   inline int Compare(const Slice& a, const Slice& b) const {
     return comparator_->Compare(a, b);
   }
@@ -98,6 +118,8 @@ class Block::Iter : public Iterator {
 
   void SeekToRestartPoint(uint32_t index) {
     key_.clear();
+    key_pinned_ = false;
+    prev_index_ = -1;
     restart_index_ = index;
     // current_ will be fixed by ParseNextKey();
 
@@ -116,7 +138,9 @@ class Block::Iter : public Iterator {
         restarts_(restarts),
         num_restarts_(num_restarts),
         current_(restarts_),
-        restart_index_(num_restarts_) {
+        restart_index_(num_restarts_),
+        key_pinned_(false),
+        prev_index_(-1) {
     assert(num_restarts_ > 0);
   }
 
@@ -130,15 +154,27 @@ class Block::Iter : public Iterator {
     assert(Valid());
     return value_;
   }
+  virtual bool IsKeyPinned() const {
+    assert(Valid());
+    return key_pinned_;
+  }
 
   virtual void Next() {
     assert(Valid());
+    prev_index_ = -1;
     ParseNextKey();
   }
 
   virtual void Prev() {
     assert(Valid());
 
+    if (prev_index_ > 0) {
+      // Previous entry is in the same restart interval and already decoded
+      prev_index_--;
+      SetCurrentFromCache();
+      return;
+    }
+
     // Scan backwards to a restart point before current_
     const uint32_t original = current_;
     while (GetRestartPoint(restart_index_) >= original) {
@@ -146,15 +182,13 @@ class Block::Iter : public Iterator {
         // No more entries
         current_ = restarts_;
         restart_index_ = num_restarts_;
+        prev_index_ = -1;
         return;
       }
       restart_index_--;
     }
 
-    SeekToRestartPoint(restart_index_);
-    do {
-      // Loop until end of current entry hits the start of original entry
-    } while (ParseNextKey() && NextEntryOffset() < original);
+    FillPrevCache(original);
   }
 
   virtual void Seek(const Slice& target) {
@@ -203,10 +237,8 @@ class Block::Iter : public Iterator {
   }
 
   virtual void SeekToLast() {
-    SeekToRestartPoint(num_restarts_ - 1);
-    while (ParseNextKey() && NextEntryOffset() < restarts_) {
-      // Keep skipping
-    }
+    restart_index_ = num_restarts_ - 1;
+    FillPrevCache(restarts_);
   }
 
  private:
@@ -215,6 +247,8 @@ class Block::Iter : public Iterator {
     restart_index_ = num_restarts_;
     status_ = Status::Corruption("bad entry in block");
     key_.clear();
+    key_pinned_ = false;
+    prev_index_ = -1;
     value_.clear();
   }
 
@@ -236,8 +270,21 @@ class Block::Iter : public Iterator {
       CorruptionError();
       return false;
     } else {
-      key_.resize(shared);
-      key_.append(p, non_shared);
+      if (shared == 0) {
+        // Key is stored in full, so refer to it in place
+        key_ = Slice(p, non_shared);
+        key_pinned_ = true;
+      } else {
+        if (key_.data() != key_buf_.data()) {
+          // Previous key lives in data_ or prev_keys_
+          key_buf_.assign(key_.data(), shared);
+        } else {
+          key_buf_.resize(shared);
+        }
+        key_buf_.append(p, non_shared);
+        key_ = key_buf_;
+        key_pinned_ = false;
+      }
       value_ = Slice(p + non_shared, value_length);
       while (restart_index_ + 1 < num_restarts_ &&
              GetRestartPoint(restart_index_ + 1) < current_) {
@@ -246,6 +293,43 @@ class Block::Iter : public Iterator {
       return true;
     }
   }
+
+  // Parses the restart interval starting at restart_index_ up to the
+  // entry that ends at or after "limit" and leaves the iterator there.
+  // Every parsed entry is remembered so that Prev() can step back
+  // through the interval cheaply.
+  void FillPrevCache(uint32_t limit) {
+    SeekToRestartPoint(restart_index_);
+    prev_entries_.clear();
+    prev_keys_.clear();
+    while (ParseNextKey()) {
+      CachedEntry entry;
+      entry.offset = current_;
+      entry.key_size = key_.size();
+      entry.key_pinned = key_pinned_;
+      if (key_pinned_) {
+        entry.key_offset = key_.data() - data_;
+      } else {
+        entry.key_offset = prev_keys_.size();
+        prev_keys_.append(key_.data(), key_.size());
+      }
+      entry.value = value_;
+      prev_entries_.push_back(entry);
+      if (NextEntryOffset() >= limit) {
+        prev_index_ = prev_entries_.size() - 1;
+        break;
+      }
+    }
+  }
+
+  void SetCurrentFromCache() {
+    const CachedEntry& entry = prev_entries_[prev_index_];
+    current_ = entry.offset;
+    key_pinned_ = entry.key_pinned;
+    key_ = Slice((key_pinned_ ? data_ : prev_keys_.data()) + entry.key_offset,
+                 entry.key_size);
+    value_ = entry.value;
+  }
 };
 
 Iterator* Block::NewIterator(const Comparator* cmp) {
@@ -11,17 +11,20 @@
 
 namespace leveldb {
 
+struct BlockContents;
 class Comparator;
 
 class Block {
  public:
-  // Initialize the block with the specified contents.
-  // Takes ownership of data[] and will delete[] it when done.
-  Block(const char* data, size_t size);
+  // Initialize the block with the specified contents.  Takes ownership
+  // of contents.data if contents.heap_allocated is set, otherwise the
+  // data must outlive the block.
+  explicit Block(const BlockContents& contents);
 
   ~Block();
 
   size_t size() const { return size_; }
+  Slice contents() const { return Slice(data_, size_); }
   Iterator* NewIterator(const Comparator* comparator);
 
  private:
@@ -30,6 +33,7 @@ class Block {
   const char* data_;
   size_t size_;
   uint32_t restart_offset_;     // Offset in data_ of restart array
+  bool owned_;                  // Block owns data_[]
 
   // No copying allowed
   Block(const Block&);
@@ -19,7 +19,8 @@
 //     value_length: varint32
 //     key_delta: char[unshared_bytes]
 //     value: char[value_length]
-// shared_bytes == 0 for restart points.
+// shared_bytes == 0 for restart points, and for every entry when
+// Options::block_delta_encoding is false.
 //
 // The trailer of the block has the form:
 //     restarts: uint32[num_restarts]
@@ -78,10 +79,12 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
          || options_->comparator->Compare(key, last_key_piece) > 0);
   size_t shared = 0;
   if (counter_ < options_->block_restart_interval) {
-    // See how much sharing to do with previous string
-    const size_t min_length = std::min(last_key_piece.size(), key.size());
-    while ((shared < min_length) && (last_key_piece[shared] == key[shared])) {
-      shared++;
+    if (options_->block_delta_encoding) {
+      // See how much sharing to do with previous string
+      const size_t min_length = std::min(last_key_piece.size(), key.size());
+      while ((shared < min_length) && (last_key_piece[shared] == key[shared])) {
+        shared++;
+      }
     }
   } else {
     // Restart compression
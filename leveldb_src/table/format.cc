@@ -4,6 +4,8 @@
 
 #include "table/format.h"
 
+#include <string.h>
+
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "table/block.h"
@@ -63,11 +65,30 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
+// "data" holds n bytes of block contents followed by the block trailer.
+static Status CheckBlockTrailer(const ReadOptions& options,
+                                const char* data, size_t n) {
+  if (options.verify_checksums) {
+    const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
+    const uint32_t actual = crc32c::Value(data, n + 1);
+    if (actual != crc) {
+      return Status::Corruption("block checksum mismatch");
+    }
+  }
+  return Status::OK();
+}
+
 Status ReadBlock(RandomAccessFile* file,
                  const ReadOptions& options,
                  const BlockHandle& handle,
-                 Block** block) {
-  *block = NULL;
+                 BlockContents* result,
+                 std::string* compressed) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+  if (compressed != NULL) {
+    compressed->clear();
+  }
 
   // Read the block contents as well as the type/crc footer.
   // See table_builder.cc for the code that built this structure.
@@ -86,41 +107,39 @@ Status ReadBlock(RandomAccessFile* file,
 
   // Check the crc of the type and the block contents
   const char* data = contents.data();    // Pointer to where Read put the data
-  if (options.verify_checksums) {
-    const uint32_t crc = crc32c::Unmask(DecodeFixed32(data + n + 1));
-    const uint32_t actual = crc32c::Value(data, n + 1);
-    if (actual != crc) {
-      delete[] buf;
-      s = Status::Corruption("block checksum mismatch");
-      return s;
-    }
+  s = CheckBlockTrailer(options, data, n);
+  if (!s.ok()) {
+    delete[] buf;
+    return s;
   }
 
   switch (data[n]) {
     case kNoCompression:
       if (data != buf) {
         // File implementation gave us pointer to some other data.
-        // Copy into buf[].
-        memcpy(buf, data, n + kBlockTrailerSize);
+        // Use it directly under the assumption that it will be live
+        // while the file is open.
+        delete[] buf;
+        result->data = Slice(data, n);
+        result->heap_allocated = false;
+        result->cachable = false;  // Do not double-cache
+      } else {
+        result->data = Slice(buf, n);
+        result->heap_allocated = true;
+        result->cachable = true;
       }
 
       // Ok
       break;
     case kSnappyCompression: {
-      size_t ulength = 0;
-      if (!port::Snappy_GetUncompressedLength(data, n, &ulength)) {
-        delete[] buf;
-        return Status::Corruption("corrupted compressed block contents");
-      }
-      char* ubuf = new char[ulength];
-      if (!port::Snappy_Uncompress(data, n, ubuf)) {
-        delete[] buf;
-        delete[] ubuf;
-        return Status::Corruption("corrupted compressed block contents");
+      if (compressed != NULL) {
+        compressed->assign(data, n);
       }
+      s = UncompressBlockContents(Slice(data, n), result);
       delete[] buf;
-      buf = ubuf;
-      n = ulength;
+      if (!s.ok()) {
+        return s;
+      }
       break;
     }
     default:
@@ -128,7 +147,56 @@ Status ReadBlock(RandomAccessFile* file,
       return Status::Corruption("bad block type");
   }
 
-  *block = new Block(buf, n);  // Block takes ownership of buf[]
+  return Status::OK();
+}
+
+Status DecodeBlock(const ReadOptions& options,
+                   const Slice& raw,
+                   BlockContents* result) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+  if (raw.size() < kBlockTrailerSize) {
+    return Status::Corruption("truncated block read");
+  }
+  const size_t n = raw.size() - kBlockTrailerSize;
+  const char* data = raw.data();
+  Status s = CheckBlockTrailer(options, data, n);
+  if (!s.ok()) {
+    return s;
+  }
+
+  switch (data[n]) {
+    case kNoCompression: {
+      char* buf = new char[n];
+      memcpy(buf, data, n);
+      result->data = Slice(buf, n);
+      result->heap_allocated = true;
+      result->cachable = true;
+      break;
+    }
+    case kSnappyCompression:
+      return UncompressBlockContents(Slice(data, n), result);
+    default:
+      return Status::Corruption("bad block type");
+  }
+  return Status::OK();
+}
+
+Status UncompressBlockContents(const Slice& input, BlockContents* result) {
+  size_t ulength = 0;
+  if (!port::Snappy_GetUncompressedLength(input.data(), input.size(),
+                                          &ulength)) {
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  char* ubuf = new char[ulength];
+  if (!port::Snappy_Uncompress(input.data(), input.size(), ubuf)) {
+    delete[] ubuf;
+    return Status::Corruption("corrupted compressed block contents");
+  }
+  result->data = Slice(ubuf, ulength);
+  result->heap_allocated = true;
+  result->cachable = true;
   return Status::OK();
 }
 
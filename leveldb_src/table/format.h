@@ -83,13 +83,37 @@ static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
-// Read the block identified by "handle" from "file".  On success,
-// store a pointer to the heap-allocated result in *block and return
-// OK.  On failure store NULL in *block and return non-OK.
+struct BlockContents {
+  Slice data;           // Actual contents of data
+  bool cachable;        // True iff data can be cached
+  bool heap_allocated;  // True iff caller should delete[] data.data()
+};
+
+// Read the block identified by "handle" from "file".  On success fill
+// *result and return OK.  Uncompressed contents that "file" already
+// holds in memory (e.g. a memory-mapped file) are referenced in place
+// rather than copied; such contents are neither heap allocated nor
+// worth caching.  If "compressed" is non-NULL and the block is stored
+// compressed, the raw compressed bytes are also copied into *compressed
+// (otherwise *compressed is cleared).  On failure return non-OK.
 extern Status ReadBlock(RandomAccessFile* file,
                         const ReadOptions& options,
                         const BlockHandle& handle,
-                        Block** block);
+                        BlockContents* result,
+                        std::string* compressed = NULL);
+
+// Like ReadBlock(), but for a block whose contents and trailer were
+// already read into "raw" as part of a larger read.  The result never
+// points into "raw", which may be discarded afterwards.
+extern Status DecodeBlock(const ReadOptions& options,
+                          const Slice& raw,
+                          BlockContents* result);
+
+// Decompress the snappy-compressed block contents in "input" into a
+// newly allocated buffer and store it in *result.  On failure return
+// non-OK.
+extern Status UncompressBlockContents(const Slice& input,
+                                      BlockContents* result);
 
 // Implementation details follow.  Clients should ignore,
 
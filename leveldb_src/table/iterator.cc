@@ -38,6 +38,10 @@ void Iterator::RegisterCleanup(CleanupFunction func, void* arg1, void* arg2) {
   c->arg2 = arg2;
 }
 
+bool Iterator::IsKeyPinned() const {
+  return false;
+}
+
 namespace {
 class EmptyIterator : public Iterator {
  public:
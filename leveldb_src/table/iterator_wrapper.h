@@ -32,6 +32,14 @@ class IteratorWrapper {
     }
   }
 
+  // Returns the wrapped iterator without deleting it and leaves this
+  // wrapper empty.  The caller takes ownership of the result.
+  Iterator* Release() {
+    Iterator* result = iter_;
+    iter_ = NULL;
+    valid_ = false;
+    return result;
+  }
 
   // Iterator interface methods
   bool Valid() const        { return valid_; }
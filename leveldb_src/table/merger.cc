@@ -132,6 +132,11 @@ class MergingIterator : public Iterator {
     return status;
   }
 
+  virtual bool IsKeyPinned() const {
+    assert(Valid());
+    return current_->iter()->IsKeyPinned();
+  }
+
  private:
   void FindSmallest();
   void FindLargest();
@@ -0,0 +1,57 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef STORAGE_LEVELDB_TABLE_PERSIST_TARGET_H_
+#define STORAGE_LEVELDB_TABLE_PERSIST_TARGET_H_
+
+#include "leveldb/persistent_cache.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+// The persistent cache that blocks are written to when the block cache
+// evicts them.  It is shared by whoever owns the keys of the blocks (a
+// single table, or all tables of a DB) and by their blocks in the block
+// cache, which may be evicted after the owner is gone.  The owner closes
+// it when nothing can look its blocks up any more, so later evictions
+// (including those done while the block cache is deleted) are not
+// written.
+class PersistTarget {
+ public:
+  explicit PersistTarget(PersistentCache* cache) : cache_(cache), refs_(1) { }
+
+  void Ref() { port::AtomicAdd(&refs_, 1); }
+  void Unref() {
+    if (port::AtomicAdd(&refs_, -1) == 0) {
+      delete this;
+    }
+  }
+
+  // Called when the owner of the keys goes away
+  void Close() {
+    MutexLock l(&mu_);
+    cache_ = NULL;
+  }
+
+  void Insert(const Slice& key, const Slice& contents) {
+    MutexLock l(&mu_);
+    if (cache_ != NULL) {
+      cache_->Insert(key, contents);
+    }
+  }
+
+ private:
+  port::Mutex mu_;
+  PersistentCache* cache_;      // NULL once closed
+  volatile int refs_;           // Updated with port::AtomicAdd()
+
+  // No copying allowed
+  PersistTarget(const PersistTarget&);
+  void operator=(const PersistTarget&);
+};
+
+}
+
+#endif  // STORAGE_LEVELDB_TABLE_PERSIST_TARGET_H_
@@ -4,17 +4,34 @@
 
 #include "leveldb/table.h"
 
+#include <string.h>
+#include <algorithm>
 #include "leveldb/cache.h"
 #include "leveldb/env.h"
+#include "leveldb/persistent_cache.h"
+#include "port/port.h"
 #include "table/block.h"
 #include "table/format.h"
+#include "table/persist_target.h"
 #include "table/two_level_iterator.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
+// Number of bytes read from the end of a table file when it is opened.
+// Large enough to hold the footer and the index block of a table built
+// with the default options.
+static const size_t kTailPrefetchSize = 64 << 10;
+
 struct Table::Rep {
   ~Rep() {
+    if (persist_target != NULL) {
+      if (owns_persist_target) {
+        persist_target->Close();
+      }
+      persist_target->Unref();
+    }
     delete index_block;
   }
 
@@ -22,6 +39,13 @@ struct Table::Rep {
   Status status;
   RandomAccessFile* file;
   uint64_t cache_id;
+  uint64_t compressed_cache_id;
+  // Blocks are kept in the persistent cache under
+  // (persistent_cache_id, file_number, offset)
+  uint64_t persistent_cache_id;
+  uint64_t file_number;
+  PersistTarget* persist_target;  // NULL without a persistent cache
+  bool owns_persist_target;       // Closed along with the table
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
@@ -31,26 +55,77 @@ Status Table::Open(const Options& options,
                    RandomAccessFile* file,
                    uint64_t size,
                    Table** table) {
+  if (options.persistent_cache == NULL) {
+    return Open(options, file, size, 0, 0, NULL, table);
+  }
+  // Nothing but this table can find its blocks again
+  PersistTarget* target = new PersistTarget(options.persistent_cache);
+  Status s = Open(options, file, size, options.persistent_cache->NewId(), 0,
+                  target, table);
+  if (s.ok()) {
+    (*table)->rep_->owns_persist_target = true;
+  }
+  target->Unref();
+  return s;
+}
+
+Status Table::Open(const Options& options,
+                   RandomAccessFile* file,
+                   uint64_t size,
+                   uint64_t persistent_cache_id,
+                   uint64_t file_number,
+                   PersistTarget* persist_target,
+                   Table** table) {
   *table = NULL;
   if (size < Footer::kEncodedLength) {
     return Status::InvalidArgument("file is too short to be an sstable");
   }
 
-  char footer_space[Footer::kEncodedLength];
-  Slice footer_input;
-  Status s = file->Read(size - Footer::kEncodedLength, Footer::kEncodedLength,
-                        &footer_input, footer_space);
-  if (!s.ok()) return s;
+  // Read the footer together with the end of the file, which is where
+  // the index block lives, so that opening a table normally costs a
+  // single read.
+  const size_t tail_size =
+      static_cast<size_t>(std::min<uint64_t>(size, kTailPrefetchSize));
+  const uint64_t tail_offset = size - tail_size;
+  char* tail_space = new char[tail_size];
+  Slice tail;
+  Status s = file->Read(tail_offset, tail_size, &tail, tail_space);
+  if (s.ok() && tail.size() != tail_size) {
+    s = Status::Corruption("truncated table footer read");
+  }
 
   Footer footer;
-  s = footer.DecodeFrom(&footer_input);
-  if (!s.ok()) return s;
+  if (s.ok()) {
+    Slice footer_input(tail.data() + tail_size - Footer::kEncodedLength,
+                       Footer::kEncodedLength);
+    s = footer.DecodeFrom(&footer_input);
+  }
 
-  // Read the index block
+  // Read the index block, from the tail if it was covered by it
+  BlockContents contents;
   Block* index_block = NULL;
   if (s.ok()) {
-    s = ReadBlock(file, ReadOptions(), footer.index_handle(), &index_block);
+    const BlockHandle& handle = footer.index_handle();
+    const uint64_t n = handle.size() + kBlockTrailerSize;
+    if (tail.data() == tail_space &&
+        handle.offset() >= tail_offset &&
+        handle.offset() - tail_offset <= tail_size &&
+        n <= tail_size - (handle.offset() - tail_offset)) {
+      s = DecodeBlock(ReadOptions(),
+                      Slice(tail.data() + (handle.offset() - tail_offset),
+                            static_cast<size_t>(n)),
+                      &contents);
+    } else {
+      // Either the index block is larger than the prefetched tail or
+      // "file" handed out data it holds in memory, in which case the
+      // block can be referenced there without a copy.
+      s = ReadBlock(file, ReadOptions(), handle, &contents);
+    }
+    if (s.ok()) {
+      index_block = new Block(contents);
+    }
   }
+  delete[] tail_space;
 
   if (s.ok()) {
     // We've successfully read the footer and the index block: we're
@@ -61,6 +136,15 @@ Status Table::Open(const Options& options,
     rep->metaindex_handle = footer.metaindex_handle();
     rep->index_block = index_block;
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+    rep->compressed_cache_id = (options.block_cache_compressed ?
+                                options.block_cache_compressed->NewId() : 0);
+    rep->persistent_cache_id = persistent_cache_id;
+    rep->file_number = file_number;
+    rep->persist_target = persist_target;
+    rep->owns_persist_target = false;
+    if (persist_target != NULL) {
+      persist_target->Ref();
+    }
     *table = new Table(rep);
   } else {
     if (index_block) delete index_block;
@@ -88,6 +172,101 @@ static void ReleaseBlock(void* arg, void* h) {
   cache->Release(handle);
 }
 
+static void DeleteCachedCompressedBlock(const Slice& key, void* value) {
+  std::string* raw = reinterpret_cast<std::string*>(value);
+  delete raw;
+}
+
+// Read the block identified by "handle", consulting the compressed block
+// cache (if any) before going to the file.  Compressed blocks read from
+// the file are added to the compressed block cache.
+static Status ReadBlockFromCompressedCache(Cache* compressed_cache,
+                                           uint64_t cache_id,
+                                           RandomAccessFile* file,
+                                           const ReadOptions& options,
+                                           const BlockHandle& handle,
+                                           BlockContents* contents) {
+  if (compressed_cache == NULL) {
+    return ReadBlock(file, options, handle, contents);
+  }
+
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, cache_id);
+  EncodeFixed64(cache_key_buffer+8, handle.offset());
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  Cache::Handle* cache_handle = compressed_cache->Lookup(key);
+  if (cache_handle != NULL) {
+    const std::string* raw = reinterpret_cast<const std::string*>(
+        compressed_cache->Value(cache_handle));
+    Status s = UncompressBlockContents(*raw, contents);
+    compressed_cache->Release(cache_handle);
+    return s;
+  }
+
+  // Only keep the compressed bytes if they are going to be cached
+  std::string raw;
+  Status s = ReadBlock(file, options, handle, contents,
+                       options.fill_cache ? &raw : NULL);
+  if (s.ok() && !raw.empty()) {
+    std::string* cached = new std::string;
+    cached->swap(raw);
+    compressed_cache->Release(compressed_cache->Insert(
+        key, cached, cached->size(), &DeleteCachedCompressedBlock));
+  }
+  return s;
+}
+
+// A block in the block cache that is written to the persistent cache
+// when the block cache evicts it.  The persistent cache only copies the
+// block into a buffer; its files are written by a thread of its own,
+// since the block cache calls the deleter on the reading thread, with
+// the cache locked.
+class PersistedBlock : public Block {
+ public:
+  PersistedBlock(const BlockContents& contents, PersistTarget* target,
+                 const Slice& key)
+      : Block(contents),
+        target_(target),
+        key_(key.data(), key.size()) {
+    target_->Ref();
+  }
+
+  ~PersistedBlock() {
+    target_->Unref();
+  }
+
+  void Persist() const {
+    if (size() > 0) {
+      target_->Insert(key_, contents());
+    }
+  }
+
+ private:
+  PersistTarget* target_;
+  std::string key_;
+};
+
+static void DeletePersistedBlock(const Slice& key, void* value) {
+  PersistedBlock* block = static_cast<PersistedBlock*>(
+      reinterpret_cast<Block*>(value));
+  block->Persist();
+  delete block;
+}
+
+static bool LookupPersistentCache(PersistentCache* cache, const Slice& key,
+                                  BlockContents* contents) {
+  std::string data;
+  if (!cache->Lookup(key, &data)) {
+    return false;
+  }
+  char* buf = new char[data.size()];
+  memcpy(buf, data.data(), data.size());
+  contents->data = Slice(buf, data.size());
+  contents->cachable = true;
+  contents->heap_allocated = true;
+  return true;
+}
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
@@ -95,6 +274,7 @@ Iterator* Table::BlockReader(void* arg,
                              const Slice& index_value) {
   Table* table = reinterpret_cast<Table*>(arg);
   Cache* block_cache = table->rep_->options.block_cache;
+  Cache* compressed_cache = table->rep_->options.block_cache_compressed;
   Block* block = NULL;
   Cache::Handle* cache_handle = NULL;
 
@@ -105,6 +285,7 @@ Iterator* Table::BlockReader(void* arg,
   // can add more features in the future.
 
   if (s.ok()) {
+    BlockContents contents;
     if (block_cache != NULL) {
       char cache_key_buffer[16];
       EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
@@ -114,14 +295,48 @@ Iterator* Table::BlockReader(void* arg,
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &block);
-        if (s.ok() && options.fill_cache) {
-          cache_handle = block_cache->Insert(
-              key, block, block->size(), &DeleteCachedBlock);
+        PersistentCache* persistent_cache =
+            table->rep_->options.persistent_cache;
+        char persistent_key_buffer[24];
+        EncodeFixed64(persistent_key_buffer, table->rep_->persistent_cache_id);
+        EncodeFixed64(persistent_key_buffer+8, table->rep_->file_number);
+        EncodeFixed64(persistent_key_buffer+16, handle.offset());
+        Slice persistent_key(persistent_key_buffer,
+                             sizeof(persistent_key_buffer));
+        if (persistent_cache == NULL ||
+            !LookupPersistentCache(persistent_cache, persistent_key,
+                                   &contents)) {
+          s = ReadBlockFromCompressedCache(compressed_cache,
+                                           table->rep_->compressed_cache_id,
+                                           table->rep_->file, options, handle,
+                                           &contents);
+        }
+        if (s.ok()) {
+          if (contents.cachable && options.fill_cache) {
+            if (persistent_cache != NULL) {
+              block = new PersistedBlock(contents,
+                                         table->rep_->persist_target,
+                                         persistent_key);
+              cache_handle = block_cache->Insert(
+                  key, block, block->size(), &DeletePersistedBlock);
+            } else {
+              block = new Block(contents);
+              cache_handle = block_cache->Insert(
+                  key, block, block->size(), &DeleteCachedBlock);
+            }
+          } else {
+            block = new Block(contents);
+          }
         }
       }
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &block);
+      s = ReadBlockFromCompressedCache(compressed_cache,
+                                       table->rep_->compressed_cache_id,
+                                       table->rep_->file, options, handle,
+                                       &contents);
+      if (s.ok()) {
+        block = new Block(contents);
+      }
     }
   }
 
@@ -142,7 +357,8 @@ Iterator* Table::BlockReader(void* arg,
 Iterator* Table::NewIterator(const ReadOptions& options) const {
   return NewTwoLevelIterator(
       rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+      &Table::BlockReader, const_cast<Table*>(this), options,
+      rep_->options.env);
 }
 
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
@@ -9,10 +9,13 @@
 #include "db/dbformat.h"
 #include "db/memtable.h"
 #include "db/write_batch_internal.h"
+#include "leveldb/cache.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "leveldb/persistent_cache.h"
 #include "leveldb/table_builder.h"
+#include "port/port.h"
 #include "table/block.h"
 #include "table/block_builder.h"
 #include "table/format.h"
@@ -110,15 +113,18 @@ class StringSink: public WritableFile {
 class StringSource: public RandomAccessFile {
  public:
   StringSource(const Slice& contents)
-      : contents_(contents.data(), contents.size()) {
+      : contents_(contents.data(), contents.size()),
+        reads_(0) {
   }
 
   virtual ~StringSource() { }
 
   uint64_t Size() const { return contents_.size(); }
+  int reads() const { return port::AtomicAdd(&reads_, 0); }
 
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                        char* scratch) const {
+    port::AtomicAdd(&reads_, 1);  // Prefetches read from other threads
     if (offset > contents_.size()) {
       return Status::InvalidArgument("invalid Read offset");
     }
@@ -132,6 +138,7 @@ class StringSource: public RandomAccessFile {
 
  private:
   std::string contents_;
+  mutable volatile int reads_;
 };
 
 typedef std::map<std::string, std::string, STLLessThan> KVMap;
@@ -185,7 +192,6 @@ class BlockConstructor: public Constructor {
   explicit BlockConstructor(const Comparator* cmp)
       : Constructor(cmp),
         comparator_(cmp),
-        block_size_(-1),
         block_(NULL) { }
   ~BlockConstructor() {
     delete block_;
@@ -201,14 +207,15 @@ class BlockConstructor: public Constructor {
       builder.Add(it->first, it->second);
     }
     // Open the block
-    Slice block_data = builder.Finish();
-    block_size_ = block_data.size();
-    char* block_data_copy = new char[block_size_];
-    memcpy(block_data_copy, block_data.data(), block_size_);
-    block_ = new Block(block_data_copy, block_size_);
+    data_ = builder.Finish().ToString();
+    BlockContents contents;
+    contents.data = data_;
+    contents.cachable = false;
+    contents.heap_allocated = false;
+    block_ = new Block(contents);
     return Status::OK();
   }
-  virtual size_t NumBytes() const { return block_size_; }
+  virtual size_t NumBytes() const { return data_.size(); }
 
   virtual Iterator* NewIterator() const {
     return block_->NewIterator(comparator_);
@@ -216,7 +223,7 @@ class BlockConstructor: public Constructor {
 
  private:
   const Comparator* comparator_;
-  int block_size_;
+  std::string data_;
   Block* block_;
 
   BlockConstructor();
@@ -263,6 +270,8 @@ class TableConstructor: public Constructor {
     return table_->ApproximateOffsetOf(key);
   }
 
+  Table* table() const { return table_; }
+
  private:
   void Reset() {
     delete table_;
@@ -423,30 +432,35 @@ struct TestArgs {
   TestType type;
   bool reverse_compare;
   int restart_interval;
+  bool delta_encoding;
 };
 
 static const TestArgs kTestArgList[] = {
-  { TABLE_TEST, false, 16 },
-  { TABLE_TEST, false, 1 },
-  { TABLE_TEST, false, 1024 },
-  { TABLE_TEST, true, 16 },
-  { TABLE_TEST, true, 1 },
-  { TABLE_TEST, true, 1024 },
-
-  { BLOCK_TEST, false, 16 },
-  { BLOCK_TEST, false, 1 },
-  { BLOCK_TEST, false, 1024 },
-  { BLOCK_TEST, true, 16 },
-  { BLOCK_TEST, true, 1 },
-  { BLOCK_TEST, true, 1024 },
+  { TABLE_TEST, false, 16, true },
+  { TABLE_TEST, false, 1, true },
+  { TABLE_TEST, false, 1024, true },
+  { TABLE_TEST, true, 16, true },
+  { TABLE_TEST, true, 1, true },
+  { TABLE_TEST, true, 1024, true },
+  { TABLE_TEST, false, 16, false },
+  { TABLE_TEST, true, 16, false },
+
+  { BLOCK_TEST, false, 16, true },
+  { BLOCK_TEST, false, 1, true },
+  { BLOCK_TEST, false, 1024, true },
+  { BLOCK_TEST, true, 16, true },
+  { BLOCK_TEST, true, 1, true },
+  { BLOCK_TEST, true, 1024, true },
+  { BLOCK_TEST, false, 16, false },
+  { BLOCK_TEST, true, 16, false },
 
   // Restart interval does not matter for memtables
-  { MEMTABLE_TEST, false, 16 },
-  { MEMTABLE_TEST, true, 16 },
+  { MEMTABLE_TEST, false, 16, true },
+  { MEMTABLE_TEST, true, 16, true },
 
   // Do not bother with restart interval variations for DB
-  { DB_TEST, false, 16 },
-  { DB_TEST, true, 16 },
+  { DB_TEST, false, 16, true },
+  { DB_TEST, true, 16, true },
 };
 static const int kNumTestArgs = sizeof(kTestArgList) / sizeof(kTestArgList[0]);
 
@@ -460,6 +474,7 @@ class Harness {
     options_ = Options();
 
     options_.block_restart_interval = args.restart_interval;
+    options_.block_delta_encoding = args.delta_encoding;
     // Use shorter block size for tests to exercise block boundary
     // conditions more.
     options_.block_size = 256;
@@ -813,6 +828,157 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
 
 }
 
+TEST(TableTest, PrefetchBlocks) {
+  TableConstructor c(BytewiseComparator());
+  char buf[20];
+  for (int i = 0; i < 1000; i++) {
+    snprintf(buf, sizeof(buf), "k%06d", i);
+    c.Add(buf, std::string(100, 'a' + (i % 26)));
+  }
+  std::vector<std::string> keys;
+  KVMap kvmap;
+  Options options;
+  options.block_size = 256;
+  options.compression = kNoCompression;
+  c.Finish(options, &keys, &kvmap);
+
+  for (int n = 1; n <= 3; n++) {
+    ReadOptions prefetch;
+    prefetch.prefetch_blocks = n;
+    Iterator* iter = c.table()->NewIterator(prefetch);
+    Iterator* model = c.table()->NewIterator(ReadOptions());
+
+    // Full forward scan
+    int count = 0;
+    for (iter->SeekToFirst(), model->SeekToFirst();
+         model->Valid();
+         iter->Next(), model->Next()) {
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(model->key().ToString(), iter->key().ToString());
+      ASSERT_EQ(model->value().ToString(), iter->value().ToString());
+      count++;
+    }
+    ASSERT_TRUE(!iter->Valid());
+    ASSERT_EQ(1000, count);
+
+    // Seeks, and changes of direction while reads are in flight
+    iter->Seek("k000500");
+    model->Seek("k000500");
+    for (int i = 0; i < 100; i++) {
+      ASSERT_EQ(model->key().ToString(), iter->key().ToString());
+      if (i % 30 < 20) {
+        iter->Next();
+        model->Next();
+      } else {
+        iter->Prev();
+        model->Prev();
+      }
+    }
+    ASSERT_EQ(model->key().ToString(), iter->key().ToString());
+    ASSERT_TRUE(iter->status().ok());
+
+    // Delete while reads may still be outstanding
+    iter->Seek("k000100");
+    delete iter;
+    delete model;
+  }
+}
+
+TEST(TableTest, OpenReadsFooterAndIndexTogether) {
+  // Small index: read along with the footer.  Large index (long keys,
+  // tiny blocks): does not fit in the prefetched tail and needs its own
+  // read.
+  const int kKeyLength[2] = { 10, 1000 };
+  for (int t = 0; t < 2; t++) {
+    Options options;
+    options.block_size = 256;
+    options.compression = kNoCompression;
+    StringSink sink;
+    TableBuilder builder(options, &sink);
+    char buf[20];
+    for (int i = 0; i < 1000; i++) {
+      snprintf(buf, sizeof(buf), "k%06d", i);
+      builder.Add(std::string(buf) + std::string(kKeyLength[t], 'x'), "v");
+    }
+    ASSERT_OK(builder.Finish());
+
+    StringSource source(sink.contents());
+    Table* table = NULL;
+    ASSERT_OK(Table::Open(Options(), &source, sink.contents().size(),
+                          &table));
+    ASSERT_EQ(t + 1, source.reads());
+
+    Iterator* iter = table->NewIterator(ReadOptions());
+    int i = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+      snprintf(buf, sizeof(buf), "k%06d", i);
+      ASSERT_EQ(std::string(buf) + std::string(kKeyLength[t], 'x'),
+                iter->key().ToString());
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_EQ(1000, i);
+    delete iter;
+    delete table;
+  }
+}
+
+TEST(TableTest, PersistentCache) {
+  Options options;
+  options.block_size = 1024;
+  options.compression = kNoCompression;
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  char buf[20];
+  for (int i = 0; i < 100; i++) {
+    snprintf(buf, sizeof(buf), "k%06d", i);
+    builder.Add(buf, std::string(500, 'a' + (i % 26)));
+  }
+  ASSERT_OK(builder.Finish());
+
+  // Large enough that every block stays in the cache's first segment,
+  // which is not written out in the background
+  PersistentCache* persistent_cache;
+  ASSERT_OK(NewPersistentCache(Env::Default(),
+                               test::TmpDir() + "/table_persistent_cache",
+                               1 << 20, &persistent_cache));
+  StringSource source(sink.contents());
+  Options table_options;
+  table_options.block_cache = NewLRUCache(1);  // Evicts every block
+  table_options.persistent_cache = persistent_cache;
+  Table* table = NULL;
+  ASSERT_OK(Table::Open(table_options, &source, sink.contents().size(),
+                        &table));
+
+  // The first scan reads every block from the file and leaves it in the
+  // persistent cache as the block cache evicts it; the second scan is
+  // served from the persistent cache.
+  int reads_after_open = source.reads();
+  for (int pass = 0; pass < 2; pass++) {
+    Iterator* iter = table->NewIterator(ReadOptions());
+    int i = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+      snprintf(buf, sizeof(buf), "k%06d", i);
+      ASSERT_EQ(buf, iter->key().ToString());
+      ASSERT_EQ(std::string(500, 'a' + (i % 26)), iter->value().ToString());
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_EQ(100, i);
+    delete iter;
+    if (pass == 0) {
+      ASSERT_GT(source.reads(), reads_after_open + 1);
+      reads_after_open = source.reads();
+    } else {
+      ASSERT_EQ(reads_after_open, source.reads());
+    }
+  }
+
+  // The blocks still in the block cache are not persisted once their
+  // table is closed, so the persistent cache may go first
+  delete table;
+  delete persistent_cache;
+  delete table_options.block_cache;
+}
+
 static bool SnappyCompressionSupported() {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
@@ -847,6 +1013,79 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"),    4000,   6000));
 }
 
+TEST(TableTest, CompressedBlockCache) {
+  if (!SnappyCompressionSupported()) {
+    fprintf(stderr, "skipping compression tests\n");
+    return;
+  }
+
+  Random rnd(301);
+  Options options;
+  options.block_size = 1024;
+  options.compression = kSnappyCompression;
+  StringSink sink;
+  TableBuilder builder(options, &sink);
+  std::vector<std::string> values;
+  std::string tmp;
+  char buf[20];
+  for (int i = 0; i < 100; i++) {
+    snprintf(buf, sizeof(buf), "k%06d", i);
+    test::CompressibleString(&rnd, 0.25, 1000, &tmp);
+    values.push_back(tmp);
+    builder.Add(buf, tmp);
+  }
+  ASSERT_OK(builder.Finish());
+
+  StringSource source(sink.contents());
+  Cache* compressed_cache = NewLRUCache(1 << 20);
+  Options table_options;
+  table_options.block_cache_compressed = compressed_cache;
+  Table* table = NULL;
+  ASSERT_OK(Table::Open(table_options, &source, sink.contents().size(),
+                        &table));
+
+  // The first scan reads every block from the file; the second one is
+  // served entirely from the compressed block cache.
+  int reads_after_open = source.reads();
+  int reads_per_scan = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    Iterator* iter = table->NewIterator(ReadOptions());
+    int i = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), i++) {
+      snprintf(buf, sizeof(buf), "k%06d", i);
+      ASSERT_EQ(buf, iter->key().ToString());
+      ASSERT_EQ(values[i], iter->value().ToString());
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_EQ(100, i);
+    delete iter;
+    if (pass == 0) {
+      reads_per_scan = source.reads() - reads_after_open;
+      ASSERT_GT(reads_per_scan, 1);
+    } else {
+      ASSERT_EQ(reads_after_open + reads_per_scan, source.reads());
+    }
+  }
+
+  // Blocks read with fill_cache == false are not added to the cache.
+  delete table;
+  ASSERT_OK(Table::Open(table_options, &source, sink.contents().size(),
+                        &table));
+  ReadOptions no_fill;
+  no_fill.fill_cache = false;
+  for (int pass = 0; pass < 2; pass++) {
+    int before = source.reads();
+    Iterator* iter = table->NewIterator(no_fill);
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) { }
+    ASSERT_OK(iter->status());
+    delete iter;
+    ASSERT_EQ(before + reads_per_scan, source.reads());
+  }
+
+  delete table;
+  delete compressed_cache;
+}
+
 }
 
 int main(int argc, char** argv) {
@@ -4,7 +4,11 @@
 
 #include "table/two_level_iterator.h"
 
+#include <deque>
+#include <vector>
+#include "leveldb/env.h"
 #include "leveldb/table.h"
+#include "port/port.h"
 #include "table/block.h"
 #include "table/format.h"
 #include "table/iterator_wrapper.h"
@@ -15,13 +19,62 @@ namespace {
 
 typedef Iterator* (*BlockFunction)(void*, const ReadOptions&, const Slice&);
 
+// A data block read that runs in the background because the iterator
+// expects to need the block soon.  Shared by the iterator and the job
+// scheduled on the Env; whoever drops the last reference deletes it.
+// The job only reads the fields set before it was scheduled.
+struct Prefetch {
+  port::Mutex mu;
+  port::CondVar cv;
+  int refs;
+  bool cancelled;       // Set when the iterator no longer wants the block
+  bool running;         // The background job is calling block_function
+  bool done;            // The background job has finished
+  BlockFunction block_function;
+  void* arg;
+  ReadOptions options;
+  std::string key;      // Index entry of the block
+  std::string handle;
+  Iterator* result;
+
+  Prefetch() : cv(&mu), refs(2), cancelled(false), running(false),
+               done(false), result(NULL) { }
+};
+
+// Drops a reference to "p".  REQUIRES: p->mu is held; releases it.
+static void UnrefPrefetch(Prefetch* p) {
+  const bool last = (--p->refs == 0);
+  p->mu.Unlock();
+  if (last) {
+    delete p->result;
+    delete p;
+  }
+}
+
+static void RunPrefetch(void* arg) {
+  Prefetch* p = reinterpret_cast<Prefetch*>(arg);
+  p->mu.Lock();
+  if (!p->cancelled) {
+    p->running = true;
+    p->mu.Unlock();
+    Iterator* iter = (*p->block_function)(p->arg, p->options, p->handle);
+    p->mu.Lock();
+    p->result = iter;
+    p->running = false;
+  }
+  p->done = true;
+  p->cv.SignalAll();
+  UnrefPrefetch(p);
+}
+
 class TwoLevelIterator: public Iterator {
  public:
   TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    Env* env);
 
   virtual ~TwoLevelIterator();
 
@@ -52,6 +105,10 @@ class TwoLevelIterator: public Iterator {
       return status_;
     }
   }
+  virtual bool IsKeyPinned() const {
+    assert(Valid());
+    return options_.pin_data && data_iter_.iter()->IsKeyPinned();
+  }
 
  private:
   void SaveError(const Status& s) {
@@ -61,48 +118,79 @@ class TwoLevelIterator: public Iterator {
   void SkipEmptyDataBlocksBackward();
   void SetDataIterator(Iterator* data_iter);
   void InitDataBlock();
+  void SchedulePrefetches();
+  void RestoreIndex();
+  Iterator* TakePrefetch(Prefetch* p);
+  void DropPrefetch(Prefetch* p);
 
   BlockFunction block_function_;
   void* arg_;
   const ReadOptions options_;
+  Env* const env_;                      // Runs prefetches; may be NULL
   Status status_;
   IteratorWrapper index_iter_;
   IteratorWrapper data_iter_; // May be NULL
   // If data_iter_ is non-NULL, then "data_block_handle_" holds the
   // "index_value" passed to block_function_ to create the data_iter_.
   std::string data_block_handle_;
+  // Data iterators that were moved off of while options_.pin_data is set.
+  // They keep their blocks alive until this iterator is destroyed.
+  std::vector<Iterator*> pinned_iters_;
+  // Outstanding reads of the blocks following the current one, in
+  // index order.
+  std::deque<Prefetch*> prefetches_;
+  // While set, index_iter_ is not at the current block but at the one
+  // after the last block in prefetches_, and current_key_ holds the
+  // index key of the current block.
+  bool index_ahead_;
+  std::string current_key_;
 };
 
 TwoLevelIterator::TwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options)
+    const ReadOptions& options,
+    Env* env)
     : block_function_(block_function),
       arg_(arg),
       options_(options),
+      env_(options.prefetch_blocks > 0 ? env : NULL),
       index_iter_(index_iter),
-      data_iter_(NULL) {
+      data_iter_(NULL),
+      index_ahead_(false) {
 }
 
 TwoLevelIterator::~TwoLevelIterator() {
+  while (!prefetches_.empty()) {
+    DropPrefetch(prefetches_.front());
+    prefetches_.pop_front();
+  }
+  for (size_t i = 0; i < pinned_iters_.size(); i++) {
+    delete pinned_iters_[i];
+  }
 }
 
 void TwoLevelIterator::Seek(const Slice& target) {
+  index_ahead_ = false;
   index_iter_.Seek(target);
   InitDataBlock();
+  SchedulePrefetches();
   if (data_iter_.iter() != NULL) data_iter_.Seek(target);
   SkipEmptyDataBlocksForward();
 }
 
 void TwoLevelIterator::SeekToFirst() {
+  index_ahead_ = false;
   index_iter_.SeekToFirst();
   InitDataBlock();
+  SchedulePrefetches();
   if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
   SkipEmptyDataBlocksForward();
 }
 
 void TwoLevelIterator::SeekToLast() {
+  index_ahead_ = false;
   index_iter_.SeekToLast();
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.SeekToLast();
@@ -117,6 +205,7 @@ void TwoLevelIterator::Next() {
 
 void TwoLevelIterator::Prev() {
   assert(Valid());
+  RestoreIndex();
   data_iter_.Prev();
   SkipEmptyDataBlocksBackward();
 }
@@ -125,12 +214,30 @@ void TwoLevelIterator::Prev() {
 void TwoLevelIterator::SkipEmptyDataBlocksForward() {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
-    if (!index_iter_.Valid()) {
-      SetDataIterator(NULL);
-      return;
+    if (index_ahead_ && !prefetches_.empty()) {
+      // The next block is the first one being prefetched
+      Prefetch* p = prefetches_.front();
+      prefetches_.pop_front();
+      current_key_ = p->key;
+      data_block_handle_ = p->handle;
+      Iterator* iter = TakePrefetch(p);
+      if (iter == NULL) {
+        iter = (*block_function_)(arg_, options_, data_block_handle_);
+      }
+      SetDataIterator(iter);
+    } else {
+      if (index_ahead_) {
+        // Nothing is in flight, so index_iter_ is at the next block
+        index_ahead_ = false;
+      } else if (!index_iter_.Valid()) {
+        SetDataIterator(NULL);
+        return;
+      } else {
+        index_iter_.Next();
+      }
+      InitDataBlock();
     }
-    index_iter_.Next();
-    InitDataBlock();
+    SchedulePrefetches();
     if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
   }
 }
@@ -149,7 +256,12 @@ void TwoLevelIterator::SkipEmptyDataBlocksBackward() {
 }
 
 void TwoLevelIterator::SetDataIterator(Iterator* data_iter) {
-  if (data_iter_.iter() != NULL) SaveError(data_iter_.status());
+  if (data_iter_.iter() != NULL) {
+    SaveError(data_iter_.status());
+    if (options_.pin_data) {
+      pinned_iters_.push_back(data_iter_.Release());
+    }
+  }
   data_iter_.Set(data_iter);
 }
 
@@ -162,21 +274,118 @@ void TwoLevelIterator::InitDataBlock() {
       // data_iter_ is already constructed with this iterator, so
       // no need to change anything
     } else {
-      Iterator* iter = (*block_function_)(arg_, options_, handle);
+      // Use the block if it was prefetched.  Outstanding prefetches of
+      // other blocks are stale: the iterator did not move forward.
+      Iterator* iter = NULL;
+      while (!prefetches_.empty()) {
+        Prefetch* p = prefetches_.front();
+        prefetches_.pop_front();
+        if (handle == Slice(p->handle)) {
+          iter = TakePrefetch(p);
+          break;
+        }
+        DropPrefetch(p);
+      }
+      if (iter == NULL) {
+        iter = (*block_function_)(arg_, options_, handle);
+      }
       data_block_handle_.assign(handle.data(), handle.size());
       SetDataIterator(iter);
     }
   }
 }
 
+// Keeps reads of the options_.prefetch_blocks blocks that follow the
+// current one in flight.  To find those blocks index_iter_ moves ahead
+// of the current block (see index_ahead_), so a forward scan visits
+// each index entry once.
+void TwoLevelIterator::SchedulePrefetches() {
+  if (env_ == NULL) {
+    return;
+  }
+  if (!index_ahead_) {
+    if (!index_iter_.Valid()) {
+      return;
+    }
+    current_key_.assign(index_iter_.key().data(), index_iter_.key().size());
+    index_ahead_ = true;
+    index_iter_.Next();
+    // Keep the reads already in flight for the blocks that follow
+    size_t kept = 0;
+    while (kept < prefetches_.size() && index_iter_.Valid() &&
+           index_iter_.value() == Slice(prefetches_[kept]->handle)) {
+      index_iter_.Next();
+      kept++;
+    }
+    while (prefetches_.size() > kept) {
+      DropPrefetch(prefetches_.back());
+      prefetches_.pop_back();
+    }
+  }
+  while (prefetches_.size() < options_.prefetch_blocks &&
+         index_iter_.Valid()) {
+    Prefetch* p = new Prefetch;
+    p->block_function = block_function_;
+    p->arg = arg_;
+    p->options = options_;
+    p->key.assign(index_iter_.key().data(), index_iter_.key().size());
+    Slice handle = index_iter_.value();
+    p->handle.assign(handle.data(), handle.size());
+    prefetches_.push_back(p);
+    env_->SchedulePrefetch(&RunPrefetch, p);
+    index_iter_.Next();
+  }
+}
+
+// Moves index_iter_ back to the current block if it is ahead of it.
+void TwoLevelIterator::RestoreIndex() {
+  if (index_ahead_) {
+    index_ahead_ = false;
+    index_iter_.Seek(current_key_);
+    assert(index_iter_.Valid() && index_iter_.key() == Slice(current_key_));
+  }
+}
+
+// Returns the block read by "p" and drops "p", or returns NULL if the
+// background job has not started yet.  In that case it is cancelled
+// since reading the block directly is no slower than waiting for it.
+Iterator* TwoLevelIterator::TakePrefetch(Prefetch* p) {
+  Iterator* result = NULL;
+  p->mu.Lock();
+  if (!p->running && !p->done) {
+    p->cancelled = true;
+  } else {
+    while (!p->done) {
+      p->cv.Wait();
+    }
+    result = p->result;
+    p->result = NULL;
+  }
+  UnrefPrefetch(p);
+  return result;
+}
+
+// Drops a prefetch whose block is no longer wanted.  A read that is
+// already running is waited for, since it may use state (such as the
+// table behind arg_) that only lives as long as this iterator.
+void TwoLevelIterator::DropPrefetch(Prefetch* p) {
+  p->mu.Lock();
+  p->cancelled = true;
+  while (p->running) {
+    p->cv.Wait();
+  }
+  UnrefPrefetch(p);
+}
+
 }
 
 Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options) {
-  return new TwoLevelIterator(index_iter, block_function, arg, options);
+    const ReadOptions& options,
+    Env* env) {
+  return new TwoLevelIterator(index_iter, block_function, arg, options, env);
 }
 
 }
@@ -9,6 +9,7 @@
 
 namespace leveldb {
 
+class Env;
 struct ReadOptions;
 
 // Return a new two level iterator.  A two-level iterator contains an
@@ -20,6 +21,11 @@ struct ReadOptions;
 //
 // Uses a supplied function to convert an index_iter value into
 // an iterator over the contents of the corresponding block.
+//
+// If "env" is non-NULL and options.prefetch_blocks is positive, the
+// blocks that follow the current one are converted ahead of time by
+// jobs passed to env->SchedulePrefetch() while the iterator moves forward.
+// "block_function" must then be safe to call from other threads.
 extern Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     Iterator* (*block_function)(
@@ -27,7 +33,8 @@ extern Iterator* NewTwoLevelIterator(
         const ReadOptions& options,
         const Slice& index_value),
     void* arg,
-    const ReadOptions& options);
+    const ReadOptions& options,
+    Env* env = NULL);
 
 }
 
@@ -16,12 +16,27 @@ namespace leveldb {
 Cache::~Cache() {
 }
 
+Cache::Handle* Cache::Insert(const Slice& key, void* value, size_t charge,
+                             void (*deleter)(const Slice& key, void* value),
+                             Priority priority) {
+  return Insert(key, value, charge, deleter);
+}
+
 namespace {
 
 // LRU cache implementation
 
 // An entry is a variable length heap-allocated structure.  Entries
 // are kept in a circular doubly linked list ordered by access time.
+//
+// When a shard reserves part of its capacity for high priority
+// entries, the newest end of the list forms the high priority pool and
+// the rest the low priority pool.  High priority entries and entries
+// that have been hit since they were inserted go to the newest end of
+// the list; other entries are inserted at the midpoint, i.e. as the
+// newest entry of the low priority pool, so that a burst of entries
+// that are used only once (such as the blocks of a long scan) cannot
+// push out the entries that are used repeatedly.
 struct LRUHandle {
   void* value;
   void (*deleter)(const Slice&, void* value);
@@ -32,6 +47,9 @@ struct LRUHandle {
   size_t key_length;
   uint32_t refs;
   uint32_t hash;      // Hash of key(); used for fast sharding and comparisons
+  bool high_pri;          // Inserted with Cache::HIGH
+  bool hit;               // Looked up since it was inserted
+  bool in_high_pri_pool;
   char key_data[1];   // Beginning of key
 
   Slice key() const {
@@ -49,19 +67,21 @@ struct LRUHandle {
 // of porting hacks and is also faster than some of the built-in hash
 // table implementations in some of the compiler/runtime combinations
 // we have tested.  E.g., readrandom speeds up by ~5% over the g++
-// 4.4.3's builtin hashtable.
+// 4.4.3's builtin hashtable.  H is the type of a cache entry; it must
+// provide key(), hash and next_hash like LRUHandle.
+template <typename H>
 class HandleTable {
  public:
   HandleTable() : length_(0), elems_(0), list_(NULL) { Resize(); }
   ~HandleTable() { delete[] list_; }
 
-  LRUHandle* Lookup(const Slice& key, uint32_t hash) {
+  H* Lookup(const Slice& key, uint32_t hash) {
     return *FindPointer(key, hash);
   }
 
-  LRUHandle* Insert(LRUHandle* h) {
-    LRUHandle** ptr = FindPointer(h->key(), h->hash);
-    LRUHandle* old = *ptr;
+  H* Insert(H* h) {
+    H** ptr = FindPointer(h->key(), h->hash);
+    H* old = *ptr;
     h->next_hash = (old == NULL ? NULL : old->next_hash);
     *ptr = h;
     if (old == NULL) {
@@ -75,9 +95,9 @@ class HandleTable {
     return old;
   }
 
-  LRUHandle* Remove(const Slice& key, uint32_t hash) {
-    LRUHandle** ptr = FindPointer(key, hash);
-    LRUHandle* result = *ptr;
+  H* Remove(const Slice& key, uint32_t hash) {
+    H** ptr = FindPointer(key, hash);
+    H* result = *ptr;
     if (result != NULL) {
       *ptr = result->next_hash;
       --elems_;
@@ -90,13 +110,13 @@ class HandleTable {
   // a linked list of cache entries that hash into the bucket.
   uint32_t length_;
   uint32_t elems_;
-  LRUHandle** list_;
+  H** list_;
 
   // Return a pointer to slot that points to a cache entry that
   // matches key/hash.  If there is no such cache entry, return a
   // pointer to the trailing slot in the corresponding linked list.
-  LRUHandle** FindPointer(const Slice& key, uint32_t hash) {
-    LRUHandle** ptr = &list_[hash & (length_ - 1)];
+  H** FindPointer(const Slice& key, uint32_t hash) {
+    H** ptr = &list_[hash & (length_ - 1)];
     while (*ptr != NULL &&
            ((*ptr)->hash != hash || key != (*ptr)->key())) {
       ptr = &(*ptr)->next_hash;
@@ -109,16 +129,16 @@ class HandleTable {
     while (new_length < elems_) {
       new_length *= 2;
     }
-    LRUHandle** new_list = new LRUHandle*[new_length];
+    H** new_list = new H*[new_length];
     memset(new_list, 0, sizeof(new_list[0]) * new_length);
     uint32_t count = 0;
     for (uint32_t i = 0; i < length_; i++) {
-      LRUHandle* h = list_[i];
+      H* h = list_[i];
       while (h != NULL) {
-        LRUHandle* next = h->next_hash;
+        H* next = h->next_hash;
         Slice key = h->key();
         uint32_t hash = h->hash;
-        LRUHandle** ptr = &new_list[hash & (new_length - 1)];
+        H** ptr = &new_list[hash & (new_length - 1)];
         h->next_hash = *ptr;
         *ptr = h;
         h = next;
@@ -139,12 +159,13 @@ class LRUCache {
   ~LRUCache();
 
   // Separate from constructor so caller can easily make an array of LRUCache
-  void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  void SetCapacity(size_t capacity, double high_pri_pool_ratio);
 
   // Like Cache methods, but with an extra "hash" parameter.
   Cache::Handle* Insert(const Slice& key, uint32_t hash,
                         void* value, size_t charge,
-                        void (*deleter)(const Slice& key, void* value));
+                        void (*deleter)(const Slice& key, void* value),
+                        Cache::Priority priority);
   Cache::Handle* Lookup(const Slice& key, uint32_t hash);
   void Release(Cache::Handle* handle);
   void Erase(const Slice& key, uint32_t hash);
@@ -152,29 +173,39 @@ class LRUCache {
  private:
   void LRU_Remove(LRUHandle* e);
   void LRU_Append(LRUHandle* e);
+  void MaintainPoolSize();
+  void EvictToCapacity();
   void Unref(LRUHandle* e);
 
-  // Initialized before use.
-  size_t capacity_;
-
   // mutex_ protects the following state.
   port::Mutex mutex_;
+  size_t capacity_;
+  size_t high_pri_pool_capacity_;
   size_t usage_;
+  size_t high_pri_pool_usage_;
   uint64_t last_id_;
 
   // Dummy head of LRU list.
   // lru.prev is newest entry, lru.next is oldest entry.
   LRUHandle lru_;
 
-  HandleTable table_;
+  // Newest entry of the low priority pool, or &lru_ if it is empty.
+  // Entries after it belong to the high priority pool.
+  LRUHandle* lru_low_pri_;
+
+  HandleTable<LRUHandle> table_;
 };
 
 LRUCache::LRUCache()
-    : usage_(0),
+    : capacity_(0),
+      high_pri_pool_capacity_(0),
+      usage_(0),
+      high_pri_pool_usage_(0),
       last_id_(0) {
   // Make empty circular linked list
   lru_.next = &lru_;
   lru_.prev = &lru_;
+  lru_low_pri_ = &lru_;
 }
 
 LRUCache::~LRUCache() {
@@ -186,6 +217,15 @@ LRUCache::~LRUCache() {
   }
 }
 
+void LRUCache::SetCapacity(size_t capacity, double high_pri_pool_ratio) {
+  MutexLock l(&mutex_);
+  capacity_ = capacity;
+  high_pri_pool_capacity_ = static_cast<size_t>(capacity *
+                                                high_pri_pool_ratio);
+  MaintainPoolSize();
+  EvictToCapacity();
+}
+
 void LRUCache::Unref(LRUHandle* e) {
   assert(e->refs > 0);
   e->refs--;
@@ -197,16 +237,55 @@ void LRUCache::Unref(LRUHandle* e) {
 }
 
 void LRUCache::LRU_Remove(LRUHandle* e) {
+  if (lru_low_pri_ == e) {
+    lru_low_pri_ = e->prev;
+  }
   e->next->prev = e->prev;
   e->prev->next = e->next;
+  if (e->in_high_pri_pool) {
+    high_pri_pool_usage_ -= e->charge;
+  }
 }
 
 void LRUCache::LRU_Append(LRUHandle* e) {
-  // Make "e" newest entry by inserting just before lru_
-  e->next = &lru_;
-  e->prev = lru_.prev;
+  if (high_pri_pool_capacity_ > 0 && (e->high_pri || e->hit)) {
+    // Make "e" newest entry by inserting just before lru_
+    e->next = &lru_;
+    e->prev = lru_.prev;
+    e->in_high_pri_pool = true;
+    high_pri_pool_usage_ += e->charge;
+  } else {
+    // Make "e" newest entry of the low priority pool
+    e->next = lru_low_pri_->next;
+    e->prev = lru_low_pri_;
+    e->in_high_pri_pool = false;
+    lru_low_pri_ = e;
+  }
   e->prev->next = e;
   e->next->prev = e;
+  MaintainPoolSize();
+}
+
+// Move the oldest entries of the high priority pool down into the low
+// priority pool until the high priority pool fits its share.
+void LRUCache::MaintainPoolSize() {
+  while (high_pri_pool_usage_ > high_pri_pool_capacity_) {
+    lru_low_pri_ = lru_low_pri_->next;
+    assert(lru_low_pri_ != &lru_);
+    lru_low_pri_->in_high_pri_pool = false;
+    high_pri_pool_usage_ -= lru_low_pri_->charge;
+  }
+}
+
+// Evict the oldest entries until the usage fits the capacity.
+// REQUIRES: mutex_ held.
+void LRUCache::EvictToCapacity() {
+  while (usage_ > capacity_ && lru_.next != &lru_) {
+    LRUHandle* old = lru_.next;
+    LRU_Remove(old);
+    table_.Remove(old->key(), old->hash);
+    Unref(old);
+  }
 }
 
 Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
@@ -214,6 +293,7 @@ Cache::Handle* LRUCache::Lookup(const Slice& key, uint32_t hash) {
   LRUHandle* e = table_.Lookup(key, hash);
   if (e != NULL) {
     e->refs++;
+    e->hit = true;
     LRU_Remove(e);
     LRU_Append(e);
   }
@@ -227,7 +307,8 @@ void LRUCache::Release(Cache::Handle* handle) {
 
 Cache::Handle* LRUCache::Insert(
     const Slice& key, uint32_t hash, void* value, size_t charge,
-    void (*deleter)(const Slice& key, void* value)) {
+    void (*deleter)(const Slice& key, void* value),
+    Cache::Priority priority) {
   MutexLock l(&mutex_);
 
   LRUHandle* e = reinterpret_cast<LRUHandle*>(
@@ -238,6 +319,9 @@ Cache::Handle* LRUCache::Insert(
   e->key_length = key.size();
   e->hash = hash;
   e->refs = 2;  // One from LRUCache, one for the returned handle
+  e->high_pri = (priority == Cache::HIGH);
+  e->hit = false;
+  e->in_high_pri_pool = false;
   memcpy(e->key_data, key.data(), key.size());
   LRU_Append(e);
   usage_ += charge;
@@ -248,12 +332,7 @@ Cache::Handle* LRUCache::Insert(
     Unref(old);
   }
 
-  while (usage_ > capacity_ && lru_.next != &lru_) {
-    LRUHandle* old = lru_.next;
-    LRU_Remove(old);
-    table_.Remove(old->key(), old->hash);
-    Unref(old);
-  }
+  EvictToCapacity();
 
   return reinterpret_cast<Cache::Handle*>(e);
 }
@@ -273,6 +352,7 @@ static const int kNumShards = 1 << kNumShardBits;
 class ShardedLRUCache : public Cache {
  private:
   LRUCache shard_[kNumShards];
+  const double high_pri_pool_ratio_;
   port::Mutex id_mutex_;
   uint64_t last_id_;
 
@@ -285,14 +365,289 @@ class ShardedLRUCache : public Cache {
   }
 
  public:
-  explicit ShardedLRUCache(size_t capacity)
-      : last_id_(0) {
+  ShardedLRUCache(size_t capacity, double high_pri_pool_ratio)
+      : high_pri_pool_ratio_(high_pri_pool_ratio),
+        last_id_(0) {
+    SetCapacity(capacity);
+  }
+  virtual ~ShardedLRUCache() { }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    return Insert(key, value, charge, deleter, LOW);
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value),
+                         Priority priority) {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Insert(key, hash, value, charge, deleter,
+                                      priority);
+  }
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    return shard_[Shard(hash)].Lookup(key, hash);
+  }
+  virtual void Release(Handle* handle) {
+    LRUHandle* h = reinterpret_cast<LRUHandle*>(handle);
+    shard_[Shard(h->hash)].Release(handle);
+  }
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    shard_[Shard(hash)].Erase(key, hash);
+  }
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<LRUHandle*>(handle)->value;
+  }
+  virtual uint64_t NewId() {
+    MutexLock l(&id_mutex_);
+    return ++(last_id_);
+  }
+  virtual void SetCapacity(size_t capacity) {
     const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
     for (int s = 0; s < kNumShards; s++) {
-      shard_[s].SetCapacity(per_shard);
+      shard_[s].SetCapacity(per_shard, high_pri_pool_ratio_);
     }
   }
-  virtual ~ShardedLRUCache() { }
+};
+
+// CLOCK cache implementation
+//
+// Entries of a shard sit in a circular list that a "hand" sweeps over
+// when room is needed.  A hit only sets the entry's reference bit and
+// bumps its reference count, both with atomic operations under a read
+// lock, so concurrent lookups in the same shard do not serialize.  The
+// sweep evicts the first entry whose reference bit is clear, clearing
+// the bits it passes over.  Inserts, erases and evictions take the
+// lock for writing.
+
+struct ClockHandle {
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  ClockHandle* next_hash;
+  ClockHandle* next;
+  ClockHandle* prev;
+  size_t charge;
+  size_t key_length;
+  volatile int refs;        // Updated with port::AtomicAdd()
+  volatile int referenced;  // Set by hits, cleared by the clock hand
+  uint32_t hash;
+  char key_data[1];         // Beginning of key
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+// A single shard of a ClockCache.
+class ClockCacheShard {
+ public:
+  ClockCacheShard();
+  ~ClockCacheShard();
+
+  void SetCapacity(size_t capacity);
+
+  Cache::Handle* Insert(const Slice& key, uint32_t hash,
+                        void* value, size_t charge,
+                        void (*deleter)(const Slice& key, void* value));
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+
+ private:
+  void Clock_Remove(ClockHandle* e);
+  void Clock_Append(ClockHandle* e);
+  void Remove(ClockHandle* e, ClockHandle** removed);
+  void EvictToCapacity(ClockHandle** removed);
+  static void Unref(ClockHandle* e);
+  static void UnrefAll(ClockHandle* list);
+
+  // mutex_ protects the following state.  Lookups hold it for reading
+  // and may update the refs and referenced fields of entries.
+  port::RWMutex mutex_;
+  size_t capacity_;
+  size_t usage_;
+
+  // Dummy head of the circular list of entries; hand_ points at the
+  // next entry to examine (or at the dummy head).
+  ClockHandle clock_;
+  ClockHandle* hand_;
+
+  HandleTable<ClockHandle> table_;
+};
+
+ClockCacheShard::ClockCacheShard()
+    : capacity_(0),
+      usage_(0) {
+  // Make empty circular linked list
+  clock_.next = &clock_;
+  clock_.prev = &clock_;
+  hand_ = &clock_;
+}
+
+ClockCacheShard::~ClockCacheShard() {
+  for (ClockHandle* e = clock_.next; e != &clock_; ) {
+    ClockHandle* next = e->next;
+    assert(e->refs == 1);  // Error if caller has an unreleased handle
+    Unref(e);
+    e = next;
+  }
+}
+
+void ClockCacheShard::Unref(ClockHandle* e) {
+  if (port::AtomicAdd(&e->refs, -1) == 0) {
+    (*e->deleter)(e->key(), e->value);
+    free(e);
+  }
+}
+
+// Drop the cache's reference to every entry in a list linked through
+// next_hash.  Called without holding mutex_ so that deleters do not run
+// under the lock.
+void ClockCacheShard::UnrefAll(ClockHandle* list) {
+  while (list != NULL) {
+    ClockHandle* next = list->next_hash;
+    Unref(list);
+    list = next;
+  }
+}
+
+void ClockCacheShard::Clock_Remove(ClockHandle* e) {
+  if (hand_ == e) {
+    hand_ = e->next;
+  }
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+}
+
+void ClockCacheShard::Clock_Append(ClockHandle* e) {
+  // Insert "e" just behind the hand, so that it is examined last
+  e->next = hand_;
+  e->prev = hand_->prev;
+  e->prev->next = e;
+  e->next->prev = e;
+}
+
+// Unlink "e", which is no longer in table_, and push it onto *removed
+// for the caller to unref once mutex_ is released.
+void ClockCacheShard::Remove(ClockHandle* e, ClockHandle** removed) {
+  Clock_Remove(e);
+  usage_ -= e->charge;
+  e->next_hash = *removed;
+  *removed = e;
+}
+
+// Sweep the hand over the entries, evicting until the usage fits the
+// capacity.  Every entry is passed over at most twice: once to clear its
+// reference bit and once more to evict it.  The evicted entries are
+// added to *removed.  REQUIRES: mutex_ held for writing.
+void ClockCacheShard::EvictToCapacity(ClockHandle** removed) {
+  while (usage_ > capacity_ && clock_.next != &clock_) {
+    ClockHandle* victim = hand_;
+    hand_ = victim->next;
+    if (victim == &clock_) {
+      continue;
+    }
+    if (victim->referenced) {
+      victim->referenced = 0;
+    } else {
+      table_.Remove(victim->key(), victim->hash);
+      Remove(victim, removed);
+    }
+  }
+}
+
+void ClockCacheShard::SetCapacity(size_t capacity) {
+  ClockHandle* removed = NULL;
+  {
+    WriteLock l(&mutex_);
+    capacity_ = capacity;
+    EvictToCapacity(&removed);
+  }
+  UnrefAll(removed);
+}
+
+Cache::Handle* ClockCacheShard::Lookup(const Slice& key, uint32_t hash) {
+  ReadLock l(&mutex_);
+  ClockHandle* e = table_.Lookup(key, hash);
+  if (e != NULL) {
+    port::AtomicAdd(&e->refs, 1);
+    if (!e->referenced) {
+      e->referenced = 1;
+    }
+  }
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+void ClockCacheShard::Release(Cache::Handle* handle) {
+  Unref(reinterpret_cast<ClockHandle*>(handle));
+}
+
+Cache::Handle* ClockCacheShard::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value)) {
+  ClockHandle* e = reinterpret_cast<ClockHandle*>(
+      malloc(sizeof(ClockHandle)-1 + key.size()));
+  e->value = value;
+  e->deleter = deleter;
+  e->charge = charge;
+  e->key_length = key.size();
+  e->hash = hash;
+  e->refs = 2;  // One from ClockCacheShard, one for the returned handle
+  e->referenced = 1;  // Survive the sweep that makes room for it
+  memcpy(e->key_data, key.data(), key.size());
+
+  ClockHandle* removed = NULL;
+  {
+    WriteLock l(&mutex_);
+    Clock_Append(e);
+    usage_ += charge;
+
+    ClockHandle* old = table_.Insert(e);
+    if (old != NULL) {
+      Remove(old, &removed);
+    }
+    EvictToCapacity(&removed);
+  }
+  UnrefAll(removed);
+
+  return reinterpret_cast<Cache::Handle*>(e);
+}
+
+void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
+  ClockHandle* removed = NULL;
+  {
+    WriteLock l(&mutex_);
+    ClockHandle* e = table_.Remove(key, hash);
+    if (e != NULL) {
+      Remove(e, &removed);
+    }
+  }
+  UnrefAll(removed);
+}
+
+class ClockCache : public Cache {
+ private:
+  ClockCacheShard* shard_;
+  const int num_shard_bits_;
+  port::Mutex id_mutex_;
+  uint64_t last_id_;
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  uint32_t Shard(uint32_t hash) const {
+    return (num_shard_bits_ > 0) ? (hash >> (32 - num_shard_bits_)) : 0;
+  }
+
+ public:
+  ClockCache(size_t capacity, int num_shard_bits)
+      : num_shard_bits_(num_shard_bits),
+        last_id_(0) {
+    shard_ = new ClockCacheShard[1 << num_shard_bits_];
+    SetCapacity(capacity);
+  }
+  virtual ~ClockCache() {
+    delete[] shard_;
+  }
+  using Cache::Insert;
   virtual Handle* Insert(const Slice& key, void* value, size_t charge,
                          void (*deleter)(const Slice& key, void* value)) {
     const uint32_t hash = HashSlice(key);
@@ -303,7 +658,7 @@ class ShardedLRUCache : public Cache {
     return shard_[Shard(hash)].Lookup(key, hash);
   }
   virtual void Release(Handle* handle) {
-    LRUHandle* h = reinterpret_cast<LRUHandle*>(handle);
+    ClockHandle* h = reinterpret_cast<ClockHandle*>(handle);
     shard_[Shard(h->hash)].Release(handle);
   }
   virtual void Erase(const Slice& key) {
@@ -311,18 +666,43 @@ class ShardedLRUCache : public Cache {
     shard_[Shard(hash)].Erase(key, hash);
   }
   virtual void* Value(Handle* handle) {
-    return reinterpret_cast<LRUHandle*>(handle)->value;
+    return reinterpret_cast<ClockHandle*>(handle)->value;
   }
   virtual uint64_t NewId() {
     MutexLock l(&id_mutex_);
     return ++(last_id_);
   }
+  virtual void SetCapacity(size_t capacity) {
+    const int num_shards = 1 << num_shard_bits_;
+    const size_t per_shard = (capacity + (num_shards - 1)) / num_shards;
+    for (int s = 0; s < num_shards; s++) {
+      shard_[s].SetCapacity(per_shard);
+    }
+  }
 };
 
 }  // end anonymous namespace
 
 Cache* NewLRUCache(size_t capacity) {
-  return new ShardedLRUCache(capacity);
+  return new ShardedLRUCache(capacity, 0.0);
+}
+
+Cache* NewLRUCache(size_t capacity, double high_pri_pool_ratio) {
+  if (high_pri_pool_ratio < 0.0) {
+    high_pri_pool_ratio = 0.0;
+  } else if (high_pri_pool_ratio > 1.0) {
+    high_pri_pool_ratio = 1.0;
+  }
+  return new ShardedLRUCache(capacity, high_pri_pool_ratio);
+}
+
+Cache* NewClockCache(size_t capacity, int num_shard_bits) {
+  if (num_shard_bits < 0) {
+    num_shard_bits = 0;
+  } else if (num_shard_bits > 20) {
+    num_shard_bits = 20;
+  }
+  return new ClockCache(capacity, num_shard_bits);
 }
 
 }
@@ -5,7 +5,10 @@
 #include "leveldb/cache.h"
 
 #include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -173,12 +176,280 @@ TEST(CacheTest, HeavyEntries) {
   ASSERT_LE(cached_weight, kCacheSize + kCacheSize/10);
 }
 
+TEST(CacheTest, SetCapacity) {
+  const int n = kCacheSize / 2;
+  for (int i = 0; i < n; i++) {
+    Insert(1000+i, 2000+i);
+  }
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  // Lowering the capacity evicts right away
+  cache_->SetCapacity(kCacheSize / 4);
+  int present = 0;
+  for (int i = 0; i < n; i++) {
+    if (Lookup(1000+i) == 2000+i) present++;
+  }
+  ASSERT_LE(present, kCacheSize / 4 + 16);  // Shards round up
+  ASSERT_EQ(n - present, deleted_keys_.size());
+
+  // Raising it makes room again
+  cache_->SetCapacity(kCacheSize);
+  deleted_keys_.clear();
+  for (int i = 0; i < kCacheSize / 4; i++) {
+    Insert(5000+i, 6000+i);
+  }
+  ASSERT_EQ(0, deleted_keys_.size());
+}
+
 TEST(CacheTest, NewId) {
   uint64_t a = cache_->NewId();
   uint64_t b = cache_->NewId();
   ASSERT_NE(a, b);
 }
 
+// An LRU cache that reserves half of its capacity for high priority
+// and frequently used entries.
+class CachePoolTest : public CacheTest {
+ public:
+  CachePoolTest() {
+    delete cache_;
+    cache_ = NewLRUCache(kCacheSize, 0.5);
+  }
+
+  void InsertHigh(int key, int value) {
+    cache_->Release(cache_->Insert(EncodeKey(key), EncodeValue(value), 1,
+                                   &CacheTest::Deleter, Cache::HIGH));
+  }
+};
+
+TEST(CachePoolTest, ScanResistance) {
+  // A small working set that is used repeatedly
+  for (int i = 0; i < 100; i++) {
+    Insert(i, 1000+i);
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+
+  // A scan that touches many more entries than the cache holds, each once
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(100000+i, i);
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+}
+
+TEST(CachePoolTest, HighPriorityEntries) {
+  for (int i = 0; i < 100; i++) {
+    InsertHigh(i, 1000+i);
+  }
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(100000+i, i);
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+}
+
+TEST(CachePoolTest, PoolEvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // Frequently used entry must be kept around
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(2000+i, Lookup(1000+i));
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+}
+
+TEST(CacheTest, ScanFlushesPlainLRU) {
+  for (int i = 0; i < 100; i++) {
+    Insert(i, 1000+i);
+    ASSERT_EQ(1000+i, Lookup(i));
+  }
+  for (int i = 0; i < 10 * kCacheSize; i++) {
+    Insert(100000+i, i);
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(-1, Lookup(i));
+  }
+}
+
+// Runs the same checks against a single-shard CLOCK cache.
+class ClockCacheTest : public CacheTest {
+ public:
+  ClockCacheTest() {
+    delete cache_;
+    cache_ = NewClockCache(kCacheSize, 0);
+  }
+};
+
+TEST(ClockCacheTest, ClockHitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1,  Lookup(200));
+
+  Insert(200, 201);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1,  Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(2, deleted_keys_.size());
+}
+
+TEST(ClockCacheTest, ClockEntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+
+  Insert(100, 102);
+  Cache::Handle* h2 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(102, DecodeValue(cache_->Value(h2)));
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+
+  cache_->Release(h2);
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(102, deleted_values_[1]);
+}
+
+TEST(ClockCacheTest, ClockEvictionPolicy) {
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(i, 1000+i);
+  }
+
+  // Making room clears every reference bit and evicts the oldest entry
+  Insert(kCacheSize, 1000+kCacheSize);
+  ASSERT_EQ(-1, Lookup(0));
+
+  // An entry used since the clock hand last passed it is kept around,
+  // its neighbours are not
+  ASSERT_EQ(1500, Lookup(500));
+  for (int i = 1; i < kCacheSize - 1; i++) {
+    Insert(kCacheSize+i, 1000+kCacheSize+i);
+  }
+  ASSERT_EQ(-1, Lookup(499));
+  ASSERT_EQ(1500, Lookup(500));
+  ASSERT_EQ(-1, Lookup(501));
+  ASSERT_EQ(1000+kCacheSize, Lookup(kCacheSize));
+}
+
+TEST(ClockCacheTest, ClockHeavyEntries) {
+  const int kLight = 1;
+  const int kHeavy = 10;
+  int added = 0;
+  int index = 0;
+  while (added < 2*kCacheSize) {
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000+index, weight);
+    added += weight;
+    index++;
+  }
+
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    const int weight = (i & 1 ? kLight : kHeavy);
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += weight;
+      ASSERT_EQ(1000+i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize);
+}
+
+namespace {
+
+struct ConcurrentState {
+  Cache* cache;
+  port::Mutex mu;
+  int running;
+  int inserted;
+  volatile int deleted;
+};
+
+struct ConcurrentArg {
+  ConcurrentState* state;
+  int id;
+};
+
+static ConcurrentState* concurrent_state;
+
+static void CountingDeleter(const Slice& key, void* v) {
+  port::AtomicAdd(&concurrent_state->deleted, 1);
+}
+
+static void ConcurrentBody(void* v) {
+  ConcurrentArg* arg = reinterpret_cast<ConcurrentArg*>(v);
+  Cache* cache = arg->state->cache;
+  int inserted = 0;
+  for (int i = 0; i < 20000; i++) {
+    const int k = (i * 7 + arg->id * 13) % 300;
+    Cache::Handle* h = cache->Lookup(EncodeKey(k));
+    if (h == NULL) {
+      h = cache->Insert(EncodeKey(k), EncodeValue(k), 1, &CountingDeleter);
+      inserted++;
+    }
+    ASSERT_EQ(k, DecodeValue(cache->Value(h)));
+    cache->Release(h);
+  }
+  MutexLock l(&arg->state->mu);
+  arg->state->inserted += inserted;
+  arg->state->running--;
+}
+
+}  // namespace
+
+TEST(ClockCacheTest, ConcurrentLookups) {
+  const int kThreads = 4;
+  ConcurrentState state;
+  state.cache = NewClockCache(100, 2);
+  state.running = kThreads;
+  state.inserted = 0;
+  state.deleted = 0;
+  concurrent_state = &state;
+
+  ConcurrentArg args[kThreads];
+  for (int i = 0; i < kThreads; i++) {
+    args[i].state = &state;
+    args[i].id = i;
+    Env::Default()->StartThread(&ConcurrentBody, &args[i]);
+  }
+  while (true) {
+    {
+      MutexLock l(&state.mu);
+      if (state.running == 0) break;
+    }
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+
+  // Every entry ever inserted is deleted exactly once
+  delete state.cache;
+  ASSERT_GT(state.inserted, 100);
+  ASSERT_EQ(state.inserted, state.deleted);
+}
+
 }
 
 int main(int argc, char** argv) {
@@ -9,12 +9,35 @@ namespace leveldb {
 Env::~Env() {
 }
 
+Status Env::GetFileModificationTime(const std::string& fname,
+                                    uint64_t* file_mtime) {
+  *file_mtime = 0;
+  return Status::NotSupported("GetFileModificationTime", fname);
+}
+
+void Env::ScheduleHighPriority(void (*function)(void* arg), void* arg) {
+  Schedule(function, arg);
+}
+
+void Env::SchedulePrefetch(void (*function)(void* arg), void* arg) {
+  Schedule(function, arg);
+}
+
+void Env::SetBackgroundThreads(int number) {
+}
+
+void Env::SetMmapReadBudget(uint64_t bytes) {
+}
+
 SequentialFile::~SequentialFile() {
 }
 
 RandomAccessFile::~RandomAccessFile() {
 }
 
+void RandomAccessFile::Hint(AccessPattern pattern) {
+}
+
 WritableFile::~WritableFile() {
 }
 
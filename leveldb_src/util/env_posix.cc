@@ -23,6 +23,7 @@
 #include "leveldb/slice.h"
 #include "port/port.h"
 #include "util/logging.h"
+#include "util/mutexlock.h"
 #include "util/posix_logger.h"
 
 namespace leveldb {
@@ -87,6 +88,111 @@ class PosixRandomAccessFile: public RandomAccessFile {
     }
     return s;
   }
+
+  virtual void Hint(AccessPattern pattern) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    int advice = POSIX_FADV_NORMAL;
+    if (pattern == kSequential) {
+      advice = POSIX_FADV_SEQUENTIAL;
+    } else if (pattern == kDontNeed) {
+      advice = POSIX_FADV_DONTNEED;
+    }
+    posix_fadvise(fd_, 0, 0, advice);  // Only advice; ignore errors
+#endif
+  }
+};
+
+// Limits the total size of the files that are memory-mapped for reading
+// at any one time, so that mappings do not exhaust the address space.
+// The budget starts at zero, which disables mapping, and is raised by
+// Env::SetMmapReadBudget().
+class MmapLimiter {
+ public:
+  MmapLimiter() : budget_(0), available_(0) { }
+
+  // Raise the budget to "budget" bytes if it is lower.
+  void Raise(uint64_t budget) {
+    MutexLock l(&mu_);
+    if (budget > budget_) {
+      available_ += budget - budget_;
+      budget_ = budget;
+    }
+  }
+
+  // If the budget has room for "n" more bytes, take them and return
+  // true.  Otherwise return false.
+  bool Acquire(uint64_t n) {
+    MutexLock l(&mu_);
+    if (n > available_) {
+      return false;
+    }
+    available_ -= n;
+    return true;
+  }
+
+  // Give back "n" bytes obtained by a successful Acquire().
+  void Release(uint64_t n) {
+    MutexLock l(&mu_);
+    available_ += n;
+  }
+
+ private:
+  port::Mutex mu_;
+  uint64_t budget_;
+  uint64_t available_;
+
+  // No copying allowed
+  MmapLimiter(const MmapLimiter&);
+  void operator=(const MmapLimiter&);
+};
+
+// A read-only view of a whole file mapped into memory.  Reads return
+// pointers into the mapping, so callers can use the data without
+// copying it.
+class PosixMmapReadableFile: public RandomAccessFile {
+ private:
+  std::string filename_;
+  void* mmapped_region_;
+  size_t length_;
+  MmapLimiter* limiter_;
+
+ public:
+  // base[0,length-1] contains the mmapped contents of the file.
+  PosixMmapReadableFile(const std::string& fname, void* base, size_t length,
+                        MmapLimiter* limiter)
+      : filename_(fname), mmapped_region_(base), length_(length),
+        limiter_(limiter) {
+  }
+  virtual ~PosixMmapReadableFile() {
+    munmap(mmapped_region_, length_);
+    limiter_->Release(length_);
+  }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    Status s;
+    if (offset > length_) {
+      *result = Slice();
+      s = IOError(filename_, EINVAL);
+    } else {
+      // Like pread(), return fewer bytes when reading past the end
+      if (n > length_ - offset) {
+        n = length_ - offset;
+      }
+      *result = Slice(reinterpret_cast<char*>(mmapped_region_) + offset, n);
+    }
+    return s;
+  }
+
+  virtual void Hint(AccessPattern pattern) {
+    int advice = MADV_NORMAL;
+    if (pattern == kSequential) {
+      advice = MADV_SEQUENTIAL;
+    } else if (pattern == kDontNeed) {
+      advice = MADV_DONTNEED;
+    }
+    madvise(mmapped_region_, length_, advice);  // Only advice; ignore errors
+  }
 };
 
 // We preallocate up to an extra megabyte and use memcpy to append new
@@ -302,6 +408,21 @@ class PosixEnv : public Env {
       *result = NULL;
       return IOError(fname, errno);
     }
+
+    // Map the file if the budget allows; otherwise fall back to pread()
+    struct stat sbuf;
+    if (fstat(fd, &sbuf) == 0 && sbuf.st_size > 0 &&
+        static_cast<uint64_t>(sbuf.st_size) <= ~static_cast<size_t>(0) &&
+        mmap_limit_.Acquire(sbuf.st_size)) {
+      const size_t size = sbuf.st_size;
+      void* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (base != MAP_FAILED) {
+        close(fd);
+        *result = new PosixMmapReadableFile(fname, base, size, &mmap_limit_);
+        return Status::OK();
+      }
+      mmap_limit_.Release(size);
+    }
     *result = new PosixRandomAccessFile(fname, fd);
     return Status::OK();
   }
@@ -374,6 +495,19 @@ class PosixEnv : public Env {
     return s;
   }
 
+  virtual Status GetFileModificationTime(const std::string& fname,
+                                         uint64_t* file_mtime) {
+    Status s;
+    struct stat sbuf;
+    if (stat(fname.c_str(), &sbuf) != 0) {
+      *file_mtime = 0;
+      s = IOError(fname, errno);
+    } else {
+      *file_mtime = static_cast<uint64_t>(sbuf.st_mtime);
+    }
+    return s;
+  }
+
   virtual Status RenameFile(const std::string& src, const std::string& target) {
     Status result;
     if (rename(src.c_str(), target.c_str()) != 0) {
@@ -412,8 +546,18 @@ class PosixEnv : public Env {
 
   virtual void Schedule(void (*function)(void*), void* arg);
 
+  virtual void ScheduleHighPriority(void (*function)(void*), void* arg);
+
+  virtual void SchedulePrefetch(void (*function)(void*), void* arg);
+
   virtual void StartThread(void (*function)(void* arg), void* arg);
 
+  virtual void SetBackgroundThreads(int number);
+
+  virtual void SetMmapReadBudget(uint64_t bytes) {
+    mmap_limit_.Raise(bytes);
+  }
+
   virtual Status GetTestDirectory(std::string* result) {
     const char* env = getenv("TEST_TMPDIR");
     if (env && env[0] != '\0') {
@@ -464,47 +608,79 @@ class PosixEnv : public Env {
     }
   }
 
-  // BGThread() is the body of the background thread
-  void BGThread();
+  // Each kind of background work has its own queue and threads
+  enum Lane {
+    kDefaultLane,                 // Schedule()
+    kHighPriorityLane,            // ScheduleHighPriority()
+    kPrefetchLane                 // SchedulePrefetch()
+  };
+
+  // Threads serving kPrefetchLane, so that prefetches of several blocks
+  // or by several iterators overlap
+  static const int kPrefetchThreads = 4;
+
+  // BGThread() is the body of the background threads
+  void BGThread(Lane lane);
   static void* BGThreadWrapper(void* arg) {
-    reinterpret_cast<PosixEnv*>(arg)->BGThread();
+    reinterpret_cast<PosixEnv*>(arg)->BGThread(kDefaultLane);
+    return NULL;
+  }
+  static void* HPThreadWrapper(void* arg) {
+    reinterpret_cast<PosixEnv*>(arg)->BGThread(kHighPriorityLane);
+    return NULL;
+  }
+  static void* PFThreadWrapper(void* arg) {
+    reinterpret_cast<PosixEnv*>(arg)->BGThread(kPrefetchLane);
     return NULL;
   }
 
   size_t page_size_;
+  MmapLimiter mmap_limit_;
   pthread_mutex_t mu_;
   pthread_cond_t bgsignal_;
-  pthread_t bgthread_;
-  bool started_bgthread_;
+  pthread_cond_t hpsignal_;
+  pthread_cond_t pfsignal_;
+  int bg_threads_;                // Background threads started so far
+  int max_bg_threads_;            // Background threads wanted
+  bool started_hpthread_;
+  int pf_threads_;                // Prefetch threads started so far
+  int pf_idle_;                   // Prefetch threads waiting for work
 
   // Entry per Schedule() call
   struct BGItem { void* arg; void (*function)(void*); };
   typedef std::deque<BGItem> BGQueue;
   BGQueue queue_;
+  BGQueue hp_queue_;              // Entry per ScheduleHighPriority() call
+  BGQueue pf_queue_;              // Entry per SchedulePrefetch() call
 };
 
 PosixEnv::PosixEnv() : page_size_(getpagesize()),
-                       started_bgthread_(false) {
+                       bg_threads_(0),
+                       max_bg_threads_(1),
+                       started_hpthread_(false),
+                       pf_threads_(0),
+                       pf_idle_(0) {
   PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
   PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
+  PthreadCall("cvar_init", pthread_cond_init(&hpsignal_, NULL));
+  PthreadCall("cvar_init", pthread_cond_init(&pfsignal_, NULL));
 }
 
 void PosixEnv::Schedule(void (*function)(void*), void* arg) {
   PthreadCall("lock", pthread_mutex_lock(&mu_));
 
-  // Start background thread if necessary
-  if (!started_bgthread_) {
-    started_bgthread_ = true;
+  // Start background threads if necessary
+  while (bg_threads_ < max_bg_threads_) {
+    pthread_t t;
     PthreadCall(
         "create thread",
-        pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
+        pthread_create(&t, NULL,  &PosixEnv::BGThreadWrapper, this));
+    bg_threads_++;
   }
 
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  if (queue_.empty()) {
-    PthreadCall("signal", pthread_cond_signal(&bgsignal_));
-  }
+  // Wake up a waiting background thread, if any.  With several threads
+  // some may be waiting even though the queue is not empty.
+  PthreadCall("signal", pthread_cond_signal(&bgsignal_));
 
   // Add to priority queue
   queue_.push_back(BGItem());
@@ -514,17 +690,75 @@ void PosixEnv::Schedule(void (*function)(void*), void* arg) {
   PthreadCall("unlock", pthread_mutex_unlock(&mu_));
 }
 
-void PosixEnv::BGThread() {
+void PosixEnv::ScheduleHighPriority(void (*function)(void*), void* arg) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+
+  if (!started_hpthread_) {
+    started_hpthread_ = true;
+    pthread_t t;
+    PthreadCall(
+        "create thread",
+        pthread_create(&t, NULL,  &PosixEnv::HPThreadWrapper, this));
+  }
+
+  hp_queue_.push_back(BGItem());
+  hp_queue_.back().function = function;
+  hp_queue_.back().arg = arg;
+  PthreadCall("signal", pthread_cond_signal(&hpsignal_));
+
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::SchedulePrefetch(void (*function)(void*), void* arg) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+
+  // Start another thread unless one is waiting for work
+  if (pf_idle_ == 0 && pf_threads_ < kPrefetchThreads) {
+    pthread_t t;
+    PthreadCall(
+        "create thread",
+        pthread_create(&t, NULL,  &PosixEnv::PFThreadWrapper, this));
+    pf_threads_++;
+  }
+
+  pf_queue_.push_back(BGItem());
+  pf_queue_.back().function = function;
+  pf_queue_.back().arg = arg;
+  PthreadCall("signal", pthread_cond_signal(&pfsignal_));
+
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::SetBackgroundThreads(int number) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  if (number > max_bg_threads_) {
+    max_bg_threads_ = number;
+  }
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::BGThread(Lane lane) {
+  BGQueue* queue = &queue_;
+  pthread_cond_t* signal = &bgsignal_;
+  if (lane == kHighPriorityLane) {
+    queue = &hp_queue_;
+    signal = &hpsignal_;
+  } else if (lane == kPrefetchLane) {
+    queue = &pf_queue_;
+    signal = &pfsignal_;
+  }
   while (true) {
     // Wait until there is an item that is ready to run
     PthreadCall("lock", pthread_mutex_lock(&mu_));
-    while (queue_.empty()) {
-      PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
+    while (queue->empty()) {
+      if (lane == kPrefetchLane) pf_idle_++;
+      PthreadCall("wait", pthread_cond_wait(signal, &mu_));
+      if (lane == kPrefetchLane) pf_idle_--;
     }
 
-    void (*function)(void*) = queue_.front().function;
-    void* arg = queue_.front().arg;
-    queue_.pop_front();
+    void (*function)(void*) = queue->front().function;
+    void* arg = queue->front().arg;
+    queue->pop_front();
 
     PthreadCall("unlock", pthread_mutex_unlock(&mu_));
     (*function)(arg);
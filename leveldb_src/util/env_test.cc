@@ -6,6 +6,7 @@
 
 #include "port/port.h"
 #include "util/testharness.h"
+#include "util/testutil.h"
 
 namespace leveldb {
 
@@ -95,6 +96,47 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+TEST(EnvPosixTest, RandomAccessFileRead) {
+  const std::string fname = test::TmpDir() + "/random_access_file_test";
+  std::string data;
+  for (int i = 0; i < 10000; i++) {
+    data.push_back(static_cast<char>('a' + (i % 26)));
+  }
+  WritableFile* writable;
+  ASSERT_OK(env_->NewWritableFile(fname, &writable));
+  ASSERT_OK(writable->Append(data));
+  ASSERT_OK(writable->Close());
+  delete writable;
+
+  RandomAccessFile* file;
+  ASSERT_OK(env_->NewRandomAccessFile(fname, &file));
+  char scratch[200];
+  Slice result;
+  ASSERT_OK(file->Read(0, 100, &result, scratch));
+  ASSERT_EQ(data.substr(0, 100), result.ToString());
+  ASSERT_OK(file->Read(5000, 200, &result, scratch));
+  ASSERT_EQ(data.substr(5000, 200), result.ToString());
+
+  // Reads past the end of the file are short
+  ASSERT_OK(file->Read(9950, 100, &result, scratch));
+  ASSERT_EQ(data.substr(9950), result.ToString());
+  ASSERT_OK(file->Read(10000, 100, &result, scratch));
+  ASSERT_EQ(0, result.size());
+  delete file;
+
+  // With a budget the file is mapped, and reads return pointers into
+  // the mapping
+  env_->SetMmapReadBudget(1 << 20);
+  ASSERT_OK(env_->NewRandomAccessFile(fname, &file));
+  ASSERT_OK(file->Read(5000, 200, &result, scratch));
+  ASSERT_EQ(data.substr(5000, 200), result.ToString());
+  ASSERT_TRUE(result.data() != scratch);
+  ASSERT_OK(file->Read(9950, 100, &result, scratch));
+  ASSERT_EQ(data.substr(9950), result.ToString());
+  delete file;
+  ASSERT_OK(env_->DeleteFile(fname));
+}
+
 }
 
 int main(int argc, char** argv) {
@@ -11,6 +11,7 @@ namespace leveldb {
 
 Options::Options()
     : comparator(BytewiseComparator()),
+      compaction_filter(NULL),
       create_if_missing(false),
       error_if_exists(false),
       paranoid_checks(false),
@@ -18,10 +19,34 @@ Options::Options()
       info_log(NULL),
       write_buffer_size(4<<20),
       max_open_files(1000),
+      mmap_read_budget(0),
+      preload_tables(false),
+      max_file_opening_threads(4),
+      max_background_compactions(1),
+      max_subcompactions(1),
+      rate_limiter(NULL),
+      compaction_readahead_size(0),
+      max_bytes_for_level_base(10 << 20),
+      max_bytes_for_level_multiplier(10),
+      target_file_size_base(2 << 20),
+      target_file_size_multiplier(1),
+      level_compaction_dynamic_level_bytes(false),
+      compaction_style(kCompactionStyleLevel),
+      universal_size_ratio(1),
+      universal_min_merge_width(2),
+      universal_max_merge_width(64),
+      universal_max_size_amplification_percent(200),
+      fifo_max_table_files_size(1 << 30),
+      fifo_max_table_files(1000),
+      fifo_ttl_seconds(0),
       block_cache(NULL),
+      block_cache_compressed(NULL),
+      persistent_cache(NULL),
       block_size(4096),
       block_restart_interval(16),
-      compression(kSnappyCompression) {
+      block_delta_encoding(true),
+      compression(kSnappyCompression),
+      max_sequential_skip_in_iterations(8) {
 }
 
 
@@ -0,0 +1,398 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/persistent_cache.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+PersistentCache::~PersistentCache() {
+}
+
+void PersistentCache::WaitForWrites() {
+}
+
+namespace {
+
+// Each entry is stored in its segment as
+//    crc: uint32      (masked crc32c of the key followed by the contents)
+//    contents: char[n]
+// The key and the length of the contents live in the in-memory index.
+static const size_t kEntryHeaderSize = 4;
+
+static const char kSegmentSuffix[] = ".pcache";
+
+// Number of full segments that may wait for the writer thread.  Entries
+// that would need another segment are dropped until it catches up.
+static const size_t kMaxSealedSegments = 2;
+
+static bool IsSegmentFile(const std::string& fname) {
+  const size_t n = strlen(kSegmentSuffix);
+  return fname.size() > n &&
+      fname.compare(fname.size() - n, n, kSegmentSuffix) == 0;
+}
+
+// A segment starts out as an in-memory buffer that new entries are
+// appended to.  Once the buffer is full it is handed to the writer
+// thread, which writes it out to its own file; subsequent lookups read
+// from that file.
+struct Segment {
+  uint64_t number;
+  int refs;
+  RandomAccessFile* file;       // NULL until the segment has been written
+  std::string buffer;           // Contents while file == NULL
+  uint64_t size;                // Bytes of entries in the segment
+  std::vector<std::string> keys;
+};
+
+struct Location {
+  Segment* segment;
+  uint64_t offset;              // Offset of the entry header in the segment
+  uint32_t size;                // Length of the contents
+};
+
+class LogStructuredCache : public PersistentCache {
+ public:
+  LogStructuredCache(Env* env, const std::string& dir, uint64_t capacity);
+  virtual ~LogStructuredCache();
+
+  Status Open();
+
+  virtual void Insert(const Slice& key, const Slice& contents);
+  virtual bool Lookup(const Slice& key, std::string* contents);
+  virtual uint64_t NewId();
+  virtual void WaitForWrites();
+
+ private:
+  std::string SegmentFileName(uint64_t number) const;
+  void NewActiveSegment();
+  void SealActiveSegment();
+  void DropSegment(Segment* s);
+  void Unref(Segment* s);
+
+  static void BGWriterWrapper(void* cache);
+  void BGWriter();
+  Status WriteSegment(Segment* s, RandomAccessFile** file);
+
+  Env* const env_;
+  const std::string dir_;
+  const uint64_t capacity_;
+  const uint64_t segment_size_;
+  FileLock* lock_;
+
+  port::Mutex mutex_;
+  port::CondVar work_cv_;               // Signalled for the writer thread
+  port::CondVar done_cv_;               // Signalled by the writer thread
+  uint64_t last_id_;
+  uint64_t next_segment_number_;
+  uint64_t usage_;                      // Sum of the sizes of segments_
+  std::deque<Segment*> segments_;       // Oldest first; back() is active
+  std::deque<Segment*> sealed_;         // Full segments left to write
+  std::map<std::string, Location> index_;
+  bool writer_running_;
+  bool shutting_down_;
+};
+
+LogStructuredCache::LogStructuredCache(Env* env, const std::string& dir,
+                                       uint64_t capacity)
+    : env_(env),
+      dir_(dir),
+      capacity_(capacity),
+      segment_size_(std::max<uint64_t>(capacity / 8, 4096)),
+      lock_(NULL),
+      work_cv_(&mutex_),
+      done_cv_(&mutex_),
+      last_id_(0),
+      next_segment_number_(1),
+      usage_(0),
+      writer_running_(false),
+      shutting_down_(false) {
+}
+
+LogStructuredCache::~LogStructuredCache() {
+  // Segments that were not written yet are simply discarded; their
+  // files would be deleted below anyway.
+  mutex_.Lock();
+  shutting_down_ = true;
+  work_cv_.Signal();
+  while (writer_running_) {
+    done_cv_.Wait();
+  }
+  mutex_.Unlock();
+
+  while (!sealed_.empty()) {
+    Segment* s = sealed_.front();
+    sealed_.pop_front();
+    Unref(s);
+  }
+  while (!segments_.empty()) {
+    Segment* s = segments_.front();
+    segments_.pop_front();
+    Unref(s);
+  }
+  if (lock_ != NULL) {
+    env_->UnlockFile(lock_);
+  }
+}
+
+std::string LogStructuredCache::SegmentFileName(uint64_t number) const {
+  char buf[100];
+  snprintf(buf, sizeof(buf), "/%06llu%s",
+           static_cast<unsigned long long>(number), kSegmentSuffix);
+  return dir_ + buf;
+}
+
+Status LogStructuredCache::Open() {
+  env_->CreateDir(dir_);  // Ignore error: the directory may already exist
+  Status s = env_->LockFile(dir_ + "/LOCK", &lock_);
+  if (!s.ok()) {
+    return s;
+  }
+
+  // The ids used in keys are not stable across processes, so entries
+  // written by a previous process cannot be matched up with tables
+  // again.  Start cold.
+  std::vector<std::string> filenames;
+  env_->GetChildren(dir_, &filenames);  // Ignoring errors on purpose
+  for (size_t i = 0; i < filenames.size(); i++) {
+    if (IsSegmentFile(filenames[i])) {
+      env_->DeleteFile(dir_ + "/" + filenames[i]);
+    }
+  }
+
+  MutexLock l(&mutex_);
+  NewActiveSegment();
+  writer_running_ = true;
+  env_->StartThread(&LogStructuredCache::BGWriterWrapper, this);
+  return Status::OK();
+}
+
+void LogStructuredCache::NewActiveSegment() {
+  mutex_.AssertHeld();
+  Segment* s = new Segment;
+  s->number = next_segment_number_++;
+  s->refs = 1;
+  s->file = NULL;
+  s->size = 0;
+  segments_.push_back(s);
+}
+
+// Hand the active segment to the writer thread and start a new one.
+// Until it has been written, lookups keep reading the old segment's
+// buffer, which is no longer modified.
+void LogStructuredCache::SealActiveSegment() {
+  mutex_.AssertHeld();
+  Segment* s = segments_.back();
+  s->refs++;
+  sealed_.push_back(s);
+  NewActiveSegment();
+  work_cv_.Signal();
+}
+
+void LogStructuredCache::BGWriterWrapper(void* cache) {
+  reinterpret_cast<LogStructuredCache*>(cache)->BGWriter();
+}
+
+void LogStructuredCache::BGWriter() {
+  MutexLock l(&mutex_);
+  while (true) {
+    while (sealed_.empty() && !shutting_down_) {
+      work_cv_.Wait();
+    }
+    if (shutting_down_) {
+      break;
+    }
+
+    // The segment stays at the front of sealed_ while it is written so
+    // that WaitForWrites() waits for it.
+    Segment* s = sealed_.front();
+    RandomAccessFile* file = NULL;
+    mutex_.Unlock();
+    Status status = WriteSegment(s, &file);
+    mutex_.Lock();
+    sealed_.pop_front();
+
+    if (status.ok()) {
+      s->file = file;
+      std::string().swap(s->buffer);
+    } else {
+      env_->DeleteFile(SegmentFileName(s->number));
+      if (std::find(segments_.begin(), segments_.end(), s) !=
+          segments_.end()) {
+        DropSegment(s);
+      }
+    }
+    Unref(s);
+
+    // Drop the oldest segments to leave room for the active one.
+    while (usage_ + segment_size_ > capacity_ && segments_.size() > 1) {
+      DropSegment(segments_.front());
+    }
+    done_cv_.SignalAll();
+  }
+  writer_running_ = false;
+  done_cv_.SignalAll();
+}
+
+// Write "s" out to its file and store a handle for reading it back in
+// *file.  REQUIRES: mutex_ not held.
+Status LogStructuredCache::WriteSegment(Segment* s, RandomAccessFile** file) {
+  const std::string fname = SegmentFileName(s->number);
+  WritableFile* out = NULL;
+  Status status = env_->NewWritableFile(fname, &out);
+  if (status.ok()) {
+    status = out->Append(s->buffer);
+    if (status.ok()) {
+      status = out->Close();
+    }
+    delete out;
+  }
+  if (status.ok()) {
+    status = env_->NewRandomAccessFile(fname, file);
+  }
+  return status;
+}
+
+// Remove "s" from segments_ along with its entries in the index.
+void LogStructuredCache::DropSegment(Segment* s) {
+  mutex_.AssertHeld();
+  for (size_t i = 0; i < s->keys.size(); i++) {
+    std::map<std::string, Location>::iterator it = index_.find(s->keys[i]);
+    if (it != index_.end() && it->second.segment == s) {
+      index_.erase(it);
+    }
+  }
+  segments_.erase(std::find(segments_.begin(), segments_.end(), s));
+  usage_ -= s->size;
+  Unref(s);
+}
+
+void LogStructuredCache::Unref(Segment* s) {
+  assert(s->refs > 0);
+  s->refs--;
+  if (s->refs == 0) {
+    if (s->file != NULL) {
+      delete s->file;
+      env_->DeleteFile(SegmentFileName(s->number));
+    }
+    delete s;
+  }
+}
+
+void LogStructuredCache::Insert(const Slice& key, const Slice& contents) {
+  const size_t entry_size = kEntryHeaderSize + contents.size();
+  if (entry_size > segment_size_) {
+    return;  // Too large to cache
+  }
+
+  MutexLock l(&mutex_);
+  const std::string k = key.ToString();
+  if (index_.find(k) != index_.end()) {
+    return;
+  }
+  if (segments_.back()->size + entry_size > segment_size_) {
+    if (sealed_.size() >= kMaxSealedSegments) {
+      return;  // The writer thread is behind; do not wait for it
+    }
+    SealActiveSegment();
+  }
+
+  Segment* s = segments_.back();
+  uint32_t crc = crc32c::Extend(crc32c::Value(key.data(), key.size()),
+                                contents.data(), contents.size());
+  Location loc;
+  loc.segment = s;
+  loc.offset = s->size;
+  loc.size = static_cast<uint32_t>(contents.size());
+  PutFixed32(&s->buffer, crc32c::Mask(crc));
+  s->buffer.append(contents.data(), contents.size());
+  s->size += entry_size;
+  s->keys.push_back(k);
+  usage_ += entry_size;
+  index_[k] = loc;
+}
+
+bool LogStructuredCache::Lookup(const Slice& key, std::string* contents) {
+  Location loc;
+  {
+    MutexLock l(&mutex_);
+    std::map<std::string, Location>::const_iterator it =
+        index_.find(key.ToString());
+    if (it == index_.end()) {
+      return false;
+    }
+    loc = it->second;
+    if (loc.segment->file == NULL) {
+      contents->assign(loc.segment->buffer.data() + loc.offset +
+                       kEntryHeaderSize, loc.size);
+      return true;
+    }
+    loc.segment->refs++;
+  }
+
+  // Read the entry outside the lock; the reference keeps the segment's
+  // file open even if the segment is dropped meanwhile.
+  const size_t n = kEntryHeaderSize + loc.size;
+  char* scratch = new char[n];
+  Slice entry;
+  Status s = loc.segment->file->Read(loc.offset, n, &entry, scratch);
+  bool found = false;
+  if (s.ok() && entry.size() == n) {
+    const uint32_t crc = crc32c::Unmask(DecodeFixed32(entry.data()));
+    const uint32_t actual = crc32c::Extend(
+        crc32c::Value(key.data(), key.size()),
+        entry.data() + kEntryHeaderSize, loc.size);
+    if (actual == crc) {
+      contents->assign(entry.data() + kEntryHeaderSize, loc.size);
+      found = true;
+    }
+  }
+  delete[] scratch;
+
+  MutexLock l(&mutex_);
+  Unref(loc.segment);
+  return found;
+}
+
+uint64_t LogStructuredCache::NewId() {
+  MutexLock l(&mutex_);
+  return ++(last_id_);
+}
+
+void LogStructuredCache::WaitForWrites() {
+  MutexLock l(&mutex_);
+  while (!sealed_.empty() && writer_running_) {
+    done_cv_.Wait();
+  }
+}
+
+}  // end anonymous namespace
+
+Status NewPersistentCache(Env* env, const std::string& dir,
+                          uint64_t capacity,
+                          PersistentCache** result) {
+  *result = NULL;
+  LogStructuredCache* cache = new LogStructuredCache(env, dir, capacity);
+  Status s = cache->Open();
+  if (s.ok()) {
+    *result = cache;
+  } else {
+    delete cache;
+  }
+  return s;
+}
+
+}
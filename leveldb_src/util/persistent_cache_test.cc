@@ -0,0 +1,182 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/persistent_cache.h"
+
+#include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/coding.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+static std::string Key(int k) {
+  std::string result;
+  PutFixed64(&result, k);
+  return result;
+}
+
+static std::string Value(int k, size_t len) {
+  char c = static_cast<char>('a' + (k % 26));
+  return std::string(len, c);
+}
+
+class PersistentCacheTest {
+ public:
+  static const uint64_t kCapacity = 64 << 10;
+
+  // Holds up the creation of segment files while stalled
+  class StallingEnv : public EnvWrapper {
+   public:
+    port::Mutex gate_;
+
+    StallingEnv() : EnvWrapper(Env::Default()) { }
+
+    virtual Status NewWritableFile(const std::string& f, WritableFile** r) {
+      gate_.Lock();
+      gate_.Unlock();
+      return target()->NewWritableFile(f, r);
+    }
+  };
+
+  StallingEnv env_stalling_;
+  Env* env_;
+  std::string dir_;
+  PersistentCache* cache_;
+
+  PersistentCacheTest() : env_(&env_stalling_), cache_(NULL) {
+    dir_ = test::TmpDir() + "/persistent_cache_test";
+    Reopen();
+  }
+
+  ~PersistentCacheTest() {
+    delete cache_;
+  }
+
+  void Reopen() {
+    delete cache_;
+    cache_ = NULL;
+    ASSERT_OK(NewPersistentCache(env_, dir_, kCapacity, &cache_));
+  }
+
+  // Insert the entry for "k" and wait for any segment it filled to be
+  // written, so that no entry is dropped for a slow writer.
+  void Insert(int k) {
+    cache_->Insert(Key(k), Value(k, 1000));
+    cache_->WaitForWrites();
+  }
+
+  bool Lookup(int k, std::string* value) {
+    return cache_->Lookup(Key(k), value);
+  }
+
+  int CountSegmentFiles() {
+    std::vector<std::string> children;
+    env_->GetChildren(dir_, &children);
+    int count = 0;
+    for (size_t i = 0; i < children.size(); i++) {
+      if (children[i].size() > 7 &&
+          children[i].substr(children[i].size() - 7) == ".pcache") {
+        count++;
+      }
+    }
+    return count;
+  }
+};
+
+TEST(PersistentCacheTest, InsertAndLookup) {
+  std::string value;
+  ASSERT_TRUE(!Lookup(1, &value));
+
+  // Enough entries to fill several segments, but not the whole cache
+  for (int i = 0; i < 40; i++) {
+    Insert(i);
+  }
+  ASSERT_GT(CountSegmentFiles(), 0);
+  for (int i = 0; i < 40; i++) {
+    ASSERT_TRUE(Lookup(i, &value));
+    ASSERT_EQ(Value(i, 1000), value);
+  }
+  ASSERT_TRUE(!Lookup(40, &value));
+
+  // A second insert of the same key is ignored
+  cache_->Insert(Key(3), Value(4, 1000));
+  ASSERT_TRUE(Lookup(3, &value));
+  ASSERT_EQ(Value(3, 1000), value);
+}
+
+TEST(PersistentCacheTest, EvictsOldestSegments) {
+  const int kNum = 1000;
+  for (int i = 0; i < kNum; i++) {
+    Insert(i);
+  }
+
+  std::string value;
+  int found = 0;
+  for (int i = 0; i < kNum; i++) {
+    if (Lookup(i, &value)) {
+      ASSERT_EQ(Value(i, 1000), value);
+      found++;
+    }
+  }
+  ASSERT_GT(found, 0);
+  ASSERT_LE(found * 1000, kCapacity);
+
+  // Most recent entries survive, oldest ones are gone
+  ASSERT_TRUE(Lookup(kNum - 1, &value));
+  ASSERT_TRUE(!Lookup(0, &value));
+  ASSERT_LE(CountSegmentFiles(), 9);
+}
+
+TEST(PersistentCacheTest, RestartStartsCold) {
+  for (int i = 0; i < 100; i++) {
+    Insert(i);
+  }
+  ASSERT_GT(CountSegmentFiles(), 0);
+
+  // A file left behind by a process that did not shut down cleanly
+  delete cache_;
+  cache_ = NULL;
+  ASSERT_OK(WriteStringToFile(env_, "garbage", dir_ + "/000007.pcache"));
+
+  Reopen();
+  ASSERT_EQ(0, CountSegmentFiles());
+  std::string value;
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(!Lookup(i, &value));
+  }
+}
+
+TEST(PersistentCacheTest, DropsWhenWriterFallsBehind) {
+  // Inserts go on while no segment can be written; once the writer is
+  // behind, further entries are dropped instead of blocking.
+  env_stalling_.gate_.Lock();
+  const int kNum = 200;
+  for (int i = 0; i < kNum; i++) {
+    cache_->Insert(Key(i), Value(i, 1000));
+  }
+  std::string value;
+  ASSERT_TRUE(Lookup(0, &value));
+  ASSERT_TRUE(!Lookup(kNum - 1, &value));
+  ASSERT_EQ(0, CountSegmentFiles());
+
+  env_stalling_.gate_.Unlock();
+  cache_->WaitForWrites();
+  ASSERT_GT(CountSegmentFiles(), 0);
+  ASSERT_TRUE(Lookup(0, &value));
+  ASSERT_EQ(Value(0, 1000), value);
+}
+
+TEST(PersistentCacheTest, NewId) {
+  uint64_t a = cache_->NewId();
+  uint64_t b = cache_->NewId();
+  ASSERT_NE(a, b);
+}
+
+}
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -0,0 +1,174 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include <algorithm>
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+RateLimiter::~RateLimiter() {
+}
+
+namespace {
+
+class GenericRateLimiter : public RateLimiter {
+ public:
+  GenericRateLimiter(Env* env, int64_t bytes_per_second, bool auto_tuned);
+
+  virtual void Request(size_t bytes, Priority pri);
+  virtual int64_t GetBytesPerSecond() const;
+  virtual void SetBytesPerSecond(int64_t bytes_per_second);
+  virtual uint64_t GetTotalBytesThrough() const;
+
+ private:
+  static const uint64_t kRefillPeriodMicros = 100000;
+
+  // Number of refill periods after which an auto-tuned rate is adjusted
+  static const int kTuningPeriods = 100;
+
+  void Refill();
+  void Tune();
+
+  Env* const env_;
+  const bool auto_tuned_;
+
+  mutable port::Mutex mutex_;
+  int64_t max_bytes_per_second_;
+  int64_t bytes_per_second_;
+  int64_t available_;                   // Tokens left in this period
+  uint64_t next_refill_micros_;
+  int high_pri_waiting_;
+  uint64_t total_bytes_through_;
+
+  // Refill periods seen since the rate was last tuned, and how many of
+  // them ran out of tokens
+  int periods_;
+  int drained_periods_;
+  bool drained_;                        // This period ran out of tokens
+};
+
+GenericRateLimiter::GenericRateLimiter(Env* env, int64_t bytes_per_second,
+                                       bool auto_tuned)
+    : env_(env),
+      auto_tuned_(auto_tuned),
+      max_bytes_per_second_(std::max<int64_t>(bytes_per_second, 1)),
+      bytes_per_second_(max_bytes_per_second_),
+      available_(0),
+      next_refill_micros_(0),
+      high_pri_waiting_(0),
+      total_bytes_through_(0),
+      periods_(0),
+      drained_periods_(0),
+      drained_(false) {
+}
+
+// Start a new period if the current one is over.  Tokens left from
+// earlier periods are dropped, so an idle limiter does not save up for
+// a burst.
+void GenericRateLimiter::Refill() {
+  mutex_.AssertHeld();
+  const uint64_t now = env_->NowMicros();
+  if (now < next_refill_micros_) {
+    return;
+  }
+  if (auto_tuned_) {
+    periods_++;
+    if (drained_) {
+      drained_periods_++;
+    }
+    drained_ = false;
+    if (periods_ >= kTuningPeriods) {
+      Tune();
+    }
+  }
+  available_ = std::max<int64_t>(
+      bytes_per_second_ * kRefillPeriodMicros / 1000000, 1);
+  next_refill_micros_ = now + kRefillPeriodMicros;
+}
+
+// Raise the rate by 5% if nearly every period ran out of tokens, or
+// lower it by 5% if most periods did not.
+void GenericRateLimiter::Tune() {
+  mutex_.AssertHeld();
+  const int percent_drained = drained_periods_ * 100 / periods_;
+  const int64_t min_bytes_per_second =
+      std::max<int64_t>(max_bytes_per_second_ / 20, 1);
+  if (percent_drained > 90) {
+    bytes_per_second_ = std::min(max_bytes_per_second_,
+                                 bytes_per_second_ * 21 / 20 + 1);
+  } else if (percent_drained < 50) {
+    bytes_per_second_ = std::max(min_bytes_per_second,
+                                 bytes_per_second_ * 19 / 20);
+  }
+  periods_ = 0;
+  drained_periods_ = 0;
+}
+
+void GenericRateLimiter::Request(size_t bytes, Priority pri) {
+  MutexLock l(&mutex_);
+  total_bytes_through_ += bytes;
+  if (pri == kHigh) {
+    high_pri_waiting_++;
+  }
+  int64_t left = static_cast<int64_t>(bytes);
+  while (true) {
+    Refill();
+    if (pri == kHigh || high_pri_waiting_ == 0) {
+      const int64_t granted = std::min(left, available_);
+      available_ -= granted;
+      left -= granted;
+      if (left == 0) {
+        break;
+      }
+    }
+
+    // Wait for the next period
+    drained_ = true;
+    const uint64_t now = env_->NowMicros();
+    const uint64_t wait =
+        (next_refill_micros_ > now) ? next_refill_micros_ - now : 0;
+    mutex_.Unlock();
+    env_->SleepForMicroseconds(static_cast<int>(wait));
+    mutex_.Lock();
+  }
+  if (pri == kHigh) {
+    high_pri_waiting_--;
+  }
+}
+
+int64_t GenericRateLimiter::GetBytesPerSecond() const {
+  MutexLock l(&mutex_);
+  return bytes_per_second_;
+}
+
+void GenericRateLimiter::SetBytesPerSecond(int64_t bytes_per_second) {
+  MutexLock l(&mutex_);
+  max_bytes_per_second_ = std::max<int64_t>(bytes_per_second, 1);
+  if (auto_tuned_) {
+    bytes_per_second_ = std::min(bytes_per_second_, max_bytes_per_second_);
+    bytes_per_second_ = std::max(bytes_per_second_,
+                                 std::max<int64_t>(max_bytes_per_second_ / 20,
+                                                   1));
+  } else {
+    bytes_per_second_ = max_bytes_per_second_;
+  }
+}
+
+uint64_t GenericRateLimiter::GetTotalBytesThrough() const {
+  MutexLock l(&mutex_);
+  return total_bytes_through_;
+}
+
+}  // end anonymous namespace
+
+RateLimiter* NewGenericRateLimiter(int64_t bytes_per_second,
+                                   bool auto_tuned) {
+  return new GenericRateLimiter(Env::Default(), bytes_per_second, auto_tuned);
+}
+
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include "leveldb/env.h"
+#include "port/port.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class RateLimiterTest { };
+
+TEST(RateLimiterTest, Rate) {
+  RateLimiter* limiter = NewGenericRateLimiter(1 << 20);
+  ASSERT_EQ(1 << 20, limiter->GetBytesPerSecond());
+
+  // The first tenth of a second is available right away; the rest of
+  // 300KB takes two more
+  Env* env = Env::Default();
+  const uint64_t start = env->NowMicros();
+  for (int i = 0; i < 30; i++) {
+    limiter->Request(10 << 10, RateLimiter::kLow);
+  }
+  const uint64_t elapsed = env->NowMicros() - start;
+  ASSERT_GE(elapsed, 150000);
+  ASSERT_LT(elapsed, 2000000);
+  ASSERT_EQ(300 << 10, limiter->GetTotalBytesThrough());
+
+  limiter->SetBytesPerSecond(1 << 10);
+  ASSERT_EQ(1 << 10, limiter->GetBytesPerSecond());
+  delete limiter;
+}
+
+namespace {
+struct LowPriorityState {
+  RateLimiter* limiter;
+  port::AtomicPointer done;
+};
+
+static void LowPriorityRequest(void* arg) {
+  LowPriorityState* state = reinterpret_cast<LowPriorityState*>(arg);
+  state->limiter->Request(50 << 10, RateLimiter::kLow);
+  state->done.Release_Store(state);
+}
+}
+
+TEST(RateLimiterTest, HighPriorityFirst) {
+  // 10KB per tenth of a second
+  RateLimiter* limiter = NewGenericRateLimiter(100 << 10);
+  LowPriorityState state;
+  state.limiter = limiter;
+  state.done.Release_Store(NULL);
+  Env* env = Env::Default();
+  env->StartThread(&LowPriorityRequest, &state);
+  env->SleepForMicroseconds(20000);
+
+  // Served ahead of the low priority request that started first
+  limiter->Request(20 << 10, RateLimiter::kHigh);
+  ASSERT_TRUE(state.done.Acquire_Load() == NULL);
+  while (state.done.Acquire_Load() == NULL) {
+    env->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ(70 << 10, limiter->GetTotalBytesThrough());
+  delete limiter;
+}
+
+}
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
@@ -623,6 +623,23 @@ Status Win32Env::GetFileSize( const std::string& fname, uint64_t* file_size )
     return sRet;
 }
 
+Status Win32Env::GetFileModificationTime( const std::string& fname, uint64_t* file_mtime )
+{
+    Status sRet;
+    std::string path = fname;
+    Win32::ModifyPath(path);
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if(::GetFileAttributesExW(Win32::MultiByteToWChar(path.c_str()),
+        GetFileExInfoStandard,&data)){
+        // FILETIME counts 100ns intervals since 1601-01-01
+        uint64_t t = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) |
+            data.ftLastWriteTime.dwLowDateTime;
+        *file_mtime = (t - 116444736000000000ULL) / 10000000;
+    }else
+        sRet = Status::IOError(path,"Could not get the file modification time.");
+    return sRet;
+}
+
 Status Win32Env::RenameFile( const std::string& src, const std::string& target )
 {
     Status sRet;
@@ -173,6 +173,9 @@ public:
 
     virtual Status GetFileSize(const std::string& fname, uint64_t* file_size);
 
+    virtual Status GetFileModificationTime(const std::string& fname,
+        uint64_t* file_mtime);
+
     virtual Status RenameFile(const std::string& src,
         const std::string& target);
 
@@ -71,6 +71,71 @@ BOOL Mutex::TryLock()
     return TryEnterCriticalSection(&_cs);
 }
 
+#if defined USE_VISTA_API
+
+RWMutex::RWMutex()
+{
+    InitializeSRWLock(&_lock);
+}
+
+RWMutex::~RWMutex()
+{
+}
+
+void RWMutex::ReadLock()
+{
+    AcquireSRWLockShared(&_lock);
+}
+
+void RWMutex::WriteLock()
+{
+    AcquireSRWLockExclusive(&_lock);
+}
+
+void RWMutex::ReadUnlock()
+{
+    ReleaseSRWLockShared(&_lock);
+}
+
+void RWMutex::WriteUnlock()
+{
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+#else
+
+RWMutex::RWMutex()
+{
+    InitializeCriticalSection(&_cs);
+}
+
+RWMutex::~RWMutex()
+{
+    DeleteCriticalSection(&_cs);
+}
+
+void RWMutex::ReadLock()
+{
+    EnterCriticalSection(&_cs);
+}
+
+void RWMutex::WriteLock()
+{
+    EnterCriticalSection(&_cs);
+}
+
+void RWMutex::ReadUnlock()
+{
+    LeaveCriticalSection(&_cs);
+}
+
+void RWMutex::WriteUnlock()
+{
+    LeaveCriticalSection(&_cs);
+}
+
+#endif
+
 CondVarOld::CondVarOld(Mutex* mu)
     : user_lock_(*mu),
       run_state_(RUNNING),
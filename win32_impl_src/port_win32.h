@@ -211,6 +211,33 @@ private:
     DISALLOW_COPY_AND_ASSIGN(CondVarOld);
 };
 
+// A lock that may be held by any number of readers or by one writer.
+// Without the Vista API it is an ordinary exclusive lock.
+class RWMutex
+{
+public:
+    RWMutex();
+    ~RWMutex();
+    void ReadLock();
+    void WriteLock();
+    void ReadUnlock();
+    void WriteUnlock();
+
+private:
+#if defined USE_VISTA_API
+    SRWLOCK _lock;
+#else
+    CRITICAL_SECTION _cs;
+#endif
+    DISALLOW_COPY_AND_ASSIGN(RWMutex);
+};
+
+inline int AtomicAdd(volatile int* value, int delta)
+{
+    return InterlockedExchangeAdd(reinterpret_cast<volatile LONG*>(value),
+                                  delta) + delta;
+}
+
 #if defined USE_VISTA_API
 
 class CondVarNew